@@ -0,0 +1,136 @@
+/*
+*  C Implementation: backoff
+*
+* Description: RFC 8415 retransmission timing (IRT/MRT/MRC/MRD with jitter)
+*
+* Each retransmission timeout is doubled from the last one and randomized by
+* +/-10% (RAND), so clients that start at the same time (eg. after a BRAS came
+* back) quickly drift apart. The first SOLICIT, CONFIRM and
+* INFORMATION-REQUEST are also delayed by a random amount.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "backoff.h"
+#include "message.h"
+#include "common.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+long long backoffnow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000LL+ts.tv_nsec/1000000;
+}
+
+void backoffseed(const unsigned char*d,int len)
+{
+	unsigned int s;
+	struct timespec ts;
+	int i;
+	clock_gettime(CLOCK_REALTIME,&ts);
+	s=ts.tv_sec^ts.tv_nsec^(getpid()<<16);
+	for(i=0;i<len;i++)s=(s^d[i])*16777619U;
+	srandom(s);
+}
+
+/*returns a random value between lo and hi (inclusive) milliseconds*/
+static long long randrange(long long lo,long long hi)
+{
+	if(hi<=lo)return lo;
+	return lo+random()%(hi-lo+1);
+}
+
+/*RFC 8415 section 15: t+RAND*t with RAND in -0.1..0.1*/
+static long long jitter(long long t)
+{
+	return t+randrange(-t/10,t/10);
+}
+
+void backoffinit(struct backoff*b,int msgtype,int maxcount)
+{
+	long long delay=0;
+	b->type=msgtype;
+	b->irt=b->mrt=b->mrd=0;
+	b->mrc=0;
+	switch(msgtype){
+		case MSG_SOLICIT:
+			b->irt=SOL_TIMEOUT;b->mrt=SOL_MAX_RT;
+			delay=SOL_MAX_DELAY;
+			break;
+		case MSG_REQUEST:
+			b->irt=REQ_TIMEOUT;b->mrt=REQ_MAX_RT;b->mrc=REQ_MAX_RC;
+			break;
+		case MSG_DHCP_CONFIRM:
+			b->irt=CNF_TIMEOUT;b->mrt=CNF_MAX_RT;b->mrd=CNF_MAX_RD;
+			delay=CNF_MAX_DELAY;
+			break;
+		case MSG_RENEW:
+			b->irt=REN_TIMEOUT;b->mrt=REN_MAX_RT;
+			break;
+		case MSG_REBIND:
+			b->irt=REB_TIMEOUT;b->mrt=REB_MAX_RT;
+			break;
+		case MSG_IREQUEST:
+			b->irt=INF_TIMEOUT;b->mrt=INF_MAX_RT;
+			delay=INF_MAX_DELAY;
+			break;
+		case MSG_RELEASE:
+			b->irt=REL_TIMEOUT;b->mrc=REL_MAX_RC;
+			break;
+		case MSG_DECLINE:
+			b->irt=DEC_TIMEOUT;b->mrc=DEC_MAX_RC;
+			break;
+		default:
+			b->irt=1;b->mrc=1;
+			break;
+	}
+	b->irt*=1000;b->mrt*=1000;b->mrd*=1000;
+	if(maxcount>0 && (b->mrc==0 || maxcount<b->mrc))
+		b->mrc=maxcount;
+	b->rt=0;
+	b->count=0;
+	b->start=backoffnow();
+	b->next=b->start+randrange(0,delay*1000);
+}
+
+void backoffsetend(struct backoff*b,long long end)
+{
+	long long d=end>b->start?end-b->start:1;
+	if(!b->mrd || d<b->mrd)b->mrd=d;
+}
+
+long long backoffwait(struct backoff*b)
+{
+	long long now=backoffnow();
+	if(b->mrd && now-b->start>=b->mrd)return -1;
+	if(now<b->next)return b->next-now;
+	if(b->mrc && b->count>=b->mrc)return -1;
+	return 0;
+}
+
+void backoffsent(struct backoff*b)
+{
+	long long now=backoffnow();
+	b->count++;
+	if(b->rt==0){
+		b->rt=jitter(b->irt);
+		/*the first SOLICIT timeout must be strictly longer than IRT*/
+		if(b->type==MSG_SOLICIT)
+			b->rt=b->irt+randrange(1,b->irt/10);
+	}else
+		b->rt=jitter(2*b->rt);
+	if(b->mrt && b->rt>b->mrt)
+		b->rt=jitter(b->mrt);
+	b->next=now+b->rt;
+	/*do not wait beyond the end of the exchange*/
+	if(b->mrd && b->next>b->start+b->mrd)
+		b->next=b->start+b->mrd;
+}
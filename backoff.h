@@ -0,0 +1,74 @@
+/*
+// C Interface: backoff
+//
+// Description: RFC 8415 retransmission timing (IRT/MRT/MRC/MRD with jitter)
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_BACKOFF_H
+#define TDHCP_BACKOFF_H
+
+/*RFC 8415 section 7.6 transmission parameters, in seconds*/
+#define SOL_MAX_DELAY 1
+#define SOL_TIMEOUT 1
+#define SOL_MAX_RT 3600
+#define REQ_TIMEOUT 1
+#define REQ_MAX_RT 30
+#define REQ_MAX_RC 10
+#define CNF_MAX_DELAY 1
+#define CNF_TIMEOUT 1
+#define CNF_MAX_RT 4
+#define CNF_MAX_RD 10
+#define REN_TIMEOUT 10
+#define REN_MAX_RT 600
+#define REB_TIMEOUT 10
+#define REB_MAX_RT 600
+#define INF_MAX_DELAY 1
+#define INF_TIMEOUT 1
+#define INF_MAX_RT 3600
+#define REL_TIMEOUT 1
+#define REL_MAX_RC 4
+#define DEC_TIMEOUT 1
+#define DEC_MAX_RC 4
+
+/*retransmission state of one exchange, all times in milliseconds*/
+struct backoff {
+	/*message type*/
+	int type;
+	/*initial and maximum retransmission time, maximum duration (0: none)*/
+	long long irt,mrt,mrd;
+	/*maximum transmission count (0: none)*/
+	int mrc;
+	/*current retransmission time, transmissions so far*/
+	long long rt;
+	int count;
+	/*start of the exchange and time of the next transmission*/
+	long long start,next;
+};
+
+/*seeds the jitter generator, mixing in data that differs between hosts (eg. the DUID)*/
+void backoffseed(const unsigned char*,int);
+
+/*starts an exchange for a message type; maxcount limits the transmissions if the
+  message type has no limit of its own or a higher one (0: use the RFC values);
+  the first transmission is delayed randomly for SOLICIT, CONFIRM and INFORMATION-REQUEST*/
+void backoffinit(struct backoff*,int msgtype,int maxcount);
+/*limits the exchange to end at the absolute time end (ms, see backoffnow), eg. T2 for RENEW;
+  a shorter maximum duration of the message type is kept*/
+void backoffsetend(struct backoff*,long long end);
+
+/*returns the milliseconds until the next transmission is due (0: now)
+  or -1 if the exchange has failed*/
+long long backoffwait(struct backoff*);
+/*call after each transmission, calculates the next timeout*/
+void backoffsent(struct backoff*);
+
+/*current monotonic time in milliseconds*/
+long long backoffnow();
+
+#endif
@@ -0,0 +1,676 @@
+/*
+*  C Implementation: binding
+*
+* Description: binding table and prefix pool
+*
+* The table is a single memory segment: a header, the pool bitmap and an
+* open addressing hash table of bindings. If a name is given the segment
+* lives in POSIX shared memory and all tdhcpd processes attaching to it
+* see the same bindings. Pool slots and binding entries are claimed with
+* compare-and-swap, so every process can allocate on its own without a
+* central daemon. The only lock is taken when the binding of a client is
+* created: a process spins on one of BIND_KEYLOCKS lock words (chosen by
+* DUID hash and IAID) that it sets to its PID with CAS, so two processes
+* that see the same message cannot both insert it. The lock is held only
+* for the lookup and insert. If the holder dies a waiter takes the word
+* over once kill(pid,0) reports the PID gone - this assumes all processes
+* share one PID namespace; a reused PID just delays the takeover until
+* that process exits.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "binding.h"
+#include "common.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#define BIND_MAGIC "TDHCPBT"
+#define BIND_VERSION 5
+/*value of the ready flag once the creator has initialized the segment*/
+#define BIND_READY 0x52454459
+/*maximum amount of pool bits: 2^20 slots, the table then takes about 370MB*/
+#define BIND_MAXPOOLBITS 20
+/*default table size if there is no pool*/
+#define BIND_DEFAULTSIZE 1024
+/*number of key lock words*/
+#define BIND_KEYLOCKS 1024
+
+/*segment header*/
+struct bindhdr {
+	char magic[8];
+	unsigned int version;
+	volatile unsigned int ready;
+	/*pool parameters*/
+	struct in6_addr pool;
+	int poollen,plen;
+	unsigned int nslots;
+	/*binding table parameters*/
+	unsigned int nbind;
+	volatile unsigned int maxprobe;
+	volatile unsigned int count;
+	/*offsets of bitmap, slot index and table from start of segment*/
+	unsigned long long mapoff,slotoff,bindoff,size;
+	/*PID of the process that creates a binding with a key of this stripe, 0 if none*/
+	volatile int keylock[BIND_KEYLOCKS];
+};
+
+static struct bindhdr*hdr=0;
+static unsigned long long*poolmap=0;
+/*binding index+1 of the owner of each pool slot, 0 if free*/
+static volatile unsigned int*slotidx=0;
+static struct binding*table=0;
+/*slots this process may allocate, NULL for all*/
+static const unsigned long long*ownmask=0;
+static int shared=0,mypid=0;
+
+/*maximum number of change listeners*/
+#define BIND_MAXLISTENERS 8
+static void(*listeners[BIND_MAXLISTENERS])(int,struct binding*);
+static int nlisteners=0;
+
+static void dorelease(struct binding*,int);
+
+/*FNV-1a over the DUID; the IAID is left out, so all IAs of a client are
+  found in the same probe sequence*/
+static unsigned int bindhash(const unsigned char*duid,int len)
+{
+	unsigned int h=2166136261U;
+	int i;
+	for(i=0;i<len;i++){
+		h^=duid[i];
+		h*=16777619U;
+	}
+	return h;
+}
+
+/*calculates the segment layout into h*/
+static void calclayout(struct bindhdr*h)
+{
+	unsigned long long nw=(h->nslots+63)/64;
+	h->mapoff=(sizeof(struct bindhdr)+7)&~7ULL;
+	h->slotoff=h->mapoff+nw*8;
+	h->bindoff=(h->slotoff+h->nslots*4ULL+63)&~63ULL;
+	h->size=h->bindoff+(unsigned long long)h->nbind*sizeof(struct binding);
+}
+
+/*fills in a fresh segment*/
+static void initsegment(struct bindhdr*h)
+{
+	unsigned long long*map=(void*)((char*)h+h->mapoff);
+	unsigned int i,nw=(h->nslots+63)/64;
+	/*mark the bits behind the end of the pool as used*/
+	for(i=h->nslots;i<nw*64;i++)
+		map[i/64]|=1ULL<<(i%64);
+	h->version=BIND_VERSION;
+	Memcpy(h->magic,BIND_MAGIC,8);
+	__sync_synchronize();
+	h->ready=BIND_READY;
+}
+
+/*attaches to an existing shared segment, returns NULL on error*/
+static struct bindhdr* attachsegment(int fd,struct bindhdr*want)
+{
+	struct stat st;
+	struct bindhdr*h;
+	int i;
+	/*wait for the creator to size and initialize it*/
+	for(i=0;i<100;i++){
+		if(fstat(fd,&st)<0)return 0;
+		if(st.st_size>=sizeof(struct bindhdr))break;
+		usleep(10000);
+	}
+	if(st.st_size<sizeof(struct bindhdr)){
+		td_log(LOGERROR,"shared binding table has not been initialized by its creator");
+		return 0;
+	}
+	h=mmap(0,st.st_size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	if(h==MAP_FAILED){
+		td_log(LOGERROR,"unable to map shared binding table: %s",strerror(errno));
+		return 0;
+	}
+	for(i=0;i<100 && h->ready!=BIND_READY;i++)
+		usleep(10000);
+	if(h->ready!=BIND_READY || memcmp(h->magic,BIND_MAGIC,8)!=0 || h->version!=BIND_VERSION){
+		td_log(LOGERROR,"shared binding table has an invalid format");
+		munmap(h,st.st_size);
+		return 0;
+	}
+	if(h->size!=st.st_size || h->nslots!=want->nslots || h->poollen!=want->poollen ||
+	   h->plen!=want->plen || Memcmp(&h->pool,&want->pool,16)!=0){
+		td_log(LOGERROR,"shared binding table was created with a different pool");
+		munmap(h,st.st_size);
+		return 0;
+	}
+	if(h->nbind!=want->nbind)
+		td_log(LOGINFO,"shared binding table has %u entries, ignoring requested size",h->nbind);
+	return h;
+}
+
+int bindinit(const char*shmname,const struct in6_addr*pool,int poollen,int plen,int maxbind)
+{
+	struct bindhdr want;
+	void*mem;
+	Memzero(&want,sizeof(want));
+	mypid=getpid();
+	/*pool parameters*/
+	if(pool){
+		if(plen<=poollen || plen>128 || poollen<1 || (plen-poollen)>BIND_MAXPOOLBITS){
+			td_log(LOGERROR,"invalid pool: delegated length must be between %i and %i",poollen+1,
+				poollen+BIND_MAXPOOLBITS>128?128:poollen+BIND_MAXPOOLBITS);
+			return -1;
+		}
+		Memcpy(&want.pool,(void*)pool,16);
+		want.poollen=poollen;
+		want.plen=plen;
+		want.nslots=1U<<(plen-poollen);
+	}
+	/*table size: a quarter more than the pool keeps probe sequences short*/
+	if(maxbind>0)
+		want.nbind=maxbind;
+	else if(want.nslots)
+		want.nbind=want.nslots+want.nslots/4+16;
+	else
+		want.nbind=BIND_DEFAULTSIZE;
+	calclayout(&want);
+	/*private table*/
+	if(!shmname){
+		mem=mmap(0,want.size,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+		if(mem==MAP_FAILED){
+			td_log(LOGERROR,"unable to allocate binding table of %llu bytes: %s",want.size,strerror(errno));
+			return -1;
+		}
+		hdr=mem;
+		Memcpy(hdr,&want,sizeof(want));
+		initsegment(hdr);
+		shared=0;
+	}else{
+		int fd;
+		/*try to create it*/
+		fd=shm_open(shmname,O_RDWR|O_CREAT|O_EXCL,0600);
+		if(fd>=0){
+			if(ftruncate(fd,want.size)<0){
+				td_log(LOGERROR,"unable to size shared binding table %s: %s",shmname,strerror(errno));
+				close(fd);
+				shm_unlink(shmname);
+				return -1;
+			}
+			mem=mmap(0,want.size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+			if(mem==MAP_FAILED){
+				td_log(LOGERROR,"unable to map shared binding table %s: %s",shmname,strerror(errno));
+				close(fd);
+				shm_unlink(shmname);
+				return -1;
+			}
+			hdr=mem;
+			Memcpy(hdr,&want,sizeof(want));
+			initsegment(hdr);
+			td_log(LOGINFO,"created shared binding table %s with %u entries",shmname,hdr->nbind);
+		}else if(errno==EEXIST){
+			/*somebody else was first, attach*/
+			fd=shm_open(shmname,O_RDWR,0600);
+			if(fd<0){
+				td_log(LOGERROR,"unable to open shared binding table %s: %s",shmname,strerror(errno));
+				return -1;
+			}
+			hdr=attachsegment(fd,&want);
+			if(!hdr){
+				close(fd);
+				return -1;
+			}
+			td_log(LOGINFO,"attached to shared binding table %s, %u bindings active",shmname,hdr->count);
+		}else{
+			td_log(LOGERROR,"unable to create shared binding table %s: %s",shmname,strerror(errno));
+			return -1;
+		}
+		close(fd);
+		shared=1;
+	}
+	poolmap=(void*)((char*)hdr+hdr->mapoff);
+	slotidx=(void*)((char*)hdr+hdr->slotoff);
+	table=(void*)((char*)hdr+hdr->bindoff);
+	return 0;
+}
+
+void binddone()
+{
+	unsigned int i;
+	if(!hdr)return;
+	/*in shared mode our bindings die with the process*/
+	if(shared)
+		for(i=0;i<hdr->nbind;i++)
+			if(table[i].state==BIND_VALID && table[i].pid==mypid)
+				bindrelease(&table[i]);
+	munmap(hdr,hdr->size);
+	hdr=0;table=0;poolmap=0;slotidx=0;
+}
+
+/*finds a free pool slot that we may allocate, starting the search at start;
+  if claim is set the slot is claimed atomically; returns BIND_NOSLOT if the pool is exhausted*/
+static unsigned int findslot(unsigned int start,int claim)
+{
+	unsigned int n,w,w0,nw;
+	unsigned long long old,freebits,m;
+	nw=(hdr->nslots+63)/64;
+	start%=hdr->nslots;
+	w0=start/64;
+	for(n=0;n<nw;n++){
+		w=(w0+n)%nw;
+		while((old=poolmap[w])!=~0ULL){
+			freebits=~old;
+			if(ownmask)freebits&=ownmask[w];
+			if(!freebits)break;
+			/*in the first word prefer the bits from start on*/
+			if(n==0){
+				m=freebits&(~0ULL<<(start%64));
+				if(m)freebits=m;
+			}
+			m=1ULL<<__builtin_ctzll(freebits);
+			if(!claim)
+				return w*64+__builtin_ctzll(m);
+			if(__sync_bool_compare_and_swap(&poolmap[w],old,old|m))
+				return w*64+__builtin_ctzll(m);
+		}
+	}
+	return BIND_NOSLOT;
+}
+
+/*claims exactly this slot, returns false if it is taken or not ours*/
+static bool claimexact(unsigned int slot)
+{
+	unsigned long long old,m;
+	if(slot>=hdr->nslots)return false;
+	m=1ULL<<(slot%64);
+	if(ownmask && !(ownmask[slot/64]&m))return false;
+	do{
+		old=poolmap[slot/64];
+		if(old&m)return false;
+	}while(!__sync_bool_compare_and_swap(&poolmap[slot/64],old,old|m));
+	return true;
+}
+
+static void freeslot(unsigned int slot)
+{
+	if(slot>=hdr->nslots)return;
+	__sync_fetch_and_and(&poolmap[slot/64],~(1ULL<<(slot%64)));
+}
+
+struct binding* bindfindclient(const unsigned char*duid,int duidlen,unsigned int*cursor)
+{
+	unsigned int h,n;
+	struct binding*b;
+	if(!hdr || duidlen<=0 || duidlen>BIND_MAXDUID)return 0;
+	h=bindhash(duid,duidlen);
+	n=hdr->maxprobe;
+	while(*cursor<=n && *cursor<hdr->nbind){
+		b=&table[(h+ (*cursor)++)%hdr->nbind];
+		if(b->state==BIND_EMPTY)break;
+		if(b->state==BIND_VALID && b->hash==h &&
+		   b->duidlen==duidlen && memcmp(b->duid,duid,duidlen)==0)
+			return b;
+	}
+	*cursor=hdr->nbind;
+	return 0;
+}
+
+struct binding* bindbyslot(unsigned int slot)
+{
+	unsigned int i;
+	struct binding*b;
+	if(!hdr || slot>=hdr->nslots)return 0;
+	i=slotidx[slot];
+	if(!i)return 0;
+	b=&table[i-1];
+	if(b->state!=BIND_VALID || b->slot!=slot)return 0;
+	return b;
+}
+
+struct binding* bindfind(const unsigned char*duid,int duidlen,unsigned int iaid)
+{
+	unsigned int h,i,n;
+	struct binding*b;
+	if(!hdr || duidlen<=0 || duidlen>BIND_MAXDUID)return 0;
+	h=bindhash(duid,duidlen);
+	n=hdr->maxprobe;
+	for(i=0;i<=n && i<hdr->nbind;i++){
+		b=&table[(h+i)%hdr->nbind];
+		if(b->state==BIND_EMPTY)return 0;
+		if(b->state==BIND_VALID && b->hash==h && b->iaid==iaid &&
+		   b->duidlen==duidlen && memcmp(b->duid,duid,duidlen)==0)
+			return b;
+	}
+	return 0;
+}
+
+/*takes the lock of a key, returns its index; a lock held by a dead process is taken over*/
+static unsigned int lockkey(unsigned int h,unsigned int iaid)
+{
+	unsigned int k=(h^(iaid*2654435761U))%BIND_KEYLOCKS;
+	int owner,n=0;
+	if(!shared)return k;
+	while(!__sync_bool_compare_and_swap(&hdr->keylock[k],0,mypid)){
+		owner=hdr->keylock[k];
+		if(owner && ++n>=1000){
+			n=0;
+			if(kill(owner,0)<0 && errno==ESRCH)
+				__sync_bool_compare_and_swap(&hdr->keylock[k],owner,0);
+		}
+		sched_yield();
+	}
+	return k;
+}
+
+static void unlockkey(unsigned int k)
+{
+	if(!shared)return;
+	__sync_synchronize();
+	hdr->keylock[k]=0;
+}
+
+/*calls all listeners*/
+static void notify(int ev,struct binding*b)
+{
+	int i;
+	for(i=0;i<nlisteners;i++)
+		listeners[i](ev,b);
+}
+
+/*inserts a new entry for a client that owns slot, returns NULL if the table is full*/
+static struct binding* newentry(unsigned int h,const unsigned char*duid,int duidlen,unsigned int iaid,unsigned int slot)
+{
+	unsigned int i,m,st;
+	struct binding*b;
+	for(i=0;i<hdr->nbind;i++){
+		b=&table[(h+i)%hdr->nbind];
+		st=b->state;
+		if(st!=BIND_EMPTY && st!=BIND_FREE)continue;
+		if(!__sync_bool_compare_and_swap(&b->state,st,BIND_BUSY))continue;
+		/*it is ours now, fill it*/
+		b->pid=mypid;
+		b->hash=h;
+		b->iaid=iaid;
+		b->slot=slot;
+		b->expires=0;
+		b->cltime=time(0);
+		b->duidlen=duidlen;
+		Memcpy(b->duid,(void*)duid,duidlen);
+		Memzero(&b->peer,sizeof(b->peer));
+		b->peerscope=0;
+		b->haskey=0;
+		b->relayed=0;
+		__sync_synchronize();
+		b->state=BIND_VALID;
+		if(slot!=BIND_NOSLOT)
+			slotidx[slot]=(h+i)%hdr->nbind+1;
+		/*make sure lookups probe far enough*/
+		while((m=hdr->maxprobe)<i)
+			if(__sync_bool_compare_and_swap(&hdr->maxprobe,m,i))break;
+		__sync_fetch_and_add(&hdr->count,1);
+		return b;
+	}
+	td_log(LOGWARN,"binding table is full (%u entries)",hdr->nbind);
+	return 0;
+}
+
+unsigned int bindoffer(const unsigned char*duid,int duidlen,unsigned int iaid)
+{
+	struct binding*b;
+	if(!hdr || !hdr->nslots || duidlen<=0 || duidlen>BIND_MAXDUID)return BIND_NOSLOT;
+	b=bindfind(duid,duidlen,iaid);
+	if(b)return b->slot;
+	return findslot(bindhash(duid,duidlen),0);
+}
+
+/*finds or creates a binding, strict allows no other slot than want*/
+static struct binding* claim(const unsigned char*duid,int duidlen,unsigned int iaid,unsigned int want,int strict)
+{
+	unsigned int h,k,slot;
+	struct binding*b;
+	if(!hdr || duidlen<=0 || duidlen>BIND_MAXDUID)return 0;
+	/*already known?*/
+	b=bindfind(duid,duidlen,iaid);
+	if(b){
+		b->cltime=time(0);
+		return b;
+	}
+	h=bindhash(duid,duidlen);
+	k=lockkey(h,iaid);
+	/*another process may have been faster*/
+	b=bindfind(duid,duidlen,iaid);
+	if(b){
+		unlockkey(k);
+		b->cltime=time(0);
+		return b;
+	}
+	/*get a prefix: the one the client asked for or the first free one behind our hash*/
+	slot=BIND_NOSLOT;
+	if(hdr->nslots){
+		if(want!=BIND_NOSLOT && claimexact(want))
+			slot=want;
+		else if(strict){
+			unlockkey(k);
+			if(want!=BIND_NOSLOT)
+				td_log(LOGINFO,"pool slot %u is not available",want);
+			return 0;
+		}else
+			slot=findslot(h,1);
+		if(slot==BIND_NOSLOT){
+			unlockkey(k);
+			td_log(LOGWARN,"prefix pool is exhausted");
+			return 0;
+		}
+	}
+	/*find a place in the table*/
+	b=newentry(h,duid,duidlen,iaid,slot);
+	unlockkey(k);
+	if(!b){
+		if(slot!=BIND_NOSLOT)freeslot(slot);
+		return 0;
+	}
+	notify(BINDEV_BIND,b);
+	return b;
+}
+
+struct binding* bindclaim(const unsigned char*duid,int duidlen,unsigned int iaid,unsigned int want)
+{
+	return claim(duid,duidlen,iaid,want,0);
+}
+
+struct binding* bindclaimexact(const unsigned char*duid,int duidlen,unsigned int iaid,unsigned int slot)
+{
+	return claim(duid,duidlen,iaid,slot,1);
+}
+
+struct binding* bindrestore(const unsigned char*duid,int duidlen,unsigned int iaid,unsigned int slot,long long expires)
+{
+	unsigned int k;
+	struct binding*b;
+	if(!hdr || duidlen<=0 || duidlen>BIND_MAXDUID)return 0;
+	if(slot!=BIND_NOSLOT && slot>=hdr->nslots){
+		td_log(LOGWARN,"cannot restore binding for slot %u, the pool only has %u slots",slot,hdr->nslots);
+		return 0;
+	}
+	k=lockkey(bindhash(duid,duidlen),iaid);
+	/*known with the same slot: just update it*/
+	b=bindfind(duid,duidlen,iaid);
+	if(b && b->slot!=slot){
+		dorelease(b,BINDEV_RELEASE);
+		b=0;
+	}
+	if(!b){
+		/*claim exactly this slot, it was allocated by the other server*/
+		if(slot!=BIND_NOSLOT){
+			const unsigned long long*own=ownmask;
+			bool ok;
+			ownmask=0;
+			ok=claimexact(slot);
+			ownmask=own;
+			if(!ok){
+				unlockkey(k);
+				td_log(LOGWARN,"cannot restore binding, pool slot %u is already in use",slot);
+				return 0;
+			}
+		}
+		b=newentry(bindhash(duid,duidlen),duid,duidlen,iaid,slot);
+		unlockkey(k);
+		if(!b){
+			if(slot!=BIND_NOSLOT)freeslot(slot);
+			return 0;
+		}
+		b->expires=expires;
+		notify(BINDEV_BIND,b);
+	}else{
+		unlockkey(k);
+		if(b->expires!=expires){
+			b->expires=expires;
+			notify(BINDEV_RENEW,b);
+		}
+	}
+	return b;
+}
+
+/*releases a binding, ev tells listeners why*/
+static void dorelease(struct binding*b,int ev)
+{
+	unsigned int slot;
+	if(!hdr || !b)return;
+	/*only one process may release it*/
+	if(!__sync_bool_compare_and_swap(&b->state,BIND_VALID,BIND_BUSY))return;
+	notify(ev,b);
+	slot=b->slot;
+	b->slot=BIND_NOSLOT;
+	if(slot!=BIND_NOSLOT){
+		__sync_bool_compare_and_swap(&slotidx[slot],(b-table)+1,0);
+		freeslot(slot);
+	}
+	__sync_fetch_and_sub(&hdr->count,1);
+	__sync_synchronize();
+	b->state=BIND_FREE;
+}
+
+void bindrelease(struct binding*b)
+{
+	dorelease(b,BINDEV_RELEASE);
+}
+
+void bindrenew(struct binding*b,long long expires)
+{
+	if(!hdr || !b || b->state!=BIND_VALID)return;
+	b->cltime=time(0);
+	if(b->expires!=expires){
+		b->expires=expires;
+		notify(BINDEV_RENEW,b);
+	}
+}
+
+struct binding* bindnext(unsigned int*cursor)
+{
+	struct binding*b;
+	if(!hdr)return 0;
+	while(*cursor<hdr->nbind){
+		b=&table[(*cursor)++];
+		if(b->state==BIND_VALID)return b;
+	}
+	return 0;
+}
+
+int bindaddlistener(void(*l)(int,struct binding*))
+{
+	if(nlisteners>=BIND_MAXLISTENERS)return -1;
+	listeners[nlisteners]=l;
+	return nlisteners++;
+}
+
+bool bindhaspool()
+{
+	return hdr && hdr->nslots;
+}
+
+int bindpoollen()
+{
+	return hdr?hdr->plen:0;
+}
+
+unsigned int bindpoolsize()
+{
+	return hdr?hdr->nslots:0;
+}
+
+void bindsetowned(const unsigned long long*mask)
+{
+	ownmask=mask;
+}
+
+void bindslotprefix(unsigned int slot,struct in6_addr*pre)
+{
+	unsigned char*p=(unsigned char*)pre;
+	int i,bit;
+	Memcpy(pre,&hdr->pool,16);
+	/*the slot number goes right behind the pool prefix*/
+	for(i=0;i<hdr->plen-hdr->poollen;i++){
+		bit=hdr->plen-1-i;
+		if(slot&(1U<<i))
+			p[bit/8]|=0x80>>(bit%8);
+		else
+			p[bit/8]&=~(0x80>>(bit%8));
+	}
+}
+
+unsigned int bindprefixslot(const struct in6_addr*pre)
+{
+	const unsigned char*p=(const unsigned char*)pre,*q;
+	unsigned int slot=0;
+	int i,bit;
+	if(!bindhaspool())return BIND_NOSLOT;
+	q=(const unsigned char*)&hdr->pool;
+	/*compare the pool prefix*/
+	for(i=0;i<hdr->poollen;i++)
+		if((p[i/8]^q[i/8])&(0x80>>(i%8)))
+			return BIND_NOSLOT;
+	/*extract slot number*/
+	for(i=0;i<hdr->plen-hdr->poollen;i++){
+		bit=hdr->plen-1-i;
+		if(p[bit/8]&(0x80>>(bit%8)))
+			slot|=1U<<i;
+	}
+	return slot;
+}
+
+void bindreap(long long now)
+{
+	unsigned int i;
+	struct binding*b;
+	if(!hdr)return;
+	for(i=0;i<hdr->nbind;i++){
+		b=&table[i];
+		if(b->state!=BIND_VALID)continue;
+		if(b->expires && b->expires<now){
+			td_log(LOGDEBUG,"binding %u expired",i);
+			dorelease(b,BINDEV_EXPIRE);
+			continue;
+		}
+		/*in shared mode bindings of dead processes are orphaned*/
+		if(shared && b->pid!=mypid && kill(b->pid,0)<0 && errno==ESRCH){
+			td_log(LOGDEBUG,"binding %u belongs to dead process %i, releasing it",i,b->pid);
+			bindrelease(b);
+		}
+	}
+}
+
+unsigned int bindcount()
+{
+	return hdr?hdr->count:0;
+}
@@ -0,0 +1,137 @@
+/*
+// C Interface: binding
+//
+// Description: binding table and prefix pool, optionally in POSIX shared
+// memory so that several tdhcpd processes hand out unique prefixes
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_BINDING_H
+#define TDHCP_BINDING_H
+
+#include "common.h"
+#include <netinet/in.h>
+
+/*binding states*/
+/*never used - ends a probe sequence*/
+#define BIND_EMPTY 0
+/*released - a tombstone, probing continues behind it*/
+#define BIND_FREE 1
+/*somebody is writing the entry right now*/
+#define BIND_BUSY 2
+/*entry is in use*/
+#define BIND_VALID 3
+
+/*marks a binding that has no slot in the prefix pool*/
+#define BIND_NOSLOT 0xffffffffU
+
+/*maximum DUID length according to RFC 3315 plus the type field*/
+#define BIND_MAXDUID 130
+/*longest Interface-ID of a relay that is remembered for RECONFIGURE*/
+#define BIND_MAXIFID 32
+
+/*a single client binding (DUID + IAID)*/
+struct binding {
+	/*BIND_* state, changed with CAS only*/
+	volatile unsigned int state;
+	/*hash of the DUID*/
+	unsigned int hash;
+	/*process that created the binding*/
+	volatile int pid;
+	/*slot in the prefix pool or BIND_NOSLOT*/
+	unsigned int slot;
+	/*IAID of the IA_PD (or IA_NA)*/
+	unsigned int iaid;
+	/*absolute expiry time, 0 means infinite*/
+	volatile long long expires;
+	/*time of the last transaction with the client*/
+	volatile long long cltime;
+	/*client DUID*/
+	unsigned short duidlen;
+	unsigned char duid[BIND_MAXDUID];
+	/*client address and interface for RECONFIGURE, :: if unknown (eg. behind
+	  more than one relay); the relay agent's address if relayed is set*/
+	struct in6_addr peer;
+	unsigned int peerscope;
+	/*reconfigure key, only valid if haskey is set*/
+	unsigned char haskey;
+	unsigned char rkey[16];
+	/*RELAY-FORW header of a client behind one relay agent, echoed in the
+	  RELAY-REPL that carries the RECONFIGURE*/
+	unsigned char relayed,relayhops,relayifidlen;
+	struct in6_addr relaylink,relaypeer;
+	unsigned char relayifid[BIND_MAXIFID];
+};
+
+/*initializes the binding table; shmname may be NULL for a private table;
+  pool may be NULL if there is no prefix pool; returns 0 on success, -1 on error*/
+int bindinit(const char*shmname,const struct in6_addr*pool,int poollen,int plen,int maxbind);
+/*detaches from the table, releases all bindings created by this process if shared*/
+void binddone();
+
+/*finds the binding of a client, returns NULL if there is none*/
+struct binding* bindfind(const unsigned char*duid,int duidlen,unsigned int iaid);
+/*iterates over all bindings (IAs) of a client, start with *cursor=0; returns NULL at the end*/
+struct binding* bindfindclient(const unsigned char*duid,int duidlen,unsigned int*cursor);
+/*returns the binding owning a pool slot, NULL if the slot is free*/
+struct binding* bindbyslot(unsigned int slot);
+/*returns the slot a client would get from bindclaim without creating any state:
+  its current slot or the first free one behind the hash of its DUID;
+  returns BIND_NOSLOT if the pool is exhausted*/
+unsigned int bindoffer(const unsigned char*duid,int duidlen,unsigned int iaid);
+/*finds or creates the binding of a client, allocates a pool slot if there is a pool
+  (want if it is still free, otherwise the one bindoffer calculates);
+  returns NULL if the table or pool is exhausted*/
+struct binding* bindclaim(const unsigned char*duid,int duidlen,unsigned int iaid,unsigned int want);
+/*like bindclaim, but a new binding gets exactly this slot (eg. chosen by an IPAM);
+  returns NULL if the slot is taken*/
+struct binding* bindclaimexact(const unsigned char*duid,int duidlen,unsigned int iaid,unsigned int slot);
+/*releases a binding and returns its slot to the pool*/
+void bindrelease(struct binding*);
+/*creates or updates a binding with a given slot and expiry time (eg. received
+  from another server); returns NULL if the slot is taken or the table is full*/
+struct binding* bindrestore(const unsigned char*duid,int duidlen,unsigned int iaid,unsigned int slot,long long expires);
+
+/*refreshes a binding after the client renewed it, listeners are only told
+  if the expiry time changes*/
+void bindrenew(struct binding*,long long expires);
+
+/*iterates over all valid bindings, start with *cursor=0; returns NULL at the end*/
+struct binding* bindnext(unsigned int*cursor);
+
+/*binding events given to listeners*/
+#define BINDEV_BIND 1
+#define BINDEV_RENEW 2
+#define BINDEV_RELEASE 3
+#define BINDEV_EXPIRE 4
+/*registers a function that is called whenever this process changes a binding;
+  on release the binding is still intact while the listener runs;
+  returns -1 if there are too many listeners*/
+int bindaddlistener(void(*)(int event,struct binding*));
+
+/*returns true if a prefix pool is configured*/
+bool bindhaspool();
+/*returns the delegated prefix length of the pool*/
+int bindpoollen();
+/*returns the amount of slots in the pool*/
+unsigned int bindpoolsize();
+/*restricts allocation of new slots to those set in mask (one bit per slot,
+  same layout as the pool bitmap); the mask must stay allocated; NULL allows all*/
+void bindsetowned(const unsigned long long*mask);
+/*calculates the prefix of a pool slot*/
+void bindslotprefix(unsigned int slot,struct in6_addr*);
+/*returns the pool slot of a prefix or BIND_NOSLOT if it is not inside the pool*/
+unsigned int bindprefixslot(const struct in6_addr*);
+
+/*reclaims expired bindings and bindings of dead processes, should be called periodically*/
+void bindreap(long long now);
+
+/*returns the amount of valid bindings*/
+unsigned int bindcount();
+
+#endif
@@ -13,6 +13,10 @@
 #include "common.h"
 #include "sock.h"
 #include "message.h"
+#include "backoff.h"
+#include "leasefile.h"
+#include "nlapply.h"
+#include "hook.h"
 
 #include <getopt.h>
 #include <stdio.h>
@@ -20,12 +24,16 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <arpa/inet.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 /*side ID, allocated in server.c (0x00) and client.c (0x01) respectively*/
 const unsigned char SIDEID=SIDE_CLIENT;
 
 
-char shortopt[]="hl:pPaAdDcCr:u:L:";
+char shortopt[]="hl:pPaAdDcCbs:w:in:k:r:u:U:L:";
 struct option longopt[]= {
  {"local-id",1,0,'l'},
  {"log-level",1,0,'L'},
@@ -38,21 +46,30 @@ struct option longopt[]= {
  {"rapid-commit",0,0,'c'},
  {"no-rapid-commit",0,0,'C'},
  {"retries",1,0,'r'},
+ {"daemon",0,0,'b'},
+ {"state-file",1,0,'s'},
+ {"wait-lladdr",1,0,'w'},
+ {"install",0,0,'i'},
+ {"lan",1,0,'n'},
+ {"hook-socket",1,0,'k'},
  {"help",0,0,'h'},
  {"duid",1,0,'u'},
+ {"duid-file",1,0,'U'},
  {0,0,0,0}
 };
 
 #include "svnrev.h"
 #define HELP \
- "Usage: %s [options] device script\n" \
+ "Usage: %s [options] device [device...] script\n" \
  "TDHCPc - Tunnel/Tiny DHCP client, revision " SVNREV "\n"\
  "(c) Konrad Rosenbaum, 2009\n"\
  "this program is protected under the GNU GPLv3 or at your option any newer\n"\
  "\n"\
  "TDHCP client parameters:\n"\
- "  device: a network device (eg. eth0, ppp0, tun0)\n" \
+ "  device: a network device (eg. eth0, ppp0, tun0); with several devices\n" \
+ "   all of them are served concurrently by this one process\n" \
  "  script: a script that is executed after fetching parameters\n" \
+ "   (\"-\" for none, eg. with --install)\n" \
  "   the script receives environment variables depending on what data has\n"\
  "   been requested and received from the server:\n"\
  "    $DNSSRV - space-separated list of DNS servers\n"\
@@ -60,6 +77,7 @@ struct option longopt[]= {
  "    $IPADDR - space-separated list of assigned IP addresses\n"\
  "    $PREFIX - space-separated list of assigned prefixes\n"\
  "    $DHCPSRV - the address of the DHCPv6 server that responded\n"\
+ "    $DEVICE - the device the configuration was received on\n"\
  "\n"\
  "TDHCP client options:\n" \
  "  -h | --help\n" \
@@ -85,20 +103,59 @@ struct option longopt[]= {
  "    set the local ID from which the DUID is calculated\n" \
  \
  "  -r num | --retries=num\n" \
- "     number of retries before the client gives up\n" \
+ "     number of transmissions before the client gives up (0: retry\n" \
+ "     forever); retransmissions back off exponentially with random\n" \
+ "     jitter as described in RFC 8415\n" \
+ \
+ "  -b | --daemon\n" \
+ "    keep the lease: after the script has been executed for the first time\n" \
+ "    the client forks into the background, renews the lease at T1, rebinds\n" \
+ "    at T2, starts over when it expires and executes the script again only\n" \
+ "    if the configuration received from the server has changed\n" \
+ \
+ "  -s file | --state-file=file\n" \
+ "    store the lease in file (file.device with several devices); on the\n" \
+ "    next start the stored configuration is passed to the script at once\n" \
+ "    and confirmed with a single REBIND, the client only falls back to\n" \
+ "    SOLICIT if that fails\n" \
+ \
+ "  -w seconds | --wait-lladdr=seconds\n" \
+ "    wait at most this long for the device to appear and its link-local\n" \
+ "    address to finish DAD before soliciting (default: 0, do not wait)\n" \
+ \
+ "  -i | --install\n" \
+ "    install the lease via netlink before the script is executed: addresses\n" \
+ "    (as /128) on the device and an unreachable route for each delegated\n" \
+ "    prefix; addresses and routes that are no longer leased are removed\n" \
+ \
+ "  -n dev | --lan=dev\n" \
+ "    give the next /64 of the first delegated prefix to LAN device dev, it\n" \
+ "    gets the address <prefix>::1/64 (repeat for each LAN, implies -i;\n" \
+ "    only with a single device)\n" \
+ \
+ "  -k path | --hook-socket=path\n" \
+ "    instead of executing the script, send each new configuration as one\n" \
+ "    line of JSON to the hook helper listening on the UNIX socket path;\n" \
+ "    the script is only executed if the helper cannot be reached\n" \
  \
  "  -u DUID | --duid=DUID\n" \
  "    set hex string as explicit DUID (overrides -l)\n" \
  \
+ "  -U file | --duid-file=file\n" \
+ "    load the DUID from file; if it does not exist yet the DUID is\n" \
+ "    calculated once and stored there (ignored with -u or -l)\n" \
+ \
  "  -L level | --log-level=level\n" \
  "    set the log level (default is warn), must be one of:\n" \
  "    none, error, warn, info, debug\n" \
  "\n"\
  "Defaults: %sget prefix, %sget address, %sget DNS,\n"\
- "          %suse rapid commit, %i retries\n"
+ "          %suse rapid commit, %i retries, wait %is for link-local\n"
 
-static char*argv0=0,*localid=0,*device=0,*script=0;
-static int getprefix=0,getaddress=0,getdns=1,retries=10,userapid=1;
+static char*argv0=0,*localid=0,*script=0,*statefile=0,*duidfile=0;
+static int getprefix=0,getaddress=0,getdns=1,retries=10,userapid=1,daemonmode=0,waitll=0;
+/*built-in netlink configuration and the LAN devices that get a /64 each*/
+static int install=0,lancnt=0;
 
 /*output the help text*/
 static void printhelp()
@@ -109,7 +166,8 @@ static void printhelp()
 		getaddress?"":"don't ",
 		getdns?"":"don't ",
 		userapid?"":"don't ",
-		retries
+		retries,
+		waitll
 	);
 }
 
@@ -117,22 +175,96 @@ static void printhelp()
 /*maximum amount of any item that we can handle: 16 is sensitive for addresses, prefixes and DNS settings*/
 #define MAXITEMS 16
 
-static struct in6_addr addresses[MAXITEMS], prefixes[MAXITEMS], dnsservers[MAXITEMS], dhcpserver;
-static char **dnsnames;
-static unsigned char prefixlens[MAXITEMS];
+/*marks infinite lifetimes and timers*/
+#define LT_INFINITE 0xffffffffUL
+
+/*states of an interface: waiting for the next exchange, exchange running, finished*/
+#define ST_WAIT 0
+#define ST_EXCHANGE 1
+#define ST_DONE 2
+
+/*one device the client runs on*/
+struct iface {
+	char*device,*statefile;
+	int fd,ifindex;
+	/*received items*/
+	struct in6_addr addresses[MAXITEMS], prefixes[MAXITEMS], dnsservers[MAXITEMS], dhcpserver;
+	char *dnsnames[MAXITEMS];
+	unsigned char prefixlens[MAXITEMS];
+	/*configuration the script has last been executed with (daemon mode)*/
+	struct in6_addr oldaddresses[MAXITEMS], oldprefixes[MAXITEMS], olddnsservers[MAXITEMS];
+	char *olddnsnames[MAXITEMS];
+	unsigned char oldprefixlens[MAXITEMS];
+	/*timers of the lease in seconds, shortest of all IAs in the last answer; T1/T2 are 0 if the server left them to us*/
+	unsigned long leaset1,leaset2,leasepref,leasevalid;
+	/*set if the server did not find a binding for one of our IAs*/
+	int leasenobinding;
+	/*exchange state: message type, the message sent and its retransmissions, the last lease*/
+	int state,type,first,ran,ret;
+	struct dhcp_msg*msg,*reply;
+	struct backoff bo;
+	int maxcount;
+	/*end of the exchange, renew time, rebind time, end of the lease, start of the next
+	  exchange (ms, -1: never)*/
+	long long limit,t1,t2,end,wake;
+};
+
+static struct iface*ifaces;
+static int numifaces=0;
 static struct in6_addr NULLADDR;
+static char*lans[MAXITEMS];
 
-static void inititems()
+/*forgets all received items*/
+static void clearitems(struct iface*ifc)
 {
-	dnsnames=Malloc(MAXITEMS*sizeof(char*));
-	Memzero(dnsnames,MAXITEMS*sizeof(char*));
-	Memzero(addresses,16*MAXITEMS);
-	Memzero(prefixes,16*MAXITEMS);
-	Memzero(dnsservers,16*MAXITEMS);
-	Memzero(prefixlens,MAXITEMS);
-	Memzero(&NULLADDR,16);
+	int i;
+	for(i=0;i<MAXITEMS;i++)
+		if(ifc->dnsnames[i]){
+			Free(ifc->dnsnames[i]);
+			ifc->dnsnames[i]=0;
+		}
+	Memzero(ifc->addresses,16*MAXITEMS);
+	Memzero(ifc->prefixes,16*MAXITEMS);
+	Memzero(ifc->dnsservers,16*MAXITEMS);
+	Memzero(ifc->prefixlens,MAXITEMS);
 }
 
+/*returns true if the received items differ from the saved configuration*/
+static int configchanged(struct iface*ifc)
+{
+	int i;
+	if(Memcmp(ifc->addresses,ifc->oldaddresses,16*MAXITEMS) ||
+	   Memcmp(ifc->prefixes,ifc->oldprefixes,16*MAXITEMS) ||
+	   Memcmp(ifc->prefixlens,ifc->oldprefixlens,MAXITEMS) ||
+	   Memcmp(ifc->dnsservers,ifc->olddnsservers,16*MAXITEMS))
+		return 1;
+	for(i=0;i<MAXITEMS;i++){
+		if(!ifc->dnsnames[i] || !ifc->olddnsnames[i]){
+			if(ifc->dnsnames[i]!=ifc->olddnsnames[i])return 1;
+			continue;
+		}
+		if(strcmp(ifc->dnsnames[i],ifc->olddnsnames[i]))return 1;
+	}
+	return 0;
+}
+
+/*remembers the received items as the current configuration*/
+static void saveconfig(struct iface*ifc)
+{
+	int i;
+	Memcpy(ifc->oldaddresses,ifc->addresses,16*MAXITEMS);
+	Memcpy(ifc->oldprefixes,ifc->prefixes,16*MAXITEMS);
+	Memcpy(ifc->oldprefixlens,ifc->prefixlens,MAXITEMS);
+	Memcpy(ifc->olddnsservers,ifc->dnsservers,16*MAXITEMS);
+	for(i=0;i<MAXITEMS;i++){
+		if(ifc->olddnsnames[i])Free(ifc->olddnsnames[i]);
+		ifc->olddnsnames[i]=0;
+		if(ifc->dnsnames[i]){
+			ifc->olddnsnames[i]=Malloc(strlen(ifc->dnsnames[i])+1);
+			Strcpy(ifc->olddnsnames[i],ifc->dnsnames[i]);
+		}
+	}
+}
 
 static int addaddr(struct in6_addr*list,struct in6_addr itm)
 {
@@ -154,7 +286,7 @@ static int addaddr(struct in6_addr*list,struct in6_addr itm)
 	return -1;
 }
 
-static void adddomain(const char*itm)
+static void adddomain(char**dnsnames,const char*itm)
 {
 	int i;
 	/*check for null items*/
@@ -174,58 +306,99 @@ static void adddomain(const char*itm)
 	}
 }
 
+/*resets the lease timers before an exchange*/
+static void initlease(struct iface*ifc)
+{
+	ifc->leaset1=ifc->leaset2=0;
+	ifc->leasepref=ifc->leasevalid=LT_INFINITE;
+	ifc->leasenobinding=0;
+}
+
+/*collects T1/T2 and the status of an IA*/
+static void leaseia(struct iface*ifc,struct dhcp_opt*ia)
+{
+	int i;
+	if(ia->opt_iapd.t1>0 && (!ifc->leaset1 || (unsigned long)ia->opt_iapd.t1<ifc->leaset1))
+		ifc->leaset1=ia->opt_iapd.t1;
+	if(ia->opt_iapd.t2>0 && (!ifc->leaset2 || (unsigned long)ia->opt_iapd.t2<ifc->leaset2))
+		ifc->leaset2=ia->opt_iapd.t2;
+	for(i=0;i<ia->opt_numopts;i++)
+		if(ia->subopt[i].opt_type==OPT_STATUS_CODE && ia->subopt[i].opt_status.status!=STAT_Success)
+			ifc->leasenobinding=1;
+}
+
+/*collects the lifetimes of an address or prefix*/
+static void leaselifetime(struct iface*ifc,unsigned long pref,unsigned long valid)
+{
+	if(pref<ifc->leasepref)ifc->leasepref=pref;
+	if(valid<ifc->leasevalid)ifc->leasevalid=valid;
+}
+
 /*parse the response message and manipulate the send message*/
-static int handlemessage(struct dhcp_msg*rmsg,struct dhcp_msg*smsg)
+static int handlemessage(struct iface*ifc,struct dhcp_msg*rmsg,struct dhcp_msg*smsg)
 {
 	int i,j,p;
+	/*the timers of the final answer count*/
+	initlease(ifc);
 	/*find DNS info*/
 	if(getdns){
 		p=messagefindoption(rmsg,OPT_DNS_SERVER);
 		if(p>=0){
 			for(i=0;i<rmsg->msg_opt[p].opt_dns_server.num_dns;i++)
-				addaddr(dnsservers,rmsg->msg_opt[p].opt_dns_server.addr[i]);
+				addaddr(ifc->dnsservers,rmsg->msg_opt[p].opt_dns_server.addr[i]);
 		}
 		p=messagefindoption(rmsg,OPT_DNS_NAME);
 		if(p>=0){
 			for(i=0;i<rmsg->msg_opt[p].opt_dns_name.num_dns;i++)
-				adddomain(rmsg->msg_opt[p].opt_dns_name.namelist[i]);
+				adddomain(ifc->dnsnames,rmsg->msg_opt[p].opt_dns_name.namelist[i]);
 		}
 	}
 	/*find PREFIX info*/
 	if(getprefix){
 		p=messagefindoption(rmsg,OPT_IAPD);
-		if(p>=0)
-		for(i=0;i<rmsg->msg_opt[p].opt_numopts;i++)
+		if(p>=0){
+			leaseia(ifc,&rmsg->msg_opt[p]);
+			for(i=0;i<rmsg->msg_opt[p].opt_numopts;i++)
 			if(rmsg->msg_opt[p].subopt[i].opt_type==OPT_IAPREFIX){
-				j=addaddr(prefixes,rmsg->msg_opt[p].subopt[i].opt_iaprefix.prefix);
+				struct dhcp_opt_iaprefix*pr=&rmsg->msg_opt[p].subopt[i].opt_iaprefix;
+				/*a valid lifetime of 0 means the prefix must no longer be used*/
+				if(pr->valid_lifetime==0)continue;
+				leaselifetime(ifc,pr->preferred_lifetime,pr->valid_lifetime);
+				j=addaddr(ifc->prefixes,pr->prefix);
 				if(j>=0)
-					prefixlens[j]=rmsg->msg_opt[p].subopt[i].opt_iaprefix.prefixlen;
+					ifc->prefixlens[j]=pr->prefixlen;
 			}
+		}
 	}
 	/*find IANA info*/
 	if(getaddress){
 		p=messagefindoption(rmsg,OPT_IANA);
-		if(p>=0)
-		for(i=0;i<rmsg->msg_opt[p].opt_numopts;i++)
-			if(rmsg->msg_opt[p].subopt[i].opt_type==OPT_IAADDR)
-				addaddr(addresses,rmsg->msg_opt[p].subopt[i].opt_iaaddress.addr);
+		if(p>=0){
+			leaseia(ifc,&rmsg->msg_opt[p]);
+			for(i=0;i<rmsg->msg_opt[p].opt_numopts;i++)
+			if(rmsg->msg_opt[p].subopt[i].opt_type==OPT_IAADDR){
+				struct dhcp_opt_iaaddress*ad=&rmsg->msg_opt[p].subopt[i].opt_iaaddress;
+				if(ad->valid_lifetime==0)continue;
+				leaselifetime(ifc,ad->preferred_lifetime,ad->valid_lifetime);
+				addaddr(ifc->addresses,ad->addr);
+			}
+		}
 	}
 	/*copy server address*/
-	Memcpy(&dhcpserver,&rmsg->msg_peer.sin6_addr,16);
+	Memcpy(&ifc->dhcpserver,&rmsg->msg_peer.sin6_addr,16);
 	/*check for rapid commit or type=REPLY; if so: tell caller it can stop now*/
 	if(rmsg->msg_type==MSG_REPLY)return 0;
 	if(messagefindoption(rmsg,OPT_RAPIDCOMMIT)>=0)return 0;
 	/*otherwise we need to continue*/
 	/*correct message type & id*/
-	clearrecvfilter();
-	if(getprefix||getaddress){
-		addrecvfilter(MSG_REPLY);
+	if(getprefix||getaddress)
 		smsg->msg_type=MSG_REQUEST;
-	}else{
-		addrecvfilter(MSG_REPLY);
+	else
 		smsg->msg_type=MSG_IREQUEST;
-	}
-	smsg->msg_id++; /*elapsed time continues to count*/
+	/*new transaction, elapsed time continues to count*/
+	xidclose(ifc->ifindex,smsg->msg_id);
+	smsg->msg_id=xidnew(ifc->ifindex);
+	xidopen(ifc->ifindex,smsg->msg_id);
 	/*rapid commit is no longer applicable*/
 	messageremoveoption(smsg,OPT_RAPIDCOMMIT);
 	/*append server ID*/
@@ -234,68 +407,543 @@ static int handlemessage(struct dhcp_msg*rmsg,struct dhcp_msg*smsg)
 	return 1;
 }
 
+/*returns true if addr is in the list of items*/
+static int hasaddr(struct in6_addr*list,struct in6_addr*addr)
+{
+	int i;
+	for(i=0;i<MAXITEMS;i++)
+		if(Memcmp(&list[i],addr,16)==0)return 1;
+	return 0;
+}
+
+/*calculates LAN subnet n (/64) of prefix/plen with interface ID ::1, returns -1 if it does not exist*/
+static int lansubnet(struct in6_addr*prefix,int plen,int n,struct in6_addr*sub)
+{
+	unsigned long long hi=0;
+	int i;
+	if(plen>64 || (plen>0 && plen<64 && (unsigned long long)n>>(64-plen)) || (plen==64 && n>0))
+		return -1;
+	for(i=0;i<8;i++)hi=hi<<8|prefix->s6_addr[i];
+	hi|=n;
+	Memzero(sub,16);
+	for(i=7;i>=0;i--,hi>>=8)sub->s6_addr[i]=hi&0xff;
+	sub->s6_addr[15]=1;
+	return 0;
+}
+
+/*installs the received configuration via netlink and removes what has been installed
+  for the saved configuration but is no longer leased; returns the number of failures*/
+static int applylease(struct iface*ifc)
+{
+	struct in6_addr sub;
+	int i;
+	nlbegin();
+	/*remove what is gone*/
+	for(i=0;i<MAXITEMS;i++){
+		if(Memcmp(&ifc->oldaddresses[i],&NULLADDR,16)==0)break;
+		if(!hasaddr(ifc->addresses,&ifc->oldaddresses[i]))
+			nladdress(ifc->device,&ifc->oldaddresses[i],128,0,0,1);
+	}
+	for(i=0;i<MAXITEMS;i++){
+		if(Memcmp(&ifc->oldprefixes[i],&NULLADDR,16)==0)break;
+		if(!hasaddr(ifc->prefixes,&ifc->oldprefixes[i]))
+			nlunreachable(&ifc->oldprefixes[i],ifc->oldprefixlens[i],1);
+	}
+	if(Memcmp(&ifc->oldprefixes[0],&ifc->prefixes[0],16)!=0 || ifc->oldprefixlens[0]!=ifc->prefixlens[0])
+		for(i=0;i<lancnt;i++)
+			if(lansubnet(&ifc->oldprefixes[0],ifc->oldprefixlens[0],i,&sub)==0)
+				nladdress(lans[i],&sub,64,0,0,1);
+	/*add new items or refresh their lifetimes*/
+	for(i=0;i<MAXITEMS;i++){
+		if(Memcmp(&ifc->addresses[i],&NULLADDR,16)==0)break;
+		nladdress(ifc->device,&ifc->addresses[i],128,ifc->leasepref,ifc->leasevalid,0);
+	}
+	for(i=0;i<MAXITEMS;i++){
+		if(Memcmp(&ifc->prefixes[i],&NULLADDR,16)==0)break;
+		nlunreachable(&ifc->prefixes[i],ifc->prefixlens[i],0);
+	}
+	if(Memcmp(&ifc->prefixes[0],&NULLADDR,16)!=0)
+		for(i=0;i<lancnt;i++){
+			if(lansubnet(&ifc->prefixes[0],ifc->prefixlens[0],i,&sub)<0){
+				td_log(LOGWARN,"prefix /%i is too small for LAN %s",(int)ifc->prefixlens[0],lans[i]);
+				continue;
+			}
+			nladdress(lans[i],&sub,64,ifc->leasepref,ifc->leasevalid,0);
+		}
+	return nlcommit()!=0;
+}
+
 /*execute the script*/
-static int execscript()
+static int execscript(struct iface*ifc)
 {
 	int i;
 	char tmp[128],buf[4096];
 	/*check there is anything to do*/
-	if(Memcmp(addresses,&NULLADDR,16)==0 &&
-	   Memcmp(prefixes,&NULLADDR,16)==0 &&
-	   Memcmp(dnsservers,&NULLADDR,16)==0 &&
-	   *dnsnames==0){
-		td_log(LOGWARN,"no information has been received from the server, not executing script");
+	if(Memcmp(ifc->addresses,&NULLADDR,16)==0 &&
+	   Memcmp(ifc->prefixes,&NULLADDR,16)==0 &&
+	   Memcmp(ifc->dnsservers,&NULLADDR,16)==0 &&
+	   *ifc->dnsnames==0){
+		td_log(LOGWARN,"no information has been received from the server on %s, not executing script",ifc->device);
 		return 1;
 	}
+	if(strcmp(script,"-")==0)return 0;
 	/*encode addresses*/
 	buf[0]=0;
 	for(i=0;i<MAXITEMS;i++){
-		if(Memcmp(&addresses[i],&NULLADDR,16)==0)break;
+		if(Memcmp(&ifc->addresses[i],&NULLADDR,16)==0)break;
 		if(i)strncat(buf," ",sizeof(buf));
-		strncat(buf,inet_ntop(AF_INET6,&addresses[i],tmp,sizeof(tmp)),sizeof(buf));
+		strncat(buf,inet_ntop(AF_INET6,&ifc->addresses[i],tmp,sizeof(tmp)),sizeof(buf));
 	}
 	if(buf[0])setenv("IPADDR",buf,1);
+	else unsetenv("IPADDR");
 	/*encode prefixes*/
 	buf[0]=0;
 	for(i=0;i<MAXITEMS;i++){
-		if(Memcmp(&prefixes[i],&NULLADDR,16)==0)break;
+		if(Memcmp(&ifc->prefixes[i],&NULLADDR,16)==0)break;
 		if(i)strncat(buf," ",sizeof(buf));
-		strncat(buf,inet_ntop(AF_INET6,&prefixes[i],tmp,sizeof(tmp)),sizeof(buf));
-		snprintf(tmp,sizeof(tmp),"/%i",(int)prefixlens[i]);
+		strncat(buf,inet_ntop(AF_INET6,&ifc->prefixes[i],tmp,sizeof(tmp)),sizeof(buf));
+		snprintf(tmp,sizeof(tmp),"/%i",(int)ifc->prefixlens[i]);
 		strncat(buf,tmp,sizeof(buf));
 	}
 	if(buf[0])setenv("PREFIX",buf,1);
+	else unsetenv("PREFIX");
 	/*encode DNS servers*/
 	buf[0]=0;
 	for(i=0;i<MAXITEMS;i++){
-		if(Memcmp(&dnsservers[i],&NULLADDR,16)==0)break;
+		if(Memcmp(&ifc->dnsservers[i],&NULLADDR,16)==0)break;
 		if(i)strncat(buf," ",sizeof(buf));
-		strncat(buf,inet_ntop(AF_INET6,&dnsservers[i],tmp,sizeof(tmp)),sizeof(buf));
+		strncat(buf,inet_ntop(AF_INET6,&ifc->dnsservers[i],tmp,sizeof(tmp)),sizeof(buf));
 	}
 	if(buf[0])setenv("DNSSRV",buf,1);
+	else unsetenv("DNSSRV");
 	/*encode DNS search names*/
 	buf[0]=0;
 	for(i=0;i<MAXITEMS;i++){
-		if(!dnsnames[i])break;
+		if(!ifc->dnsnames[i])break;
 		if(i)strncat(buf," ",sizeof(buf));
-		strncat(buf,dnsnames[i],sizeof(buf));
+		strncat(buf,ifc->dnsnames[i],sizeof(buf));
 	}
 	if(buf[0])setenv("DNSDOM",buf,1);
+	else unsetenv("DNSDOM");
 	
 	// interface
-	if(device && device[0]) setenv("DEVICE", device, 1);
+	setenv("DEVICE", ifc->device, 1);
 	
 	/*dhcp server addr*/
-	setenv("DHCPSRV",inet_ntop(AF_INET6,&dhcpserver,tmp,sizeof(tmp)),1);
+	setenv("DHCPSRV",inet_ntop(AF_INET6,&ifc->dhcpserver,tmp,sizeof(tmp)),1);
 	/*call*/
 	return system(script)!=0;
 }
 
+/*creates a message of the given type for the interface; RENEW and REBIND quote the IAs
+  of the last reply, RENEW also addresses its server*/
+/*IAID of the IAs of an interface: its position on the command line, so it is
+  unique in this client and stays the same across restarts (the first is 0)*/
+#define IFACEIAID(ifc) ((unsigned int)((ifc)-ifaces))
+
+static struct dhcp_msg* buildmessage(struct iface*ifc,int type)
+{
+	struct dhcp_msg*msg,*reply=ifc->reply;
+	int p,q;
+	msg=newmessage(type);
+	settargetserver(&msg->msg_peer);
+	msg->msg_peer.sin6_scope_id=ifc->ifindex;
+	msg->msg_sock=ifc->fd;
+	msg->msg_id=xidnew(ifc->ifindex);
+	messageaddopt(msg,OPT_CLIENTID);
+	if(type==MSG_RENEW && reply && (p=messagefindoption(reply,OPT_SERVERID))>=0)
+		messageappendopt(msg,&reply->msg_opt[p]);
+	if(getdns){
+		messageaddoptrequest(msg,OPT_DNS_SERVER);
+		messageaddoptrequest(msg,OPT_DNS_NAME);
+	}
+	if(type==MSG_RENEW || type==MSG_REBIND){
+		if(getaddress && (p=messagefindoption(reply,OPT_IANA))>=0){
+			q=messageappendopt(msg,&reply->msg_opt[p]);
+			msg->msg_opt[q].opt_iana.t1=msg->msg_opt[q].opt_iana.t2=0;
+		}else if(getaddress)
+			msg->msg_opt[messageaddopt(msg,OPT_IANA)].opt_iana.iaid=IFACEIAID(ifc);
+		if(getprefix && (p=messagefindoption(reply,OPT_IAPD))>=0){
+			q=messageappendopt(msg,&reply->msg_opt[p]);
+			msg->msg_opt[q].opt_iapd.t1=msg->msg_opt[q].opt_iapd.t2=0;
+		}else if(getprefix)
+			msg->msg_opt[messageaddopt(msg,OPT_IAPD)].opt_iapd.iaid=IFACEIAID(ifc);
+		return msg;
+	}
+	if(getaddress)msg->msg_opt[messageaddopt(msg,OPT_IANA)].opt_iana.iaid=IFACEIAID(ifc);
+	if(getprefix)msg->msg_opt[messageaddopt(msg,OPT_IAPD)].opt_iapd.iaid=IFACEIAID(ifc);
+	if(type==MSG_SOLICIT && userapid)messageaddopt(msg,OPT_RAPIDCOMMIT);
+	return msg;
+}
+
+/*converts lease seconds into an absolute time (ms), -1 if infinite*/
+static long long leasetime(long long now,unsigned long secs)
+{
+	if(secs>=LT_INFINITE)return -1;
+	return now+secs*1000LL;
+}
+
+/*returns path relative to the current directory as an absolute path,
+  daemonize() changes to / and the path must still work afterwards*/
+static char* abspath(char*path)
+{
+	char cwd[4096],*r;
+	if(path[0]=='/' || !getcwd(cwd,sizeof(cwd)))return path;
+	r=Malloc(strlen(cwd)+strlen(path)+2);
+	sprintf(r,"%s/%s",cwd,path);
+	return r;
+}
+
+/*switch to the background after the first lease, the parent returns the script status*/
+static void daemonize(int status)
+{
+	int pid;
+	umask(022);
+	if((pid=fork())<0){
+		td_log(LOGERROR,"unable to fork, staying in the foreground");
+		return;
+	}
+	if(pid!=0)exit(status);
+	setsid();
+	activatesyslog();
+	close(0);close(1);close(2);
+	open("/dev/null",O_RDWR);
+	dup(0);dup(0);
+	chdir("/");
+}
+
+/*appends a JSON string to buf*/
+static void jsonstr(char*buf,int max,const char*str)
+{
+	int l=strlen(buf);
+	if(l<max-1)buf[l++]='"';
+	for(;*str && l<max-7;str++){
+		unsigned char c=*str;
+		if(c=='"' || c=='\\'){
+			buf[l++]='\\';
+			buf[l++]=c;
+		}else if(c<0x20)
+			l+=snprintf(buf+l,max-l,"\\u%04x",c);
+		else
+			buf[l++]=c;
+	}
+	if(l<max-1)buf[l++]='"';
+	buf[l]=0;
+}
+
+/*appends "key":[...] with the addresses of a list, with prefix lengths if lens is given*/
+static void jsonaddrs(char*buf,int max,const char*key,struct in6_addr*list,unsigned char*lens)
+{
+	char tmp[128];
+	int i,l;
+	l=strlen(buf);
+	snprintf(buf+l,max-l,",\"%s\":[",key);
+	for(i=0;i<MAXITEMS;i++){
+		if(Memcmp(&list[i],&NULLADDR,16)==0)break;
+		inet_ntop(AF_INET6,&list[i],tmp,64);
+		if(lens)snprintf(tmp+strlen(tmp),sizeof(tmp)-strlen(tmp),"/%i",(int)lens[i]);
+		if(i)strncat(buf,",",max-strlen(buf)-1);
+		jsonstr(buf,max,tmp);
+	}
+	strncat(buf,"]",max-strlen(buf)-1);
+}
+
+/*sends an event with the received configuration to the hook helper, returns 0 on success*/
+static int hookevent(struct iface*ifc,const char*event)
+{
+	char buf[8192],tmp[128];
+	int i,l;
+	snprintf(buf,sizeof(buf),"{\"event\":\"%s\",\"pid\":%i,\"device\":",event,(int)getpid());
+	jsonstr(buf,sizeof(buf),ifc->device);
+	if(strcmp(event,"bound")==0){
+		l=strlen(buf);
+		snprintf(buf+l,sizeof(buf)-l,",\"server\":\"%s\",\"preferred\":%lu,\"valid\":%lu",
+			inet_ntop(AF_INET6,&ifc->dhcpserver,tmp,sizeof(tmp)),ifc->leasepref,ifc->leasevalid);
+		jsonaddrs(buf,sizeof(buf),"addresses",ifc->addresses,0);
+		jsonaddrs(buf,sizeof(buf),"prefixes",ifc->prefixes,ifc->prefixlens);
+		jsonaddrs(buf,sizeof(buf),"dns",ifc->dnsservers,0);
+		strncat(buf,",\"domains\":[",sizeof(buf)-strlen(buf)-1);
+		for(i=0;i<MAXITEMS && ifc->dnsnames[i];i++){
+			if(i)strncat(buf,",",sizeof(buf)-strlen(buf)-1);
+			jsonstr(buf,sizeof(buf),ifc->dnsnames[i]);
+		}
+		strncat(buf,"]",sizeof(buf)-strlen(buf)-1);
+	}
+	strncat(buf,"}",sizeof(buf)-strlen(buf)-1);
+	return hooksend(buf);
+}
+
+/*puts the received configuration into effect: netlink first, then the hook helper or the script*/
+static int applyconfig(struct iface*ifc)
+{
+	int ret=0;
+	if(install)ret=applylease(ifc);
+	if(hookenabled() && hookevent(ifc,"bound")==0)return ret;
+	return execscript(ifc)|ret;
+}
+
+/*sets up the retransmission timing, once per exchange (or phase: SOLICIT, then REQUEST)*/
+static void startbackoff(struct iface*ifc,int timing)
+{
+	backoffinit(&ifc->bo,timing,ifc->maxcount);
+	if(ifc->limit>0)backoffsetend(&ifc->bo,ifc->limit);
+}
+
+/*starts the next exchange of the interface; after the first lease SOLICIT is retried forever*/
+static void startexchange(struct iface*ifc)
+{
+	int timing=ifc->type;
+	clearitems(ifc);
+	ifc->msg=buildmessage(ifc,ifc->type);
+	xidopen(ifc->ifindex,ifc->msg->msg_id);
+	ifc->maxcount=0;
+	ifc->limit=0;
+	if(ifc->type==MSG_RENEW)ifc->limit=ifc->t2;
+	/*confirming the cached lease is timed like a CONFIRM: retransmit quickly, give up soon*/
+	else if(ifc->type==MSG_REBIND && ifc->first){
+		timing=MSG_DHCP_CONFIRM;
+		ifc->limit=ifc->end;
+	}else if(ifc->type==MSG_REBIND)ifc->limit=ifc->end;
+	else if(ifc->first)ifc->maxcount=retries;
+	startbackoff(ifc,timing);
+	ifc->state=ST_EXCHANGE;
+}
+
+/*waits until the absolute time t (ms, -1: forever) before the next exchange*/
+static void waitexchange(struct iface*ifc,int type,long long t)
+{
+	ifc->type=type;
+	ifc->wake=t;
+	ifc->state=ST_WAIT;
+}
+
+/*continues after an exchange ended with the answer rmsg (0: none): keeps or drops
+  the lease, puts the configuration into effect and schedules the next exchange*/
+static void endexchange(struct iface*ifc,struct dhcp_msg*rmsg)
+{
+	int stateful=getaddress||getprefix;
+	int lost;
+	long long now=backoffnow();
+	xidclose(ifc->ifindex,ifc->msg->msg_id);
+	freemessage(ifc->msg);
+	ifc->msg=0;
+	/*the lease is lost if the server has no binding for us*/
+	lost=ifc->end>=0 && now>=ifc->end;
+	if(rmsg && stateful && (ifc->leasenobinding || (Memcmp(ifc->addresses,&NULLADDR,16)==0 && Memcmp(ifc->prefixes,&NULLADDR,16)==0))){
+		td_log(LOGWARN,"the server did not confirm our lease on %s",ifc->device);
+		freemessage(rmsg);
+		rmsg=0;
+		lost=1;
+		if(ifc->type==MSG_RENEW)ifc->end=now;
+	}
+	if(!rmsg){
+		if(ifc->first && ifc->type!=MSG_REBIND){
+			ifc->ret=ifc->ran?1:execscript(ifc);
+			ifc->state=ST_DONE;
+			return;
+		}
+		if(ifc->type==MSG_RENEW && (ifc->end<0 || now<ifc->end)){
+			td_log(LOGINFO,"RENEW failed on %s, trying REBIND",ifc->device);
+			waitexchange(ifc,MSG_REBIND,now);
+			return;
+		}
+		if(ifc->type==MSG_REBIND || ifc->type==MSG_RENEW){
+			td_log(LOGWARN,lost?"lease on %s expired, starting over":"lease on %s could not be confirmed, starting over",ifc->device);
+			/*keep the cached lease if the server was just not reachable*/
+			if(lost)leaseremove(ifc->statefile);
+			if(hookenabled() && ifc->ran)hookevent(ifc,"expired");
+			/*take back what has been installed, it is no longer ours*/
+			if(install && ifc->ran){
+				clearitems(ifc);
+				applylease(ifc);
+				saveconfig(ifc);
+			}
+			if(ifc->reply)freemessage(ifc->reply);
+			ifc->reply=0;
+			waitexchange(ifc,stateful?MSG_SOLICIT:MSG_IREQUEST,now);
+		}else
+			/*the server has nothing for us right now*/
+			waitexchange(ifc,ifc->type,now+(stateful?SOL_MAX_RT:INF_MAX_RT)*1000LL);
+		return;
+	}
+	/*got a lease*/
+	if(ifc->reply)freemessage(ifc->reply);
+	ifc->reply=rmsg;
+	if(stateful){
+		unsigned long r1=ifc->leaset1,r2=ifc->leaset2;
+		/*RFC 8415 18.2.4: T1/T2 left to the client are 0.5 and 0.8 times the preferred lifetime*/
+		if(!r1)r1=ifc->leasepref>=LT_INFINITE?LT_INFINITE:ifc->leasepref/2;
+		if(!r2)r2=r1>=LT_INFINITE?LT_INFINITE:r1*8/5;
+		if(r1>r2)r1=r2;
+		ifc->t1=leasetime(now,r1);
+		ifc->t2=leasetime(now,r2);
+		ifc->end=leasetime(now,ifc->leasevalid);
+		td_log(LOGINFO,"lease on %s: renew in %lis, rebind in %lis, valid for %lis",ifc->device,
+			ifc->t1<0?-1L:(long)r1,ifc->t2<0?-1L:(long)r2,ifc->end<0?-1L:(long)ifc->leasevalid);
+		if(ifc->statefile)leasesave(ifc->statefile,ifc->reply);
+		waitexchange(ifc,MSG_RENEW,ifc->t1);
+	}else{
+		/*RFC 8415 21.23: default information refresh time*/
+		ifc->t1=leasetime(now,86400);
+		waitexchange(ifc,MSG_IREQUEST,ifc->t1);
+	}
+	/*execute the script if something has changed*/
+	if(!ifc->ran || configchanged(ifc)){
+		ifc->ret=applyconfig(ifc);
+		saveconfig(ifc);
+		ifc->ran=1;
+	}else{
+		/*same lease: only refresh the lifetimes of what is installed*/
+		if(install && applylease(ifc))
+			td_log(LOGWARN,"could not refresh the lease lifetimes on %s",ifc->device);
+		td_log(LOGDEBUG,"configuration of %s unchanged, not executing script",ifc->device);
+	}
+	if(ifc->first){
+		ifc->first=0;
+		if(!daemonmode)ifc->state=ST_DONE;
+	}
+}
+
+/*prepares the interface: a cached lease is applied right away and confirmed with REBIND*/
+static void startiface(struct iface*ifc)
+{
+	int stateful=getaddress||getprefix;
+	ifc->first=1;
+	ifc->ret=1;
+	ifc->t1=ifc->t2=ifc->end=-1;
+	waitexchange(ifc,stateful?MSG_SOLICIT:MSG_IREQUEST,0);
+	if(stateful && ifc->statefile && (ifc->reply=leaseload(ifc->statefile))!=0){
+		handlemessage(ifc,ifc->reply,0);
+		ifc->end=leasetime(backoffnow(),ifc->leasevalid);
+		td_log(LOGINFO,"using cached lease from %s, confirming it",ifc->statefile);
+		ifc->ret=applyconfig(ifc);
+		saveconfig(ifc);
+		ifc->ran=1;
+		ifc->type=MSG_REBIND;
+	}
+}
+
+/*does whatever is due on the interface, returns the milliseconds until its next timer or -1 if there is none*/
+static long long ifacetimer(struct iface*ifc)
+{
+	long long wait;
+	while(1){
+		if(ifc->state==ST_WAIT){
+			if(ifc->wake<0)return -1;
+			wait=ifc->wake-backoffnow();
+			if(wait>0)return wait;
+			startexchange(ifc);
+		}else if(ifc->state==ST_EXCHANGE){
+			wait=backoffwait(&ifc->bo);
+			if(wait>0)return wait;
+			if(wait==0){
+				if(ifc->bo.count)
+					td_log(LOGDEBUG,"timeout on %s, retransmission %i",ifc->device,ifc->bo.count);
+				sendmessage(ifc->msg);
+				backoffsent(&ifc->bo);
+				continue;
+			}
+			td_log(LOGWARN,"no answer on %s after %i transmissions, giving up",ifc->device,ifc->bo.count);
+			endexchange(ifc,0);
+		}else
+			return -1;
+	}
+}
+
+/*handles a message received on the interface*/
+static void ifacemessage(struct iface*ifc,struct dhcp_msg*rmsg)
+{
+	struct dhcp_msg*smsg=ifc->msg;
+	int type=smsg->msg_type;
+	/*only answers to the running exchange are of interest: ADVERTISE (or a rapid commit REPLY)
+	  for SOLICIT, REPLY for everything else*/
+	if(ifc->state!=ST_EXCHANGE || rmsg->msg_id!=smsg->msg_id ||
+	   (smsg->msg_type==MSG_SOLICIT ? rmsg->msg_type==MSG_REPLY && !userapid : rmsg->msg_type!=MSG_REPLY)){
+		td_log(LOGINFO,"received unexpected message of type %i on %s, dropping it",(int)rmsg->msg_type,ifc->device);
+		freemessage(rmsg);
+		return;
+	}
+	if(handlemessage(ifc,rmsg,smsg)==0){
+		endexchange(ifc,rmsg);
+		return;
+	}
+	freemessage(rmsg);
+	/*next phase (REQUEST), it has its own timing; the running one is kept otherwise*/
+	if(smsg->msg_type!=type)startbackoff(ifc,smsg->msg_type);
+}
+
+/*gets a lease on each interface and executes the script; in daemon mode the leases are kept alive
+  afterwards, all retransmissions and renewals are driven by this single loop; returns the exit code*/
+static int runclient()
+{
+	int i,ret,pending,active,daemonized=0;
+	for(i=0;i<numifaces;i++)
+		startiface(&ifaces[i]);
+	while(1){
+		fd_set rfd,xfd;
+		struct timeval tv;
+		int sret,maxfd=-1;
+		long long wait=-1,w;
+		/*run timers, find the next one*/
+		for(i=0;i<numifaces;i++){
+			w=ifacetimer(&ifaces[i]);
+			if(w>=0 && (wait<0 || w<wait))wait=w;
+		}
+		/*every interface has its first result: finish or switch to the background*/
+		ret=pending=active=0;
+		for(i=0;i<numifaces;i++){
+			ret|=ifaces[i].ret;
+			if(ifaces[i].state!=ST_DONE){
+				active++;
+				if(ifaces[i].first)pending++;
+			}
+		}
+		if(!active)return ret;
+		if(!pending && daemonmode && !daemonized){
+			daemonize(ret);
+			daemonized=1;
+		}
+		//wait for event, wake up once a day at least since select does not like huge timeouts
+		if(wait<0 || wait>86400000LL)wait=86400000LL;
+		FD_ZERO(&rfd);
+		FD_ZERO(&xfd);
+		for(i=0;i<numifaces;i++)
+			if(ifaces[i].state!=ST_DONE){
+				FD_SET(ifaces[i].fd,&rfd);
+				FD_SET(ifaces[i].fd,&xfd);
+				if(ifaces[i].fd>maxfd)maxfd=ifaces[i].fd;
+			}
+		tv.tv_sec=wait/1000;
+		tv.tv_usec=(wait%1000)*1000;
+		sret=select(maxfd+1,&rfd,0,&xfd,&tv);
+		//check for errors
+		if(sret<0){
+			int e=errno;
+			if(e==EAGAIN || e==EINTR)continue;
+			td_log(LOGERROR,"Error caught: %s\n",strerror(e));
+			exit(1);
+		}
+		//check for events
+		if(sret>0)
+			for(i=0;i<numifaces;i++){
+				if(ifaces[i].state==ST_DONE)continue;
+				if(FD_ISSET(ifaces[i].fd,&rfd)){
+					struct dhcp_msg*msg;
+					msg=readmessagefrom(ifaces[i].fd,0);
+					if(msg)ifacemessage(&ifaces[i],msg);
+				}
+				if(FD_ISSET(ifaces[i].fd,&xfd)){
+					td_log(LOGERROR,"Exception on socket of %s caught.\n",ifaces[i].device);
+					exit(1);
+				}
+			}
+	}
+}
+
 /*main loop, message sender, etc.pp.*/
 int main(int argc,char**argv)
 {
-	int c,optindex=1;
-	struct dhcp_msg *msg;
+	int c,i,optindex=1;
 	/*parse options*/
 	argv0=*argv;
         while(1){
@@ -311,8 +959,18 @@ int main(int argc,char**argv)
                         case 'r':retries=atoi(optarg);break;
                         case 'l':localid=optarg;break;
                         case 'u':setduid(optarg);break;
+                        case 'U':duidfile=optarg;break;
                         case 'c':userapid=1;break;
                         case 'C':userapid=0;break;
+                        case 'b':daemonmode=1;break;
+                        case 's':statefile=abspath(optarg);break;
+                        case 'w':waitll=atoi(optarg);break;
+                        case 'i':install=1;break;
+                        case 'k':hooksetsocket(abspath(optarg));break;
+                        case 'n':
+                                if(lancnt<MAXITEMS)lans[lancnt++]=optarg;
+                                install=1;
+                                break;
                         case 'L':setloglevel(optarg);break;
                         default:
                                 fprintf(stderr,"Syntax error in arguments.\n");
@@ -325,82 +983,57 @@ int main(int argc,char**argv)
                                 break;
                 }
         }
-        if((optind+2)!=argc){
+        if((optind+2)>argc){
         	fprintf(stderr,"Syntax error.\n");
         	printhelp();
         	return 1;
 	}
-	device=argv[optind];
-	script=argv[optind+1];
+	numifaces=argc-optind-1;
+	script=argv[argc-1];
+	/*a name without a slash is searched in PATH by the shell*/
+	if(strchr(script,'/'))script=abspath(script);
+	if(lancnt>0 && numifaces>1){
+		fprintf(stderr,"Error: --lan can only be used with a single device.\n");
+		return 1;
+	}
 
 	if(DUIDLEN==0){
 		if(localid)
 			setlocalid(localid);
-		else
-			initlocalid();
+		else if(!duidfile || loadduid(duidfile)<0){
+			initlocalid(0);
+			if(duidfile)saveduid(duidfile);
+		}
 	}
-	/*init socket*/
-	initsocket(DHCP_CLIENTPORT,device);
-	if(sockfd<0){
-		td_log(LOGERROR,"unable to allocate socket, exiting.");
+	/*init sockets, as soon as the link-local addresses can be bound*/
+	if(waitll>0)
+		waitlladdr(argv+optind,numifaces,waitll);
+	ifaces=Malloc(numifaces*sizeof(struct iface));
+	if(!ifaces){
+		td_log(LOGERROR,"out of memory, exiting.");
 		exit(1);
 	}
-	/*init my own stuff*/
-	inititems();
-	/*init SOLICIT/IREQ msg*/
-	if(!getaddress && !getprefix){
-		msg=newmessage(MSG_IREQUEST);
-		addrecvfilter(MSG_REPLY);
-	}else{
-		msg=newmessage(MSG_SOLICIT);
-		addrecvfilter(MSG_ADVERTISE);
-	}
-	COMPAREMSGID=1;
-	settargetserver(&msg->msg_peer);
-	messageaddopt(msg,OPT_CLIENTID);
-	if(getdns){
-		messageaddoptrequest(msg,OPT_DNS_SERVER);
-		messageaddoptrequest(msg,OPT_DNS_NAME);
-	}
-	if(getaddress)messageaddopt(msg,OPT_IANA);
-	if(getprefix)messageaddopt(msg,OPT_IAPD);
-	if(userapid&&(getaddress||getprefix))messageaddopt(msg,OPT_RAPIDCOMMIT);
-	/*start main loop*/
-	for(c=0;c<retries;c++){
-		sendmessage(msg);
-		fd_set rfd,xfd;
-		struct timeval tv;
-		int sret;
-		//wait for event
-		FD_ZERO(&rfd);
-		FD_ZERO(&xfd);
-		FD_SET(sockfd,&rfd);
-		FD_SET(sockfd,&xfd);
-		tv.tv_sec=1;
-		tv.tv_usec=0;
-		sret=select(sockfd+1,&rfd,0,&xfd,&tv);
-		//check for errors
-		if(sret<0){
-			int e=errno;
-			if(e==EAGAIN)continue;
-			td_log(LOGERROR,"Error caught: %s\n",strerror(e));
-			return 1;
+	Memzero(ifaces,numifaces*sizeof(struct iface));
+	Memzero(&NULLADDR,16);
+	for(i=0;i<numifaces;i++){
+		ifaces[i].device=argv[optind+i];
+		ifaces[i].fd=initifsocket(DHCP_CLIENTPORT,ifaces[i].device,&ifaces[i].ifindex);
+		if(ifaces[i].fd<0){
+			td_log(LOGERROR,"unable to allocate socket for %s, exiting.",ifaces[i].device);
+			exit(1);
 		}
-		//check for event
-		if(sret>0){
-			if(FD_ISSET(sockfd,&rfd)){
-				struct dhcp_msg*msg2;
-				msg2=readmessage();
-				if(msg2)
-					if(handlemessage(msg2,msg)==0)break;
-			}
-			if(FD_ISSET(sockfd,&xfd)){
-				td_log(LOGERROR,"Exception on socket caught.\n");
-				return 1;
-			}
+		/*every device keeps its own lease*/
+		if(statefile && numifaces>1){
+			ifaces[i].statefile=Malloc(strlen(statefile)+strlen(ifaces[i].device)+2);
+			sprintf(ifaces[i].statefile,"%s.%s",statefile,ifaces[i].device);
 		}else
-			td_log(LOGDEBUG,"timeout, iteration %i",c);
+			ifaces[i].statefile=statefile;
 	}
-	/*execute script*/
-	return execscript();
+	/*init my own stuff*/
+	clearrecvfilter();
+	addrecvfilter(MSG_ADVERTISE);
+	addrecvfilter(MSG_REPLY);
+	COMPAREMSGID=1;
+	backoffseed(DUID,DUIDLEN);
+	return runclient();
 }
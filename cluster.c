@@ -0,0 +1,173 @@
+/*
+*  C Implementation: cluster
+*
+* Description: consistent hash pool sharding
+*
+* The pool is cut into a fixed number of slices. Every node puts a number of
+* virtual points onto a 32bit hash ring, every slice belongs to the node
+* owning the first point at or behind the hash of the slice. All nodes are
+* given the same list of node IDs, so they agree on the owners without ever
+* talking to each other. Adding or removing a node only moves the slices
+* that are adjacent to its points (about 1/n of them).
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "cluster.h"
+#include "binding.h"
+#include "common.h"
+#include "md5.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*maximum number of nodes*/
+#define CLUSTER_MAXNODES 64
+/*virtual points per node on the ring*/
+#define CLUSTER_VNODES 64
+/*maximum number of slices the pool is cut into*/
+#define CLUSTER_SLICES 1024
+
+struct ringpoint {
+	unsigned int hash;
+	int node;
+};
+
+static char*nodes[CLUSTER_MAXNODES];
+static int nodecnt=0,mynode=-1;
+static char*mynodename=0;
+
+static struct ringpoint*ring=0;
+static int ringsize=0;
+static unsigned int nslices=0,nslots=0;
+static unsigned long long*owned=0;
+
+void clustersetnode(const char*id)
+{
+	mynodename=Malloc(strlen(id)+1);
+	Strcpy(mynodename,id);
+}
+
+int clusteraddnode(const char*id)
+{
+	int i;
+	if(!id || !*id)return -1;
+	for(i=0;i<nodecnt;i++)
+		if(strcmp(nodes[i],id)==0)return i;
+	if(nodecnt>=CLUSTER_MAXNODES){
+		td_log(LOGWARN,"unable to add cluster node %s, a maximum of %i is allowed",id,CLUSTER_MAXNODES);
+		return -1;
+	}
+	nodes[nodecnt]=Malloc(strlen(id)+1);
+	Strcpy(nodes[nodecnt],id);
+	return nodecnt++;
+}
+
+bool clusterenabled()
+{
+	return mynodename!=0 || nodecnt>0;
+}
+
+const char* clusternodename(int n)
+{
+	if(n<0 || n>=nodecnt)return "";
+	return nodes[n];
+}
+
+/*hashes a string plus a number into a ring position*/
+static unsigned int ringhash(const char*s,unsigned int n)
+{
+	MD5_CTX ctx;
+	unsigned char md[16],num[4];
+	num[0]=n>>24;num[1]=n>>16;num[2]=n>>8;num[3]=n;
+	MD5Init(&ctx);
+	if(s)MD5Update(&ctx,(void*)s,strlen(s));
+	MD5Update(&ctx,num,4);
+	MD5Final(md,&ctx);
+	return ((unsigned int)md[0])<<24 | md[1]<<16 | md[2]<<8 | md[3];
+}
+
+static int cmppoint(const void*a,const void*b)
+{
+	const struct ringpoint*x=a,*y=b;
+	if(x->hash!=y->hash)return x->hash<y->hash?-1:1;
+	/*break ties deterministically*/
+	return strcmp(nodes[x->node],nodes[y->node]);
+}
+
+/*returns the node owning a slice*/
+static int sliceowner(unsigned int slice)
+{
+	unsigned int h=ringhash(0,slice);
+	int lo=0,hi=ringsize;
+	/*first point with hash>=h*/
+	while(lo<hi){
+		int mid=(lo+hi)/2;
+		if(ring[mid].hash<h)lo=mid+1;
+		else hi=mid;
+	}
+	if(lo==ringsize)lo=0;
+	return ring[lo].node;
+}
+
+int clusterinit()
+{
+	int i,j,cnt=0;
+	unsigned int s,k,first,last;
+	if(!clusterenabled())return 0;
+	if(!mynodename){
+		td_log(LOGERROR,"cluster nodes given, but no node ID for this server");
+		return -1;
+	}
+	/*all nodes must build the same ring, so our own ID has to be in the list*/
+	for(mynode=0;mynode<nodecnt;mynode++)
+		if(strcmp(nodes[mynode],mynodename)==0)break;
+	if(mynode>=nodecnt){
+		td_log(LOGERROR,"cluster node %s is not in the list of cluster nodes (-N)",mynodename);
+		mynode=-1;
+		return -1;
+	}
+	nslots=bindpoolsize();
+	if(!nslots){
+		td_log(LOGERROR,"cluster mode requires a prefix pool");
+		return -1;
+	}
+	/*build ring*/
+	ringsize=nodecnt*CLUSTER_VNODES;
+	ring=Malloc(ringsize*sizeof(struct ringpoint));
+	for(i=0;i<nodecnt;i++)
+		for(j=0;j<CLUSTER_VNODES;j++){
+			ring[i*CLUSTER_VNODES+j].hash=ringhash(nodes[i],j);
+			ring[i*CLUSTER_VNODES+j].node=i;
+		}
+	qsort(ring,ringsize,sizeof(struct ringpoint),cmppoint);
+	/*mark the slots of our slices*/
+	nslices=nslots<CLUSTER_SLICES?nslots:CLUSTER_SLICES;
+	owned=Malloc(((nslots+63)/64)*8);
+	Memzero(owned,((nslots+63)/64)*8);
+	for(s=0;s<nslices;s++){
+		if(sliceowner(s)!=mynode)continue;
+		cnt++;
+		first=(unsigned long long)s*nslots/nslices;
+		last=(unsigned long long)(s+1)*nslots/nslices;
+		for(k=first;k<last;k++)
+			owned[k/64]|=1ULL<<(k%64);
+		td_log(LOGDEBUG,"cluster: own slice %u (slots %u-%u)",s,first,last-1);
+	}
+	td_log(LOGINFO,"cluster node %s owns %i of %u slices of the pool (%i nodes)",mynodename,cnt,nslices,nodecnt);
+	if(!cnt)
+		td_log(LOGWARN,"cluster node %s does not own any part of the pool",mynodename);
+	bindsetowned(owned);
+	return 0;
+}
+
+int clusterslotowner(unsigned int slot)
+{
+	if(!ring || slot>=nslots)return -1;
+	return sliceowner((unsigned long long)slot*nslices/nslots);
+}
@@ -0,0 +1,35 @@
+/*
+// C Interface: cluster
+//
+// Description: consistent hash ring that shards the prefix pool between
+// several server nodes
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_CLUSTER_H
+#define TDHCP_CLUSTER_H
+
+#include "common.h"
+
+/*sets the ID of this node*/
+void clustersetnode(const char*);
+/*adds a node to the ring, returns its index or -1 on error*/
+int clusteraddnode(const char*);
+/*returns true if cluster mode is configured*/
+bool clusterenabled();
+
+/*builds the ring and restricts the binding pool to the slices owned by
+  this node; must be called after bindinit; returns 0 on success, -1 on error*/
+int clusterinit();
+
+/*returns the index of the node owning a pool slot, -1 if not in cluster mode*/
+int clusterslotowner(unsigned int slot);
+/*returns the ID of a node*/
+const char* clusternodename(int);
+
+#endif
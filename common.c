@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <netdb.h>
 #include <stdlib.h>
+#include <fcntl.h>
 
 const unsigned long PEN=34360;
 
@@ -58,22 +59,26 @@ static void calcduid()
 }
 
 
-void initlocalid()
+void initlocalid(int resolve)
 {
 	MD5_CTX ctx;
 	char s[1024];
-	struct hostent*he;
+	struct hostent*he=0;
 	
 	MD5Init(&ctx);
+	s[0]=0;
 	gethostname(s,sizeof(s));
 	
-	he=gethostbyname(s);
+	/*the client does not ask the resolver: it may block for a long time while
+	  the uplink is still down*/
+	if(resolve)he=gethostbyname(s);
 	if(he && he->h_name){
 		td_log(LOGDEBUG,"FQDN=%s",he->h_name);
 		MD5Update(&ctx,(void*)he->h_name,strlen(he->h_name));
 	}else{
 		td_log(LOGDEBUG,"host=%s",s);
 		MD5Update(&ctx,(void*)s,strlen(s)+1);
+		s[0]=0;
 		getdomainname(s,sizeof(s));
 		td_log(LOGDEBUG,"domain=%s",s);
 		MD5Update(&ctx,(void*)s,strlen(s));
@@ -92,7 +97,8 @@ void setlocalid(const char*s)
 	calcduid();
 }
 
-void setduid(const char*hx)
+/*parses a hex string into DUID*/
+static void parseduid(const char*hx)
 {
 	int i,k;
 	DUIDLEN=0;
@@ -111,11 +117,70 @@ void setduid(const char*hx)
 			k=1;
 		}
 	}
+}
+
+void setduid(const char*hx)
+{
+	parseduid(hx);
 	dumpduid();
 }
 
+int loadduid(const char*file)
+{
+	char buf[4096];
+	int fd,len;
+	fd=open(file,O_RDONLY);
+	if(fd<0)return -1;
+	len=read(fd,buf,sizeof(buf)-1);
+	close(fd);
+	if(len<=0)return -1;
+	buf[len]=0;
+	parseduid(buf);
+	/*a DUID has at least a type and some data*/
+	if(DUIDLEN<3){
+		td_log(LOGWARN,"DUID file %s is not valid, ignoring it",file);
+		DUIDLEN=0;
+		return -1;
+	}
+	dumpduid();
+	return 0;
+}
+
+int saveduid(const char*file)
+{
+	char buf[4096],tmp[1024];
+	int fd,i,len;
+	static const char hex[]="0123456789abcdef";
+	if(DUIDLEN<=0 || DUIDLEN*2+1>sizeof(buf))return -1;
+	for(i=0;i<DUIDLEN;i++){
+		buf[i*2]=hex[DUID[i]>>4];
+		buf[i*2+1]=hex[DUID[i]&0xf];
+	}
+	buf[DUIDLEN*2]='\n';
+	len=DUIDLEN*2+1;
+	/*write a temporary file and rename it, so that a crash does not leave half a DUID*/
+	snprintf(tmp,sizeof(tmp),"%s.new",file);
+	fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0644);
+	if(fd<0 || write(fd,buf,len)!=len){
+		td_log(LOGWARN,"unable to write DUID file %s",tmp);
+		if(fd>=0){
+			close(fd);
+			unlink(tmp);
+		}
+		return -1;
+	}
+	close(fd);
+	if(rename(tmp,file)<0){
+		td_log(LOGWARN,"unable to rename %s to %s",tmp,file);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
 static int usesyslog=0;
 int loglevel=LOGWARN;
+static void(*logfunc)(int,const char*)=0;
 
 void setloglevel(const char*l)
 {
@@ -133,7 +198,11 @@ void td_log(int prio,const char*fmt,...)
 	va_list ap;
 	if(prio<loglevel)return;
 	va_start(ap,fmt);
-	if(usesyslog){
+	if(logfunc){
+		char msg[1024];
+		vsnprintf(msg,sizeof(msg),fmt,ap);
+		logfunc(prio,msg);
+	}else if(usesyslog){
 		int p2=LOG_INFO;
 		switch(prio){
 			case LOGDEBUG:p2=LOG_DEBUG;break;
@@ -153,6 +222,12 @@ void td_log(int prio,const char*fmt,...)
 		}
 		vfprintf(stderr,fmt2,ap);
 	}
+	va_end(ap);
+}
+
+void setlogfunc(void(*f)(int,const char*))
+{
+	logfunc=f;
 }
 
 void activatesyslog()
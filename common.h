@@ -28,12 +28,17 @@ extern unsigned char LOCALID[16];
 extern int DUIDLEN;
 extern unsigned char DUID[1024];
 
-/*calculate local id from querying the system for its identifier*/
-void initlocalid();
+/*calculate local id from querying the system for its identifier; with resolve
+  the FQDN from the resolver is used if there is one, otherwise host and domain name*/
+void initlocalid(int resolve);
 /*set local id from string (calculates MD5 of this string)*/
 void setlocalid(const char*);
 /*set DUID directly from hex string*/
 void setduid(const char*);
+/*load the DUID from a file (hex string as for setduid); returns 0 on success, -1 if there is no valid DUID*/
+int loadduid(const char*);
+/*store the DUID in a file, returns 0 on success, -1 on error*/
+int saveduid(const char*);
 
 #define LOGDEBUG 0
 #define LOGINFO 1
@@ -53,6 +58,9 @@ extern int loglevel;
 /*switches to syslog*/
 void activatesyslog();
 
+/*sends all log messages that pass the log level to f instead, eg. the logger of a host program*/
+void setlogfunc(void(*f)(int prio,const char*msg));
+
 
 /*emulate C++ boolean type*/
 #define bool int
@@ -0,0 +1,379 @@
+/*
+*  C Implementation: event
+*
+* Description: stream of binding events for external consumers
+*
+* Consumers (accounting, RADIUS glue) connect to a UNIX stream socket and
+* receive one JSON object per line for every bind, renew, release and expire
+* of this process. The binding listener only copies the change into a fixed
+* ring; encoding and sending happen once per main loop iteration with
+* non-blocking writes. Each consumer has its own position in the ring: one
+* that falls behind by more than the ring size loses the oldest events,
+* gets a "dropped" line with the count and continues with the newest ones.
+* A slow consumer therefore never stalls the message handling.
+* A passive replication standby reports nothing: the bindings it restores
+* (and releases on a snapshot resync) are reported by the active server.
+*
+* "%i" in the socket path is replaced by the device name, so every session
+* of the pppd plugin gets its own socket. If the socket cannot be opened
+* the server runs without events.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "event.h"
+#include "binding.h"
+#include "replic.h"
+#include "common.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+/*events kept for slow consumers*/
+#define EV_RINGSIZE 8192
+/*maximum number of consumers*/
+#define EV_MAXCONN 8
+/*output buffer per consumer*/
+#define EV_OUTBUF 65536
+/*upper bound for one encoded event*/
+#define EV_MAXREC 512
+
+/*one binding change*/
+struct evrecord {
+	long long time,expires;
+	/*binding of a new bind, until its client address is known (end of the iteration)*/
+	struct binding*bind;
+	struct in6_addr prefix,peer;
+	unsigned int iaid,slot;
+	unsigned char ev,plen,duidlen;
+	unsigned char duid[BIND_MAXDUID];
+};
+
+/*a consumer*/
+struct evconn {
+	int fd;
+	/*next event to send*/
+	unsigned long long seq;
+	/*events lost so far, and lost but not yet reported*/
+	unsigned long long dropped,unreported;
+	char out[EV_OUTBUF];
+	int outoff,outlen;
+};
+
+static const char*evpath=0,*evdevice="";
+/*the socket path with the device name filled in*/
+static struct sockaddr_un evaddr;
+static int listenfd=-1,listening=0,nconns=0,mypid=0;
+static struct evconn*conns[EV_MAXCONN];
+static struct evrecord*ring=0;
+/*sequence of the next event; events before complete are ready to be sent*/
+static unsigned long long nextseq=0,complete=0;
+static unsigned long long evsent=0,evdropped=0;
+
+void eventsetsocket(const char*p)
+{
+	evpath=p;
+}
+
+bool eventenabled()
+{
+	return evpath!=0;
+}
+
+static void eventlistener(int ev,struct binding*b)
+{
+	struct evrecord*r;
+	/*nobody listens: nothing to remember; bindings of other processes
+	  belong to the event streams of their own devices, replicated ones
+	  to the stream of the active server*/
+	if(!nconns || b->pid!=mypid || replpassive())return;
+	/*the lifetime of a new binding is set right after it was made*/
+	if(ev==BINDEV_RENEW && nextseq>complete){
+		r=&ring[(nextseq-1)%EV_RINGSIZE];
+		if(r->bind==b){
+			r->expires=b->expires;
+			return;
+		}
+	}
+	r=&ring[nextseq%EV_RINGSIZE];
+	r->ev=ev;
+	r->time=time(0);
+	r->expires=b->expires;
+	r->iaid=b->iaid;
+	r->slot=b->slot;
+	r->duidlen=b->duidlen;
+	Memcpy(r->duid,b->duid,b->duidlen);
+	if(b->slot!=BIND_NOSLOT){
+		bindslotprefix(b->slot,&r->prefix);
+		r->plen=bindpoollen();
+	}else
+		r->plen=0;
+	Memcpy(&r->peer,&b->peer,16);
+	/*the server records the client address after binding*/
+	r->bind=ev==BINDEV_BIND?b:0;
+	nextseq++;
+}
+
+/*oldest event still in the ring*/
+static unsigned long long firstseq()
+{
+	return nextseq>EV_RINGSIZE?nextseq-EV_RINGSIZE:0;
+}
+
+/*encodes one event as a line of JSON, returns its length*/
+static int encode(char*buf,int size,struct evrecord*r)
+{
+	static const char*names[]={"","bind","renew","release","expire"};
+	char hex[2*BIND_MAXDUID+1],a[64];
+	int i,l;
+	for(i=0;i<r->duidlen;i++)
+		snprintf(hex+2*i,3,"%02x",r->duid[i]);
+	hex[2*i]=0;
+	l=snprintf(buf,size,"{\"event\":\"%s\",\"time\":%lld,\"pid\":%i,\"device\":\"%s\",\"duid\":\"%s\",\"iaid\":%u",
+		names[r->ev],r->time,(int)getpid(),evdevice,hex,r->iaid);
+	if(r->plen)
+		l+=snprintf(buf+l,size-l,",\"prefix\":\"%s/%i\"",inet_ntop(AF_INET6,&r->prefix,a,sizeof(a)),(int)r->plen);
+	l+=snprintf(buf+l,size-l,",\"expires\":%lld",r->expires);
+	if(!IN6_IS_ADDR_UNSPECIFIED(&r->peer))
+		l+=snprintf(buf+l,size-l,",\"peer\":\"%s\"",inet_ntop(AF_INET6,&r->peer,a,sizeof(a)));
+	l+=snprintf(buf+l,size-l,"}\n");
+	return l;
+}
+
+/*encodes as many pending events of c as fit into its buffer*/
+static void fillconn(struct evconn*c)
+{
+	unsigned long long first=firstseq();
+	if(c->outoff>0){
+		memmove(c->out,c->out+c->outoff,c->outlen-c->outoff);
+		c->outlen-=c->outoff;
+		c->outoff=0;
+	}
+	/*overtaken by the ring*/
+	if(c->seq<first){
+		c->unreported+=first-c->seq;
+		c->dropped+=first-c->seq;
+		evdropped+=first-c->seq;
+		c->seq=first;
+	}
+	if(c->unreported && c->outlen+EV_MAXREC<=EV_OUTBUF){
+		c->outlen+=snprintf(c->out+c->outlen,EV_OUTBUF-c->outlen,
+			"{\"event\":\"dropped\",\"time\":%lld,\"count\":%llu,\"total\":%llu}\n",
+			(long long)time(0),c->unreported,c->dropped);
+		c->unreported=0;
+	}
+	while(c->seq<complete && c->outlen+EV_MAXREC<=EV_OUTBUF){
+		c->outlen+=encode(c->out+c->outlen,EV_OUTBUF-c->outlen,&ring[c->seq%EV_RINGSIZE]);
+		c->seq++;
+		evsent++;
+	}
+}
+
+static void closeconn(int i)
+{
+	if(conns[i]->dropped)
+		td_log(LOGINFO,"event consumer disconnected, it lost %llu events",conns[i]->dropped);
+	close(conns[i]->fd);
+	Free(conns[i]);
+	conns[i]=0;
+	nconns--;
+}
+
+static void writeconn(int i)
+{
+	struct evconn*c=conns[i];
+	int r;
+	fillconn(c);
+	if(c->outoff>=c->outlen)return;
+	r=send(c->fd,c->out+c->outoff,c->outlen-c->outoff,MSG_NOSIGNAL|MSG_DONTWAIT);
+	if(r<0){
+		if(errno!=EAGAIN && errno!=EINTR)closeconn(i);
+		return;
+	}
+	c->outoff+=r;
+	if(c->outoff>=c->outlen)c->outoff=c->outlen=0;
+}
+
+/*consumers do not talk, reading only detects the end of the connection*/
+static void readconn(int i)
+{
+	char buf[256];
+	int r=recv(conns[i]->fd,buf,sizeof(buf),MSG_DONTWAIT);
+	if(r==0 || (r<0 && errno!=EAGAIN && errno!=EINTR))
+		closeconn(i);
+}
+
+static void acceptconn()
+{
+	int fd,i;
+	fd=accept(listenfd,0,0);
+	if(fd<0)return;
+	for(i=0;i<EV_MAXCONN;i++)
+		if(!conns[i])break;
+	if(i>=EV_MAXCONN){
+		td_log(LOGWARN,"too many event consumers, rejecting another one");
+		close(fd);
+		return;
+	}
+	td_log(LOGINFO,"event consumer connected");
+	fcntl(fd,F_SETFL,O_NONBLOCK);
+	conns[i]=Malloc(sizeof(struct evconn));
+	Memzero(conns[i],sizeof(struct evconn));
+	conns[i]->fd=fd;
+	/*it gets the events from now on*/
+	conns[i]->seq=nextseq;
+	nconns++;
+}
+
+/*fills the socket path into evaddr, returns -1 if it is too long*/
+static int expandpath(const char*dev)
+{
+	const char*p;
+	int l=0,n;
+	Memzero(&evaddr,sizeof(evaddr));
+	evaddr.sun_family=AF_UNIX;
+	for(p=evpath;*p;p++){
+		if(p[0]=='%' && p[1]=='i'){
+			n=strlen(dev);
+			if(l+n>=sizeof(evaddr.sun_path))return -1;
+			Memcpy(evaddr.sun_path+l,(void*)dev,n);
+			l+=n;
+			p++;
+			continue;
+		}
+		if(l+1>=sizeof(evaddr.sun_path))return -1;
+		evaddr.sun_path[l++]=*p;
+	}
+	return 0;
+}
+
+int eventinit(const char*dev)
+{
+	int fd;
+	if(!evpath)return 0;
+	evdevice=dev;
+	mypid=getpid();
+	if(!ring){
+		ring=Malloc(EV_RINGSIZE*sizeof(struct evrecord));
+		if(!ring)return -1;
+	}
+	if(!listening){
+		if(bindaddlistener(eventlistener)<0){
+			td_log(LOGERROR,"event socket: cannot register for binding changes");
+			return -1;
+		}
+		listening=1;
+	}
+	Memzero(conns,sizeof(conns));
+	nconns=0;
+	/*from here on problems only cost the events, not the service*/
+	if(expandpath(dev)<0){
+		td_log(LOGWARN,"event socket path %s is too long, running without events",evpath);
+		return 0;
+	}
+	/*remove a stale socket, but do not steal it from a running server*/
+	fd=socket(AF_UNIX,SOCK_STREAM,0);
+	if(fd>=0){
+		if(connect(fd,(struct sockaddr*)&evaddr,sizeof(evaddr))==0){
+			td_log(LOGWARN,"event socket %s is in use by another process, running without events",evaddr.sun_path);
+			close(fd);
+			return 0;
+		}
+		close(fd);
+	}
+	unlink(evaddr.sun_path);
+	listenfd=socket(AF_UNIX,SOCK_STREAM,0);
+	if(listenfd<0){
+		td_log(LOGWARN,"event socket: unable to allocate socket, running without events: %s",strerror(errno));
+		return 0;
+	}
+	if(bind(listenfd,(struct sockaddr*)&evaddr,sizeof(evaddr))<0 || listen(listenfd,EV_MAXCONN)<0){
+		td_log(LOGWARN,"event socket: unable to listen on %s, running without events: %s",evaddr.sun_path,strerror(errno));
+		close(listenfd);
+		listenfd=-1;
+		return 0;
+	}
+	fcntl(listenfd,F_SETFL,O_NONBLOCK);
+	return 0;
+}
+
+int eventfdset(fd_set*rfd,fd_set*wfd,int maxfd)
+{
+	int i;
+	if(listenfd<0)return maxfd;
+	FD_SET(listenfd,rfd);
+	if(listenfd>maxfd)maxfd=listenfd;
+	for(i=0;i<EV_MAXCONN;i++){
+		if(!conns[i])continue;
+		FD_SET(conns[i]->fd,rfd);
+		if(conns[i]->outoff<conns[i]->outlen || conns[i]->seq<complete || conns[i]->unreported)
+			FD_SET(conns[i]->fd,wfd);
+		if(conns[i]->fd>maxfd)maxfd=conns[i]->fd;
+	}
+	return maxfd;
+}
+
+void eventpoll(fd_set*rfd,fd_set*wfd)
+{
+	int i;
+	if(listenfd<0)return;
+	for(i=0;i<EV_MAXCONN;i++){
+		if(conns[i] && FD_ISSET(conns[i]->fd,wfd))
+			writeconn(i);
+		if(conns[i] && FD_ISSET(conns[i]->fd,rfd))
+			readconn(i);
+	}
+	if(FD_ISSET(listenfd,rfd))
+		acceptconn();
+}
+
+void eventflush()
+{
+	struct evrecord*r;
+	struct binding*b;
+	unsigned long long s;
+	int i;
+	if(listenfd<0)return;
+	/*new bindings know their client address by now*/
+	for(s=complete>firstseq()?complete:firstseq();s<nextseq;s++){
+		r=&ring[s%EV_RINGSIZE];
+		b=r->bind;
+		if(b && b->state==BIND_VALID && b->slot==r->slot && b->iaid==r->iaid)
+			Memcpy(&r->peer,&b->peer,16);
+		r->bind=0;
+	}
+	complete=nextseq;
+	for(i=0;i<EV_MAXCONN;i++)
+		if(conns[i] && (conns[i]->seq<complete || conns[i]->outoff<conns[i]->outlen))
+			writeconn(i);
+}
+
+void eventstats()
+{
+	if(!evpath)return;
+	td_log(LOGINFO,"statistics: %llu binding events sent, %llu dropped for slow consumers",evsent,evdropped);
+}
+
+void eventdone()
+{
+	int i;
+	if(listenfd<0)return;
+	eventflush();
+	for(i=0;i<EV_MAXCONN;i++)
+		if(conns[i])closeconn(i);
+	close(listenfd);
+	listenfd=-1;
+	unlink(evaddr.sun_path);
+}
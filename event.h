@@ -0,0 +1,39 @@
+/*
+// C Interface: event
+//
+// Description: stream of binding events for external consumers over a UNIX socket
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_EVENT_H
+#define TDHCP_EVENT_H
+
+#include "common.h"
+#include <sys/select.h>
+
+/*accept event consumers on the UNIX stream socket path*/
+void eventsetsocket(const char*path);
+/*returns true if an event socket is configured*/
+bool eventenabled();
+
+/*opens the socket and registers for binding changes of this process, call after
+  bindinit; dev is reported with every event; a socket that cannot be opened
+  only disables the events; returns 0 on success, -1 on error*/
+int eventinit(const char*dev);
+/*adds the event sockets to the select sets, returns the new maximum fd*/
+int eventfdset(fd_set*rfd,fd_set*wfd,int maxfd);
+/*handles socket events after select*/
+void eventpoll(fd_set*rfd,fd_set*wfd);
+/*sends the events of this main loop iteration to the consumers, call once per iteration*/
+void eventflush();
+/*logs the event counters*/
+void eventstats();
+/*sends what can be sent without blocking, closes all connections and removes the socket*/
+void eventdone();
+
+#endif
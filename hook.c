@@ -0,0 +1,96 @@
+/*
+*  C Implementation: hook
+*
+* Description: lease events for a persistent hook helper over a UNIX socket
+*
+* Instead of starting a shell per lease, the client writes one JSON object
+* per line to a UNIX stream socket that a single long-running helper listens
+* on. The connection stays open for the life of the client, so the helper
+* can tell instances apart and sees EOF when one exits. Writes time out after
+* a second, a slow helper does not stall the DHCP exchange.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "hook.h"
+#include "common.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+static const char*hookpath=0;
+static int hookfd=-1;
+
+void hooksetsocket(const char*p)
+{
+	hookpath=p;
+}
+
+int hookenabled()
+{
+	return hookpath!=0;
+}
+
+static int hookconnect()
+{
+	struct sockaddr_un sa;
+	struct timeval tv;
+	if(strlen(hookpath)>=sizeof(sa.sun_path)){
+		td_log(LOGERROR,"hook socket path %s is too long",hookpath);
+		return -1;
+	}
+	hookfd=socket(AF_UNIX,SOCK_STREAM,0);
+	if(hookfd<0){
+		td_log(LOGWARN,"Cannot allocate hook socket: %s.",strerror(errno));
+		return -1;
+	}
+	tv.tv_sec=1;tv.tv_usec=0;
+	setsockopt(hookfd,SOL_SOCKET,SO_SNDTIMEO,&tv,sizeof(tv));
+	Memzero(&sa,sizeof(sa));
+	sa.sun_family=AF_UNIX;
+	Strcpy(sa.sun_path,hookpath);
+	if(connect(hookfd,(struct sockaddr*)&sa,sizeof(sa))<0){
+		td_log(LOGWARN,"Cannot connect to hook helper at %s: %s.",hookpath,strerror(errno));
+		close(hookfd);
+		hookfd=-1;
+		return -1;
+	}
+	return 0;
+}
+
+/*writes all of buf, returns -1 on error*/
+static int hookwrite(const char*buf,int len)
+{
+	int n;
+	while(len>0){
+		n=send(hookfd,buf,len,MSG_NOSIGNAL);
+		if(n<0 && errno==EINTR)continue;
+		if(n<=0)return -1;
+		buf+=n;len-=n;
+	}
+	return 0;
+}
+
+int hooksend(const char*rec)
+{
+	int try;
+	if(!hookpath)return -1;
+	/*the helper may have been restarted: reconnect once*/
+	for(try=0;try<2;try++){
+		if(hookfd<0 && hookconnect()<0)return -1;
+		if(hookwrite(rec,strlen(rec))==0 && hookwrite("\n",1)==0)
+			return 0;
+		td_log(LOGINFO,"lost connection to hook helper: %s",strerror(errno));
+		close(hookfd);
+		hookfd=-1;
+	}
+	return -1;
+}
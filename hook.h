@@ -0,0 +1,25 @@
+/*
+// C Interface: hook
+//
+// Description: lease events for a persistent hook helper over a UNIX socket
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_HOOK_H
+#define TDHCP_HOOK_H
+
+/*sets the path of the helper's UNIX stream socket*/
+void hooksetsocket(const char*);
+/*returns true if a helper socket has been configured*/
+int hookenabled();
+
+/*sends one record (a JSON object without the line feed) to the helper, connecting
+  or reconnecting as needed; returns 0 on success, -1 if the helper is not reachable*/
+int hooksend(const char*);
+
+#endif
@@ -0,0 +1,468 @@
+/*
+*  C Implementation: ipam
+*
+* Description: asynchronous prefix allocation by an external IPAM
+*
+* When a SOLICIT or REQUEST asks for an IA_PD that has no binding yet, the
+* message is parked and the IPAM is asked which prefix the IA gets. All
+* queries go out pipelined over one UNIX stream connection, one line each,
+* and the answers may come back in any order:
+*   -> <id> ALLOC <DUID as hex> <IAID> <device>
+*   <- <id> OK <prefix>/<length> <ttl>
+*   <- <id> NONE <ttl>
+*   -> 0 FREE <DUID as hex> <IAID> <prefix>/<length>
+* FREE tells the IPAM that a binding was released or expired, it is not
+* answered; a passive replication standby sends none. Answers are cached for ttl seconds (at least 1) per DUID and
+* IAID. Once all IAs of a
+* parked message are answered it is handled again and finds its prefixes in
+* the cache. The prefixes must lie in the pool (-o), they are bound to its
+* slots so the binding table, routes and events work as without IPAM.
+* Unanswered queries and a missing IPAM count as a refusal for a few seconds.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "ipam.h"
+#include "binding.h"
+#include "message.h"
+#include "replic.h"
+#include "common.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*cached answers (power of 2)*/
+#define IPAM_CACHESIZE 16384
+/*maximum number of messages waiting for answers*/
+#define IPAM_MAXPARKED 4096
+/*seconds until a query counts as failed*/
+#define IPAM_TIMEOUT 3
+/*seconds a failure is cached*/
+#define IPAM_NEGTTL 5
+/*seconds between connection attempts*/
+#define IPAM_RECONNECT 5
+#define IPAM_BUFSIZE 65536
+/*upper bound for one query line*/
+#define IPAM_MAXLINE (2*BIND_MAXDUID+64)
+
+/*cache entry states*/
+#define IP_EMPTY 0
+#define IP_PENDING 1
+#define IP_VALID 2
+
+struct ipentry {
+	unsigned char state,duidlen;
+	unsigned char duid[BIND_MAXDUID];
+	unsigned int iaid;
+	/*chosen slot, BIND_NOSLOT for a refusal*/
+	unsigned int slot;
+	/*query ID while pending*/
+	unsigned int id;
+	/*end of validity or, while pending, the deadline of the query*/
+	long long expires;
+};
+
+static const char*ipampath=0,*ipamdev="";
+static void(*msghandler)(struct dhcp_msg*)=0;
+static int ipamfd=-1;
+static long long nextconnect=0,lastscan=0;
+static struct ipentry*cache=0;
+static unsigned int idseq=0;
+static int npending=0;
+static struct dhcp_msg**parked=0,**retry=0;
+static int nparked=0;
+static unsigned char inbuf[IPAM_BUFSIZE],outbuf[IPAM_BUFSIZE];
+static int inlen=0,outoff=0,outlen=0;
+static unsigned long long queries=0,hits=0,refused=0,failed=0,dropped=0,freed=0;
+static int listening=0;
+
+void ipamsetsocket(const char*p)
+{
+	ipampath=p;
+}
+
+bool ipamenabled()
+{
+	return ipampath!=0;
+}
+
+/*FNV-1a over DUID and IAID*/
+static struct ipentry* ipentry(const unsigned char*duid,int duidlen,unsigned int iaid)
+{
+	unsigned int h=2166136261U;
+	int i;
+	for(i=0;i<duidlen;i++)h=(h^duid[i])*16777619U;
+	for(i=0;i<4;i++)h=(h^((iaid>>(8*i))&0xff))*16777619U;
+	return &cache[h&(IPAM_CACHESIZE-1)];
+}
+
+static bool ipmatch(struct ipentry*e,const unsigned char*duid,int duidlen,unsigned int iaid)
+{
+	return e->state!=IP_EMPTY && e->iaid==iaid && e->duidlen==duidlen && memcmp(e->duid,duid,duidlen)==0;
+}
+
+/*caches an answer for ttl seconds; it is valid at least until the end of the
+  next second, so the waiting messages always find it*/
+static void ipanswer(struct ipentry*e,unsigned int slot,long ttl)
+{
+	if(ttl<1)ttl=1;
+	if(e->state==IP_PENDING)npending--;
+	e->state=IP_VALID;
+	e->slot=slot;
+	e->expires=time(0)+ttl;
+}
+
+/*hands all parked messages back, those still waiting are parked again*/
+static void retryparked()
+{
+	struct dhcp_msg**p=parked;
+	int i,n=nparked;
+	if(!n)return;
+	parked=retry;
+	retry=p;
+	nparked=0;
+	for(i=0;i<n;i++)
+		msghandler(retry[i]);
+}
+
+/*answers all pending queries with a failure*/
+static void failpending()
+{
+	int i;
+	for(i=0;i<IPAM_CACHESIZE && npending>0;i++)
+		if(cache[i].state==IP_PENDING){
+			ipanswer(&cache[i],BIND_NOSLOT,IPAM_NEGTTL);
+			failed++;
+		}
+	npending=0;
+}
+
+static void ipamclose()
+{
+	if(ipamfd>=0)close(ipamfd);
+	ipamfd=-1;
+	inlen=outoff=outlen=0;
+	nextconnect=time(0)+IPAM_RECONNECT;
+	failpending();
+}
+
+static int ipamconnect()
+{
+	struct sockaddr_un sa;
+	nextconnect=time(0)+IPAM_RECONNECT;
+	ipamfd=socket(AF_UNIX,SOCK_STREAM,0);
+	if(ipamfd<0){
+		td_log(LOGWARN,"IPAM: unable to allocate socket: %s",strerror(errno));
+		return -1;
+	}
+	Memzero(&sa,sizeof(sa));
+	sa.sun_family=AF_UNIX;
+	Strcpy(sa.sun_path,ipampath);
+	if(connect(ipamfd,(struct sockaddr*)&sa,sizeof(sa))<0){
+		td_log(LOGWARN,"IPAM: cannot connect to %s: %s",ipampath,strerror(errno));
+		close(ipamfd);
+		ipamfd=-1;
+		return -1;
+	}
+	fcntl(ipamfd,F_SETFL,O_NONBLOCK);
+	td_log(LOGINFO,"IPAM: connected to %s",ipampath);
+	return 0;
+}
+
+/*tells the IPAM about prefixes that are no longer bound*/
+static void ipamlistener(int ev,struct binding*b)
+{
+	struct ipentry*e;
+	struct in6_addr pre;
+	char hex[2*BIND_MAXDUID+1],a[64];
+	int i;
+	if((ev!=BINDEV_RELEASE && ev!=BINDEV_EXPIRE) || b->slot==BIND_NOSLOT)return;
+	/*the next request asks again*/
+	e=ipentry(b->duid,b->duidlen,b->iaid);
+	if(ipmatch(e,b->duid,b->duidlen,b->iaid) && e->state==IP_VALID)
+		e->state=IP_EMPTY;
+	/*a standby only mirrors the primary, which reports its own releases*/
+	if(replpassive())return;
+	if(ipamfd<0 || outlen+IPAM_MAXLINE>IPAM_BUFSIZE){
+		td_log(LOGDEBUG,"IPAM: cannot report that slot %u is free",b->slot);
+		return;
+	}
+	for(i=0;i<b->duidlen;i++)
+		snprintf(hex+2*i,3,"%02x",b->duid[i]);
+	hex[2*i]=0;
+	bindslotprefix(b->slot,&pre);
+	outlen+=snprintf((char*)outbuf+outlen,IPAM_BUFSIZE-outlen,"0 FREE %s %u %s/%i\n",
+		hex,b->iaid,inet_ntop(AF_INET6,&pre,a,sizeof(a)),bindpoollen());
+	freed++;
+}
+
+int ipaminit(const char*dev,void(*handler)(struct dhcp_msg*))
+{
+	struct sockaddr_un sa;
+	if(!ipampath)return 0;
+	if(!bindhaspool()){
+		td_log(LOGERROR,"IPAM: needs a prefix pool (-o) that contains its prefixes");
+		return -1;
+	}
+	if(strlen(ipampath)>=sizeof(sa.sun_path)){
+		td_log(LOGERROR,"IPAM socket path %s is too long",ipampath);
+		return -1;
+	}
+	ipamdev=dev;
+	msghandler=handler;
+	if(!cache){
+		cache=Malloc(IPAM_CACHESIZE*sizeof(struct ipentry));
+		parked=Malloc(IPAM_MAXPARKED*sizeof(struct dhcp_msg*));
+		retry=Malloc(IPAM_MAXPARKED*sizeof(struct dhcp_msg*));
+		if(!cache || !parked || !retry)return -1;
+	}
+	Memzero(cache,IPAM_CACHESIZE*sizeof(struct ipentry));
+	npending=nparked=0;
+	if(!listening){
+		if(bindaddlistener(ipamlistener)<0){
+			td_log(LOGERROR,"IPAM: cannot register for binding changes");
+			return -1;
+		}
+		listening=1;
+	}
+	/*the server starts anyway, it keeps trying*/
+	ipamconnect();
+	return 0;
+}
+
+/*returns true if the IA has to wait for the IPAM, sends the query if needed*/
+static bool ipresolve(const unsigned char*duid,int duidlen,unsigned int iaid)
+{
+	struct ipentry*e=ipentry(duid,duidlen,iaid);
+	char hex[2*BIND_MAXDUID+1];
+	long long now=time(0);
+	int i;
+	if(ipmatch(e,duid,duidlen,iaid)){
+		if(e->state==IP_PENDING)return true;
+		if(e->expires>=now){
+			hits++;
+			return false;
+		}
+	}else if(e->state==IP_PENDING)
+		/*another IA hashes here: ask when its answer is in*/
+		return true;
+	/*a new query, the entry is taken over from whatever was cached there*/
+	e->duidlen=duidlen;
+	Memcpy(e->duid,(void*)duid,duidlen);
+	e->iaid=iaid;
+	if(ipamfd<0 || outlen+IPAM_MAXLINE>IPAM_BUFSIZE){
+		e->state=IP_VALID;
+		e->slot=BIND_NOSLOT;
+		e->expires=now+IPAM_NEGTTL;
+		failed++;
+		return false;
+	}
+	e->state=IP_PENDING;
+	e->id=(++idseq*IPAM_CACHESIZE)|(e-cache);
+	e->expires=now+IPAM_TIMEOUT;
+	npending++;
+	queries++;
+	for(i=0;i<duidlen;i++)
+		snprintf(hex+2*i,3,"%02x",duid[i]);
+	hex[2*i]=0;
+	outlen+=snprintf((char*)outbuf+outlen,IPAM_BUFSIZE-outlen,"%u ALLOC %s %u %s\n",e->id,hex,iaid,ipamdev);
+	return true;
+}
+
+bool ipampark(struct dhcp_msg*msg)
+{
+	struct dhcp_opt*id;
+	int i,p,wait=0;
+	if(!ipampath)return false;
+	if(msg->msg_type!=MSG_SOLICIT && msg->msg_type!=MSG_REQUEST)return false;
+	p=messagefindoption(msg,OPT_CLIENTID);
+	if(p<0)return false;
+	id=&msg->msg_opt[p];
+	for(i=0;i<msg->msg_numopts;i++){
+		if(msg->msg_opt[i].opt_type!=OPT_IAPD)continue;
+		/*existing bindings keep their prefix*/
+		if(bindfind(id->opt_duid.duid,id->opt_duid.len,msg->msg_opt[i].opt_iapd.iaid))continue;
+		if(ipresolve(id->opt_duid.duid,id->opt_duid.len,msg->msg_opt[i].opt_iapd.iaid))
+			wait=1;
+	}
+	if(!wait)return false;
+	if(nparked>=IPAM_MAXPARKED){
+		/*the client retransmits*/
+		dropped++;
+		freemessage(msg);
+		return true;
+	}
+	parked[nparked++]=msg;
+	return true;
+}
+
+unsigned int ipamslot(const unsigned char*duid,int duidlen,unsigned int iaid)
+{
+	struct ipentry*e;
+	if(!cache)return BIND_NOSLOT;
+	e=ipentry(duid,duidlen,iaid);
+	/*expired answers are still good for the message that waited for them*/
+	if(!ipmatch(e,duid,duidlen,iaid) || e->state!=IP_VALID)return BIND_NOSLOT;
+	return e->slot;
+}
+
+/*handles one answer line*/
+static void parseline(char*line)
+{
+	struct ipentry*e;
+	struct in6_addr pre;
+	char*tok[4],*s;
+	unsigned int id,slot;
+	int n=0,plen;
+	for(s=strtok(line," \t\r");s && n<4;s=strtok(0," \t\r"))tok[n++]=s;
+	if(n<3)goto invalid;
+	id=strtoul(tok[0],0,10);
+	e=&cache[id&(IPAM_CACHESIZE-1)];
+	/*late answers for entries that were taken over or timed out*/
+	if(e->state!=IP_PENDING || e->id!=id)return;
+	if(strcmp(tok[1],"NONE")==0){
+		refused++;
+		ipanswer(e,BIND_NOSLOT,atol(tok[2]));
+		return;
+	}
+	if(strcmp(tok[1],"OK")!=0 || n<4)goto invalid;
+	s=strchr(tok[2],'/');
+	if(!s)goto invalid;
+	*s++=0;
+	plen=atoi(s);
+	if(inet_pton(AF_INET6,tok[2],&pre)<=0)goto invalid;
+	slot=bindprefixslot(&pre);
+	if(plen!=bindpoollen() || slot==BIND_NOSLOT || slot>=bindpoolsize()){
+		td_log(LOGWARN,"IPAM: prefix %s/%i is not a prefix of the pool",tok[2],plen);
+		refused++;
+		ipanswer(e,BIND_NOSLOT,IPAM_NEGTTL);
+		return;
+	}
+	ipanswer(e,slot,atol(tok[3]));
+	return;
+invalid:
+	td_log(LOGWARN,"IPAM: invalid answer, ignoring it");
+}
+
+static void readanswers()
+{
+	int r,i,start=0;
+	r=recv(ipamfd,inbuf+inlen,sizeof(inbuf)-inlen,0);
+	if(r==0 || (r<0 && errno!=EAGAIN && errno!=EINTR)){
+		td_log(LOGWARN,"IPAM: lost connection");
+		ipamclose();
+		retryparked();
+		return;
+	}
+	if(r<0)return;
+	inlen+=r;
+	for(i=0;i<inlen;i++)
+		if(inbuf[i]=='\n'){
+			inbuf[i]=0;
+			parseline((char*)inbuf+start);
+			start=i+1;
+		}
+	if(start==0 && inlen==sizeof(inbuf)){
+		td_log(LOGWARN,"IPAM: answer line too long, reconnecting");
+		ipamclose();
+	}else{
+		inlen-=start;
+		memmove(inbuf,inbuf+start,inlen);
+	}
+	retryparked();
+}
+
+static void sendqueries()
+{
+	int r;
+	if(ipamfd<0 || outoff>=outlen)return;
+	r=send(ipamfd,outbuf+outoff,outlen-outoff,MSG_NOSIGNAL|MSG_DONTWAIT);
+	if(r<0){
+		if(errno!=EAGAIN && errno!=EINTR){
+			td_log(LOGWARN,"IPAM: lost connection: %s",strerror(errno));
+			ipamclose();
+			retryparked();
+		}
+		return;
+	}
+	outoff+=r;
+	if(outoff>=outlen)outoff=outlen=0;
+	else if(outoff>0){
+		memmove(outbuf,outbuf+outoff,outlen-outoff);
+		outlen-=outoff;
+		outoff=0;
+	}
+}
+
+int ipamfdset(fd_set*rfd,fd_set*wfd,int maxfd)
+{
+	if(ipamfd<0)return maxfd;
+	FD_SET(ipamfd,rfd);
+	if(outoff<outlen)FD_SET(ipamfd,wfd);
+	if(ipamfd>maxfd)maxfd=ipamfd;
+	return maxfd;
+}
+
+void ipampoll(fd_set*rfd,fd_set*wfd)
+{
+	if(ipamfd>=0 && FD_ISSET(ipamfd,wfd))
+		sendqueries();
+	if(ipamfd>=0 && FD_ISSET(ipamfd,rfd))
+		readanswers();
+}
+
+void ipamtimer(long long now)
+{
+	int i,n=0;
+	if(!ipampath)return;
+	if(ipamfd<0 && now>=nextconnect)
+		ipamconnect();
+	/*all queries of this iteration in one go*/
+	sendqueries();
+	/*queries without answer*/
+	if(npending>0 && now!=lastscan){
+		lastscan=now;
+		for(i=0;i<IPAM_CACHESIZE;i++)
+			if(cache[i].state==IP_PENDING && cache[i].expires<=now){
+				ipanswer(&cache[i],BIND_NOSLOT,IPAM_NEGTTL);
+				failed++;
+				n++;
+			}
+		if(n){
+			td_log(LOGWARN,"IPAM: %i queries timed out",n);
+			retryparked();
+		}
+	}
+}
+
+void ipamstats()
+{
+	if(!ipampath)return;
+	td_log(LOGINFO,"statistics: IPAM %llu queries, %llu cache hits, %llu refused, %llu failed, %llu messages dropped, %llu prefixes freed",
+		queries,hits,refused,failed,dropped,freed);
+}
+
+void ipamdone()
+{
+	int i;
+	if(!ipampath || !cache)return;
+	if(ipamfd>=0)close(ipamfd);
+	ipamfd=-1;
+	inlen=outoff=outlen=0;
+	for(i=0;i<nparked;i++)
+		freemessage(parked[i]);
+	nparked=0;
+}
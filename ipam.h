@@ -0,0 +1,47 @@
+/*
+// C Interface: ipam
+//
+// Description: asynchronous prefix allocation by an external IPAM over a UNIX socket
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_IPAM_H
+#define TDHCP_IPAM_H
+
+#include "common.h"
+#include <sys/select.h>
+
+struct dhcp_msg;
+
+/*ask the IPAM listening on the UNIX stream socket path which pool prefix new bindings get*/
+void ipamsetsocket(const char*path);
+/*returns true if an IPAM is configured*/
+bool ipamenabled();
+
+/*connects to the IPAM; dev is passed on with every query; handler gets parked
+  messages back once all their answers are in; returns 0 on success, -1 on error*/
+int ipaminit(const char*dev,void(*handler)(struct dhcp_msg*));
+/*parks a SOLICIT or REQUEST while the IPAM is asked about its new IA_PDs; returns true
+  if the message was taken (parked or dropped), false if it can be answered now*/
+bool ipampark(struct dhcp_msg*);
+/*returns the pool slot the IPAM chose for an IA, BIND_NOSLOT if it refused or failed*/
+unsigned int ipamslot(const unsigned char*duid,int duidlen,unsigned int iaid);
+
+/*adds the IPAM connection to the select sets, returns the new maximum fd*/
+int ipamfdset(fd_set*rfd,fd_set*wfd,int maxfd);
+/*reads answers and hands back the messages that can be answered now*/
+void ipampoll(fd_set*rfd,fd_set*wfd);
+/*sends the queries of this iteration, handles timeouts and reconnects;
+  call once per main loop iteration*/
+void ipamtimer(long long now);
+/*logs the lookup counters*/
+void ipamstats();
+/*closes the connection and drops parked messages*/
+void ipamdone();
+
+#endif
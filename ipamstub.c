@@ -0,0 +1,287 @@
+/*
+*  C Implementation: ipamstub
+*
+* Description: minimal IPAM for testing the asynchronous allocator of tdhcpd;
+*  answers ALLOC queries on a UNIX socket with prefixes of a pool, each client
+*  IA keeps its prefix; answers can be delayed and reordered
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HELP \
+ "Usage: %s [options] socket prefix/length/plen\n" \
+ "Answers IPAM queries of tdhcpd (--ipam=socket) with prefixes of length plen\n" \
+ "out of prefix/length, handed out in order.\n" \
+ "  -d ms      delay every answer by this many milliseconds (default: 0)\n" \
+ "  -j ms      add up to this many milliseconds of random delay, so answers\n" \
+ "             come back out of order (default: 0)\n" \
+ "  -t secs    TTL of the answers (default: 60)\n" \
+ "  -r         refuse all queries\n"
+
+#define MAXCONN 16
+#define BUFSIZE 65536
+#define HASHSIZE 65536
+
+/*an IA that got a prefix*/
+struct assign {
+	char*key;
+	unsigned int slot;
+	struct assign*next;
+};
+
+/*an answer waiting for its time*/
+struct answer {
+	long long due;
+	int fd;
+	char line[128];
+};
+
+static struct assign*hash[HASHSIZE];
+static unsigned int nextslot=0,nslots;
+static unsigned char pool[16];
+static int poollen,plen;
+static int conns[MAXCONN];
+static char inbuf[MAXCONN][BUFSIZE];
+static int inlen[MAXCONN];
+static struct answer*answers=0;
+static int nanswers=0,maxanswers=0;
+static int delay=0,jitter=0,ttl=60,refuse=0;
+static unsigned long long served=0,freed=0;
+static volatile int doexit=0;
+
+static long long now_ms()
+{
+	struct timeval tv;
+	gettimeofday(&tv,0);
+	return tv.tv_sec*1000LL+tv.tv_usec/1000;
+}
+
+/*returns the slot of an IA, assigning the next free one; -1 if the pool is exhausted*/
+static long long lookup(const char*key)
+{
+	unsigned int h=2166136261U;
+	const char*k;
+	struct assign*a;
+	for(k=key;*k;k++)h=(h^(unsigned char)*k)*16777619U;
+	h%=HASHSIZE;
+	for(a=hash[h];a;a=a->next)
+		if(strcmp(a->key,key)==0)return a->slot;
+	if(nextslot>=nslots)return -1;
+	a=malloc(sizeof(struct assign));
+	a->key=strdup(key);
+	a->slot=nextslot++;
+	a->next=hash[h];
+	hash[h]=a;
+	return a->slot;
+}
+
+static void slotprefix(unsigned int slot,char*buf,int len)
+{
+	unsigned char p[16];
+	int i,bit;
+	memcpy(p,pool,16);
+	for(i=0;i<plen-poollen && i<32;i++)
+		if(slot&(1U<<i)){
+			bit=plen-1-i;
+			p[bit/8]|=0x80>>(bit%8);
+		}
+	inet_ntop(AF_INET6,p,buf,len);
+}
+
+static void queueanswer(int fd,const char*line)
+{
+	struct answer*a;
+	if(nanswers>=maxanswers){
+		maxanswers=maxanswers?maxanswers*2:256;
+		answers=realloc(answers,maxanswers*sizeof(struct answer));
+	}
+	a=&answers[nanswers++];
+	a->fd=fd;
+	a->due=now_ms()+delay+(jitter?random()%(jitter+1):0);
+	snprintf(a->line,sizeof(a->line),"%s",line);
+}
+
+/*handles "<id> ALLOC <duid> <iaid> <device>" and "0 FREE <duid> <iaid> <prefix>",
+  freed prefixes stay with their IA*/
+static void query(int fd,char*line)
+{
+	char key[512],pre[64],ans[128];
+	char*id,*cmd,*duid,*iaid;
+	long long slot;
+	id=strtok(line," \r");
+	cmd=strtok(0," \r");
+	duid=strtok(0," \r");
+	iaid=strtok(0," \r");
+	if(id && cmd && duid && iaid && strcmp(cmd,"FREE")==0){
+		freed++;
+		return;
+	}
+	if(!id || !cmd || !duid || !iaid || strcmp(cmd,"ALLOC")!=0){
+		fprintf(stderr,"invalid query\n");
+		return;
+	}
+	served++;
+	snprintf(key,sizeof(key),"%s/%s",duid,iaid);
+	slot=refuse?-1:lookup(key);
+	if(slot<0)
+		snprintf(ans,sizeof(ans),"%s NONE %i\n",id,ttl);
+	else{
+		slotprefix(slot,pre,sizeof(pre));
+		snprintf(ans,sizeof(ans),"%s OK %s/%i %i\n",id,pre,plen,ttl);
+	}
+	queueanswer(fd,ans);
+}
+
+static void closeconn(int i)
+{
+	int j;
+	close(conns[i]);
+	/*forget its answers*/
+	for(j=0;j<nanswers;)
+		if(answers[j].fd==conns[i])answers[j]=answers[--nanswers];
+		else j++;
+	conns[i]=-1;
+}
+
+static void readconn(int i)
+{
+	int r,j,start=0;
+	r=recv(conns[i],inbuf[i]+inlen[i],BUFSIZE-inlen[i],0);
+	if(r<=0){
+		closeconn(i);
+		return;
+	}
+	inlen[i]+=r;
+	for(j=0;j<inlen[i];j++)
+		if(inbuf[i][j]=='\n'){
+			inbuf[i][j]=0;
+			query(conns[i],inbuf[i]+start);
+			start=j+1;
+		}
+	inlen[i]-=start;
+	memmove(inbuf[i],inbuf[i]+start,inlen[i]);
+}
+
+/*sends the answers that are due, returns ms until the next one (-1: none)*/
+static long long sendanswers()
+{
+	long long now=now_ms(),next=-1;
+	int j;
+	for(j=0;j<nanswers;){
+		if(answers[j].due<=now){
+			send(answers[j].fd,answers[j].line,strlen(answers[j].line),MSG_NOSIGNAL);
+			answers[j]=answers[--nanswers];
+			continue;
+		}
+		if(next<0 || answers[j].due-now<next)next=answers[j].due-now;
+		j++;
+	}
+	return next;
+}
+
+static void sighandler(int sig)
+{
+	doexit=1;
+}
+
+int main(int argc,char**argv)
+{
+	struct sockaddr_un sa;
+	char*s,*e;
+	int c,i,lfd,maxfd;
+	while((c=getopt(argc,argv,"d:j:t:rh"))!=-1)switch(c){
+		case 'd':delay=atoi(optarg);break;
+		case 'j':jitter=atoi(optarg);break;
+		case 't':ttl=atoi(optarg);break;
+		case 'r':refuse=1;break;
+		default:
+			fprintf(stderr,HELP,argv[0]);
+			return c=='h'?0:1;
+	}
+	if(argc-optind!=2){
+		fprintf(stderr,HELP,argv[0]);
+		return 1;
+	}
+	/*parse the pool*/
+	s=strchr(argv[optind+1],'/');
+	if(!s){
+		fprintf(stderr,"invalid pool %s\n",argv[optind+1]);
+		return 1;
+	}
+	*s++=0;
+	poollen=strtol(s,&e,10);
+	if(*e=='/')plen=atoi(e+1);
+	if(inet_pton(AF_INET6,argv[optind+1],pool)<=0 || *e!='/' || poollen<1 || plen<=poollen || plen>128){
+		fprintf(stderr,"invalid pool\n");
+		return 1;
+	}
+	nslots=plen-poollen>=32?0xffffffffU:1U<<(plen-poollen);
+	/*listen*/
+	memset(&sa,0,sizeof(sa));
+	sa.sun_family=AF_UNIX;
+	strncpy(sa.sun_path,argv[optind],sizeof(sa.sun_path)-1);
+	unlink(sa.sun_path);
+	lfd=socket(AF_UNIX,SOCK_STREAM,0);
+	if(lfd<0 || bind(lfd,(struct sockaddr*)&sa,sizeof(sa))<0 || listen(lfd,MAXCONN)<0){
+		fprintf(stderr,"cannot listen on %s: %s\n",sa.sun_path,strerror(errno));
+		return 1;
+	}
+	for(i=0;i<MAXCONN;i++)conns[i]=-1;
+	signal(SIGTERM,sighandler);
+	signal(SIGINT,sighandler);
+	while(!doexit){
+		fd_set rfd;
+		struct timeval tv,*tvp=0;
+		long long next=sendanswers();
+		if(next>=0){
+			tv.tv_sec=next/1000;
+			tv.tv_usec=(next%1000)*1000;
+			tvp=&tv;
+		}
+		FD_ZERO(&rfd);
+		FD_SET(lfd,&rfd);
+		maxfd=lfd;
+		for(i=0;i<MAXCONN;i++)
+			if(conns[i]>=0){
+				FD_SET(conns[i],&rfd);
+				if(conns[i]>maxfd)maxfd=conns[i];
+			}
+		if(select(maxfd+1,&rfd,0,0,tvp)<0){
+			if(errno==EINTR)continue;
+			break;
+		}
+		for(i=0;i<MAXCONN;i++)
+			if(conns[i]>=0 && FD_ISSET(conns[i],&rfd))
+				readconn(i);
+		if(FD_ISSET(lfd,&rfd)){
+			int fd=accept(lfd,0,0);
+			for(i=0;i<MAXCONN;i++)
+				if(conns[i]<0)break;
+			if(fd>=0 && i<MAXCONN){
+				conns[i]=fd;
+				inlen[i]=0;
+			}else if(fd>=0)
+				close(fd);
+		}
+	}
+	fprintf(stderr,"served %llu queries, %u prefixes assigned, %llu freed\n",served,nextslot,freed);
+	unlink(sa.sun_path);
+	return 0;
+}
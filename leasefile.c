@@ -0,0 +1,229 @@
+/*
+*  C Implementation: leasefile
+*
+* Description: client lease state file for fast reconnects
+*
+* The file is plain text, one item per line: "server <hex DUID>",
+* "peer <address>", "iana <IAID>" and "iapd <IAID>" start an IA, followed by
+* "address <address> <expiry>" or "prefix <prefix>/<length> <expiry>" lines;
+* "dns <address>" and "domain <name>" carry the DNS settings. Expiry times
+* are absolute (seconds since the epoch, 0 for infinite), so that the
+* remaining lifetime is known after a restart. The file is replaced
+* atomically through rename.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "leasefile.h"
+#include "message.h"
+#include "common.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+/*maximum number of DNS servers and domains that are restored*/
+#define LF_MAXDNS 16
+
+/*absolute expiry of a lifetime, 0 if infinite*/
+static long long expiry(unsigned long lt,long long now)
+{
+	if(lt==0xffffffffUL)return 0;
+	return now+lt;
+}
+
+/*lifetime remaining until an absolute expiry, 0xffffffff if infinite*/
+static unsigned long remaining(long long exp,long long now)
+{
+	if(exp==0)return 0xffffffffUL;
+	if(exp<=now)return 0;
+	return exp-now;
+}
+
+static void saveia(FILE*f,struct dhcp_opt*ia,long long now)
+{
+	char tmp[INET6_ADDRSTRLEN];
+	int i;
+	fprintf(f,"%s %lu\n",ia->opt_type==OPT_IANA?"iana":"iapd",(unsigned long)ia->opt_iapd.iaid);
+	for(i=0;i<ia->opt_numopts;i++){
+		struct dhcp_opt*o=&ia->subopt[i];
+		if(o->opt_type==OPT_IAADDR)
+			fprintf(f,"address %s %lld\n",
+				inet_ntop(AF_INET6,&o->opt_iaaddress.addr,tmp,sizeof(tmp)),
+				expiry(o->opt_iaaddress.valid_lifetime,now));
+		if(o->opt_type==OPT_IAPREFIX)
+			fprintf(f,"prefix %s/%i %lld\n",
+				inet_ntop(AF_INET6,&o->opt_iaprefix.prefix,tmp,sizeof(tmp)),
+				(int)o->opt_iaprefix.prefixlen,
+				expiry(o->opt_iaprefix.valid_lifetime,now));
+	}
+}
+
+int leasesave(const char*file,struct dhcp_msg*reply)
+{
+	char tmp[INET6_ADDRSTRLEN],*tfile;
+	long long now=time(0);
+	FILE*f;
+	int i,j;
+	if(!file || !reply)return -1;
+	tfile=Malloc(strlen(file)+5);
+	Strcpy(tfile,file);
+	strcat(tfile,".new");
+	f=fopen(tfile,"w");
+	if(!f){
+		td_log(LOGWARN,"unable to write lease file %s",tfile);
+		Free(tfile);
+		return -1;
+	}
+	for(i=0;i<reply->msg_numopts;i++){
+		struct dhcp_opt*o=&reply->msg_opt[i];
+		switch(o->opt_type){
+			case OPT_SERVERID:
+				fprintf(f,"server ");
+				for(j=0;j<o->opt_duid.len;j++)
+					fprintf(f,"%02x",o->opt_duid.duid[j]);
+				fprintf(f,"\n");
+				break;
+			case OPT_IANA:case OPT_IAPD:
+				saveia(f,o,now);
+				break;
+			case OPT_DNS_SERVER:
+				for(j=0;j<o->opt_dns_server.num_dns;j++)
+					fprintf(f,"dns %s\n",inet_ntop(AF_INET6,&o->opt_dns_server.addr[j],tmp,sizeof(tmp)));
+				break;
+			case OPT_DNS_NAME:
+				for(j=0;j<o->opt_dns_name.num_dns;j++)
+					fprintf(f,"domain %s\n",o->opt_dns_name.namelist[j]);
+				break;
+		}
+	}
+	fprintf(f,"peer %s\n",inet_ntop(AF_INET6,&reply->msg_peer.sin6_addr,tmp,sizeof(tmp)));
+	if(fclose(f)!=0 || rename(tfile,file)!=0){
+		td_log(LOGWARN,"unable to write lease file %s",file);
+		unlink(tfile);
+		Free(tfile);
+		return -1;
+	}
+	Free(tfile);
+	return 0;
+}
+
+/*decodes a hex string, returns the number of bytes*/
+static int hexdecode(const char*hx,unsigned char*buf,int max)
+{
+	int len=0,k=0;
+	for(;*hx && len<max;hx++){
+		int c;
+		if(*hx>='0' && *hx<='9')c=*hx-'0';else
+		if(*hx>='a' && *hx<='f')c=*hx-'a'+10;else
+		if(*hx>='A' && *hx<='F')c=*hx-'A'+10;
+		else continue;
+		if(k)buf[len++]|=c;
+		else buf[len]=c<<4;
+		k=!k;
+	}
+	return len;
+}
+
+struct dhcp_msg* leaseload(const char*file)
+{
+	char line[1100],key[16],val[1040];
+	unsigned char duid[512];
+	long long now=time(0),exp;
+	struct dhcp_msg*msg;
+	struct dhcp_opt opt;
+	struct in6_addr dns[LF_MAXDNS];
+	char*domains[LF_MAXDNS];
+	int ndns=0,ndomains=0;
+	FILE*f;
+	int ia=-1,valid=0;
+	if(!file)return 0;
+	f=fopen(file,"r");
+	if(!f)return 0;
+	msg=newmessage(MSG_REPLY);
+	msg->msg_peer.sin6_family=AF_INET6;
+	while(fgets(line,sizeof(line),f)){
+		exp=0;
+		if(sscanf(line,"%15s %1039s %lld",key,val,&exp)<2)continue;
+		Memzero(&opt,sizeof(opt));
+		if(!strcmp(key,"server")){
+			opt.opt_type=OPT_SERVERID;
+			opt.opt_duid.len=hexdecode(val,duid,sizeof(duid));
+			opt.opt_duid.duid=duid;
+			messageappendopt(msg,&opt);
+		}else
+		if(!strcmp(key,"peer")){
+			inet_pton(AF_INET6,val,&msg->msg_peer.sin6_addr);
+		}else
+		if(!strcmp(key,"iana") || !strcmp(key,"iapd")){
+			opt.opt_type=key[2]=='n'?OPT_IANA:OPT_IAPD;
+			opt.opt_iapd.iaid=strtoul(val,0,10);
+			ia=messageappendopt(msg,&opt);
+		}else
+		if(!strcmp(key,"address") && ia>=0 && msg->msg_opt[ia].opt_type==OPT_IANA){
+			opt.opt_type=OPT_IAADDR;
+			if(inet_pton(AF_INET6,val,&opt.opt_iaaddress.addr)<=0)continue;
+			opt.opt_iaaddress.valid_lifetime=remaining(exp,now);
+			opt.opt_iaaddress.preferred_lifetime=opt.opt_iaaddress.valid_lifetime;
+			if(!opt.opt_iaaddress.valid_lifetime)continue;
+			optappendopt(&msg->msg_opt[ia],&opt);
+			valid++;
+		}else
+		if(!strcmp(key,"prefix") && ia>=0 && msg->msg_opt[ia].opt_type==OPT_IAPD){
+			char*s=strchr(val,'/');
+			if(!s)continue;
+			*s++=0;
+			opt.opt_type=OPT_IAPREFIX;
+			if(inet_pton(AF_INET6,val,&opt.opt_iaprefix.prefix)<=0)continue;
+			opt.opt_iaprefix.prefixlen=atoi(s);
+			opt.opt_iaprefix.valid_lifetime=remaining(exp,now);
+			opt.opt_iaprefix.preferred_lifetime=opt.opt_iaprefix.valid_lifetime;
+			if(!opt.opt_iaprefix.valid_lifetime)continue;
+			optappendopt(&msg->msg_opt[ia],&opt);
+			valid++;
+		}else
+		if(!strcmp(key,"dns") && ndns<LF_MAXDNS){
+			if(inet_pton(AF_INET6,val,&dns[ndns])>0)ndns++;
+		}else
+		if(!strcmp(key,"domain") && ndomains<LF_MAXDNS){
+			domains[ndomains]=Malloc(strlen(val)+1);
+			Strcpy(domains[ndomains++],val);
+		}
+	}
+	fclose(f);
+	/*DNS settings are added as a whole*/
+	if(ndns){
+		Memzero(&opt,sizeof(opt));
+		opt.opt_type=OPT_DNS_SERVER;
+		opt.opt_dns_server.num_dns=ndns;
+		opt.opt_dns_server.addr=dns;
+		messageappendopt(msg,&opt);
+	}
+	if(ndomains){
+		Memzero(&opt,sizeof(opt));
+		opt.opt_type=OPT_DNS_NAME;
+		opt.opt_dns_name.num_dns=ndomains;
+		opt.opt_dns_name.namelist=domains;
+		messageappendopt(msg,&opt);
+		while(ndomains>0)Free(domains[--ndomains]);
+	}
+	/*nothing left that could be confirmed*/
+	if(!valid){
+		td_log(LOGINFO,"lease in %s has expired",file);
+		freemessage(msg);
+		return 0;
+	}
+	return msg;
+}
+
+void leaseremove(const char*file)
+{
+	if(file)unlink(file);
+}
@@ -0,0 +1,29 @@
+/*
+// C Interface: leasefile
+//
+// Description: client lease state file for fast reconnects
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_LEASEFILE_H
+#define TDHCP_LEASEFILE_H
+
+struct dhcp_msg;
+
+/*stores the lease of a REPLY (server ID and address, IAs, DNS) in file;
+  returns 0 on success, -1 on error*/
+int leasesave(const char*file,struct dhcp_msg*reply);
+
+/*loads a lease stored by leasesave as a REPLY with the remaining lifetimes;
+  returns NULL if there is none or it has expired*/
+struct dhcp_msg* leaseload(const char*file);
+
+/*forgets the stored lease*/
+void leaseremove(const char*file);
+
+#endif
@@ -0,0 +1,554 @@
+/*
+*  C Implementation: leasequery
+*
+* Description: leasequery and bulk leasequery against the binding table
+*
+* Single queries (by address or client ID) are answered from the slot
+* index or the client's probe sequence. Bulk queries by link address
+* return every binding: the connection keeps a cursor into the binding
+* table and encodes the next LEASEQUERY-DATA messages only when the
+* socket has room for them, so the result is never built in memory.
+*
+* Requestors may be restricted to a list of prefixes. Without a list, UDP
+* queries are only answered for link-local senders that are not relayed
+* and bulk connections are only accepted from the loopback address.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "leasequery.h"
+#include "binding.h"
+#include "message.h"
+#include "sock.h"
+#include "common.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+
+/*maximum simultaneous bulk connections*/
+#define LQ_MAXCONN 8
+/*maximum IAs of one client that are reported*/
+#define LQ_MAXIA 8
+/*output buffer of a bulk connection*/
+#define LQ_OUTBUF 65536
+/*upper bound for one encoded LEASEQUERY-DATA message*/
+#define LQ_MAXMSG 1024
+/*seconds until idle bulk connections are closed*/
+#define LQ_IDLE 60
+/*maximum number of allowed requestor prefixes*/
+#define LQ_MAXALLOW 32
+
+#define PUT2(p,v) (p)[0]=((v)>>8)&0xff;(p)[1]=(v)&0xff;
+
+/*a CLIENT_DATA option that points into the binding table (no allocations)*/
+struct lqdata {
+	struct dhcp_opt cd;
+	struct dhcp_opt sub[2+LQ_MAXIA];
+};
+
+/*a bulk leasequery connection*/
+struct lqconn {
+	int fd;
+	unsigned char in[2+MSG_MAXSIZE];
+	int inlen;
+	unsigned char out[LQ_OUTBUF];
+	int outoff,outlen;
+	/*running bulk query*/
+	int streaming;
+	unsigned int cursor;
+	long msgid;
+	unsigned char reqduid[BIND_MAXDUID];
+	int reqduidlen;
+	long long lastact;
+	/*the requestor closed its side, close once everything is answered*/
+	int eof;
+};
+
+static int udpenabled=0,bulkenabled=0;
+static struct sockaddr_in6 bulkaddr;
+static int listenfd=-1;
+static struct lqconn*conns[LQ_MAXCONN];
+/*requestors that may query*/
+static struct in6_addr allow[LQ_MAXALLOW];
+static unsigned char allowlen[LQ_MAXALLOW];
+static int nallow=0;
+
+void lqenable()
+{
+	udpenabled=1;
+}
+
+int lqsetbulk(const char*s)
+{
+	if(parseaddrport(s,&bulkaddr,DHCP_SERVERPORT)<0){
+		td_log(LOGERROR,"invalid bulk leasequery address %s",s);
+		return -1;
+	}
+	bulkenabled=1;
+	return 0;
+}
+
+int lqallow(const char*s)
+{
+	char buf[64],*p,*e;
+	int l=128;
+	Strncpy(buf,s,sizeof(buf));
+	buf[sizeof(buf)-1]=0;
+	if((p=strchr(buf,'/'))!=0){
+		*p++=0;
+		l=strtol(p,&e,10);
+		if(*e || l<0 || l>128)l=-1;
+	}
+	if(l<0 || nallow>=LQ_MAXALLOW || inet_pton(AF_INET6,buf,&allow[nallow])<=0){
+		td_log(LOGERROR,"invalid leasequery requestor %s (or more than %i given)",s,LQ_MAXALLOW);
+		return -1;
+	}
+	allowlen[nallow++]=l;
+	return 0;
+}
+
+/*returns true if addr is inside one of the allowed prefixes*/
+static bool allowed(const struct in6_addr*addr)
+{
+	const unsigned char*a=(const unsigned char*)addr,*q;
+	int i,b;
+	for(i=0;i<nallow;i++){
+		q=(const unsigned char*)&allow[i];
+		for(b=0;b<allowlen[i];b++)
+			if((a[b/8]^q[b/8])&(0x80>>(b%8)))break;
+		if(b>=allowlen[i])return true;
+	}
+	return false;
+}
+
+bool lqenabled()
+{
+	return udpenabled||bulkenabled;
+}
+
+int lqinit()
+{
+	int val=1;
+	Memzero(conns,sizeof(conns));
+	if(!bulkenabled)return 0;
+	listenfd=socket(PF_INET6,SOCK_STREAM,0);
+	if(listenfd<0){
+		td_log(LOGERROR,"bulk leasequery: unable to allocate socket: %s",strerror(errno));
+		return -1;
+	}
+	setsockopt(listenfd,SOL_SOCKET,SO_REUSEADDR,&val,sizeof(val));
+	if(bind(listenfd,(struct sockaddr*)&bulkaddr,sizeof(bulkaddr))<0 || listen(listenfd,LQ_MAXCONN)<0){
+		td_log(LOGERROR,"bulk leasequery: unable to listen: %s",strerror(errno));
+		close(listenfd);
+		listenfd=-1;
+		return -1;
+	}
+	fcntl(listenfd,F_SETFL,O_NONBLOCK);
+	return 0;
+}
+
+/*fills d with the data of n bindings of the same client*/
+static void filldata(struct lqdata*d,struct binding**bl,int n,long long now)
+{
+	int i,k=0;
+	long long clt=0,rem;
+	struct dhcp_opt*o;
+	Memzero(d,sizeof(struct lqdata));
+	d->cd.opt_type=OPT_CLIENT_DATA;
+	d->cd.subopt=d->sub;
+	/*client ID*/
+	o=&d->sub[k++];
+	o->opt_type=OPT_CLIENTID;
+	o->opt_duid.len=bl[0]->duidlen;
+	o->opt_duid.duid=bl[0]->duid;
+	/*prefixes*/
+	for(i=0;i<n;i++){
+		if(bl[i]->cltime>clt)clt=bl[i]->cltime;
+		if(bl[i]->slot==BIND_NOSLOT)continue;
+		o=&d->sub[k++];
+		o->opt_type=OPT_IAPREFIX;
+		o->opt_iaprefix.prefixlen=bindpoollen();
+		bindslotprefix(bl[i]->slot,&o->opt_iaprefix.prefix);
+		if(bl[i]->expires){
+			rem=bl[i]->expires-now;
+			if(rem<0)rem=0;
+			o->opt_iaprefix.valid_lifetime=rem;
+			o->opt_iaprefix.preferred_lifetime=rem;
+		}else{
+			o->opt_iaprefix.valid_lifetime=0xffffffff;
+			o->opt_iaprefix.preferred_lifetime=0xffffffff;
+		}
+	}
+	/*time since last transaction*/
+	o=&d->sub[k++];
+	o->opt_type=OPT_CLT_TIME;
+	o->opt_clt_time.secs=clt&&now>clt?now-clt:0;
+	d->cd.opt_numopts=k;
+	/*allows messageappendopt to deep-copy it*/
+	d->cd.priv_optlen=k;
+}
+
+/*collects all bindings of a client, returns their number*/
+static int collectclient(const unsigned char*duid,int len,struct binding**bl)
+{
+	unsigned int c=0;
+	int n=0;
+	struct binding*b;
+	while(n<LQ_MAXIA && (b=bindfindclient(duid,len,&c))!=0)
+		bl[n++]=b;
+	return n;
+}
+
+/*executes a single query, returns the status code; fills bl on success*/
+static int runquery(struct dhcp_opt*q,struct binding**bl,int*n)
+{
+	int i;
+	unsigned int slot;
+	struct binding*b;
+	*n=0;
+	switch(q->opt_lq_query.query_type){
+		case LQ_QUERY_BY_ADDRESS:
+			for(i=0;i<q->opt_numopts;i++)
+				if(q->subopt[i].opt_type==OPT_IAADDR)break;
+			if(i>=q->opt_numopts)return STAT_MalformedQuery;
+			slot=bindprefixslot(&q->subopt[i].opt_iaaddress.addr);
+			b=slot==BIND_NOSLOT?0:bindbyslot(slot);
+			if(!b)return STAT_NotConfigured;
+			*n=collectclient(b->duid,b->duidlen,bl);
+			break;
+		case LQ_QUERY_BY_CLIENTID:
+			for(i=0;i<q->opt_numopts;i++)
+				if(q->subopt[i].opt_type==OPT_CLIENTID)break;
+			if(i>=q->opt_numopts)return STAT_MalformedQuery;
+			*n=collectclient(q->subopt[i].opt_duid.duid,q->subopt[i].opt_duid.len,bl);
+			break;
+		default:
+			return STAT_UnknownQueryType;
+	}
+	return *n?STAT_Success:STAT_NotConfigured;
+}
+
+/*appends a status code option to a message*/
+static void addstatus(struct dhcp_msg*msg,int code,const char*text)
+{
+	struct dhcp_opt st;
+	Memzero(&st,sizeof(st));
+	st.opt_type=OPT_STATUS_CODE;
+	st.opt_status.status=code;
+	st.opt_status.message=(char*)text;
+	messageappendopt(msg,&st);
+}
+
+static const char*statustext(int code)
+{
+	switch(code){
+		case STAT_Success:return "success";
+		case STAT_UnknownQueryType:return "unknown query type";
+		case STAT_MalformedQuery:return "malformed query";
+		case STAT_NotConfigured:return "no such binding";
+		case STAT_NotAllowed:return "leasequery not allowed";
+	}
+	return "failed";
+}
+
+/*creates the LEASEQUERY-REPLY header for a query*/
+static struct dhcp_msg* newreply(struct dhcp_msg*rmsg)
+{
+	struct dhcp_msg*smsg;
+	int p;
+	smsg=newmessage(MSG_LEASEQUERY_REPLY);
+	smsg->msg_id=rmsg->msg_id;
+	Memcpy(&smsg->msg_peer,&rmsg->msg_peer,sizeof(rmsg->msg_peer));
+	smsg->msg_sock=rmsg->msg_sock;
+	messagemoverelay(smsg,rmsg);
+	messageaddopt(smsg,OPT_SERVERID);
+	p=messagefindoption(rmsg,OPT_CLIENTID);
+	if(p>=0)
+		messageappendopt(smsg,&rmsg->msg_opt[p]);
+	return smsg;
+}
+
+void lqhandlemessage(struct dhcp_msg*rmsg)
+{
+	struct dhcp_msg*smsg;
+	struct binding*bl[LQ_MAXIA];
+	struct lqdata d;
+	int q,n,st;
+	smsg=newreply(rmsg);
+	q=messagefindoption(rmsg,OPT_LQ_QUERY);
+	if(!udpenabled)
+		st=STAT_NotAllowed;
+	else if(nallow?!allowed(&rmsg->msg_peer.sin6_addr):
+	        rmsg->msg_numrelay || !IN6_IS_ADDR_LINKLOCAL(&rmsg->msg_peer.sin6_addr))
+		st=STAT_NotAllowed;
+	else if(q<0)
+		st=STAT_MalformedQuery;
+	else
+		st=runquery(&rmsg->msg_opt[q],bl,&n);
+	if(st==STAT_Success){
+		filldata(&d,bl,n,time(0));
+		messageappendopt(smsg,&d.cd);
+	}else
+		addstatus(smsg,st,statustext(st));
+	td_log(LOGDEBUG,"leasequery answered with status %i",st);
+	freemessage(rmsg);
+	sendmessage(smsg);
+	freemessage(smsg);
+}
+
+/*appends a message with length prefix to the output of c, returns -1 if there is no room*/
+static int queuemsg(struct lqconn*c,struct dhcp_msg*msg)
+{
+	int l=encodemessage(msg,c->out+c->outlen+2,LQ_OUTBUF-c->outlen-2);
+	if(l<0)return -1;
+	PUT2(c->out+c->outlen,l);
+	c->outlen+=2+l;
+	return 0;
+}
+
+/*encodes the next bindings of a streaming query*/
+static void fillstream(struct lqconn*c)
+{
+	struct dhcp_msg m;
+	struct dhcp_opt o[3];
+	struct lqdata d;
+	struct binding*b;
+	long long now=time(0);
+	while(c->streaming && c->outlen+LQ_MAXMSG<=LQ_OUTBUF){
+		Memzero(&m,sizeof(m));
+		m.msg_id=c->msgid;
+		m.msg_opt=o;
+		b=bindnext(&c->cursor);
+		if(!b){
+			/*end of table*/
+			m.msg_type=MSG_LEASEQUERY_DONE;
+			queuemsg(c,&m);
+			c->streaming=0;
+			break;
+		}
+		filldata(&d,&b,1,now);
+		Memzero(o,sizeof(o));
+		if(c->streaming==1){
+			/*the first binding goes into the reply*/
+			o[m.msg_numopts].opt_type=OPT_SERVERID;
+			o[m.msg_numopts].opt_duid.len=DUIDLEN;
+			o[m.msg_numopts++].opt_duid.duid=DUID;
+			if(c->reqduidlen){
+				o[m.msg_numopts].opt_type=OPT_CLIENTID;
+				o[m.msg_numopts].opt_duid.len=c->reqduidlen;
+				o[m.msg_numopts++].opt_duid.duid=c->reqduid;
+			}
+			m.msg_type=MSG_LEASEQUERY_REPLY;
+			c->streaming=2;
+		}else
+			m.msg_type=MSG_LEASEQUERY_DATA;
+		Memcpy(&o[m.msg_numopts++],&d.cd,sizeof(struct dhcp_opt));
+		queuemsg(c,&m);
+	}
+}
+
+static void closeconn(int i)
+{
+	close(conns[i]->fd);
+	Free(conns[i]);
+	conns[i]=0;
+}
+
+/*handles one complete query received on a bulk connection*/
+static void handlebulk(struct lqconn*c,unsigned char*buf,int len)
+{
+	struct dhcp_msg*rmsg,*smsg;
+	struct binding*bl[LQ_MAXIA];
+	struct lqdata d;
+	int q,n,st,p;
+	rmsg=decodemessage(buf,len);
+	if(!rmsg)return;
+	if(rmsg->msg_type!=MSG_LEASEQUERY){
+		freemessage(rmsg);
+		return;
+	}
+	smsg=newreply(rmsg);
+	q=messagefindoption(rmsg,OPT_LQ_QUERY);
+	if(q>=0 && rmsg->msg_opt[q].opt_lq_query.query_type==LQ_QUERY_BY_LINK_ADDRESS){
+		/*all bindings; we do not track links, so every binding is on it*/
+		c->streaming=1;
+		c->cursor=0;
+		c->msgid=rmsg->msg_id;
+		c->reqduidlen=0;
+		p=messagefindoption(rmsg,OPT_CLIENTID);
+		if(p>=0 && rmsg->msg_opt[p].opt_duid.len<=BIND_MAXDUID){
+			c->reqduidlen=rmsg->msg_opt[p].opt_duid.len;
+			Memcpy(c->reqduid,rmsg->msg_opt[p].opt_duid.duid,c->reqduidlen);
+		}
+		td_log(LOGINFO,"bulk leasequery: streaming %u bindings",bindcount());
+		if(bindcount()==0){
+			/*nothing to stream: empty reply*/
+			c->streaming=0;
+			queuemsg(c,smsg);
+		}
+		freemessage(smsg);
+		freemessage(rmsg);
+		return;
+	}
+	if(q<0)
+		st=STAT_MalformedQuery;
+	else
+		st=runquery(&rmsg->msg_opt[q],bl,&n);
+	if(st==STAT_Success){
+		filldata(&d,bl,n,time(0));
+		messageappendopt(smsg,&d.cd);
+	}else
+		addstatus(smsg,st,statustext(st));
+	if(queuemsg(c,smsg)<0)
+		td_log(LOGWARN,"bulk leasequery: output buffer overflow, dropping reply");
+	freemessage(smsg);
+	freemessage(rmsg);
+}
+
+/*handles the complete queries in the input buffer, one at a time once the
+  previous one is done; returns -1 if the connection was closed*/
+static int parseconn(int i)
+{
+	struct lqconn*c=conns[i];
+	int l;
+	while(!c->streaming && c->outlen+LQ_MAXMSG<=LQ_OUTBUF && c->inlen>=2){
+		l=((int)c->in[0])<<8 | c->in[1];
+		if(l>MSG_MAXSIZE){
+			td_log(LOGWARN,"bulk leasequery: query of %i bytes is too big, closing connection",l);
+			closeconn(i);
+			return -1;
+		}
+		if(c->inlen<l+2)break;
+		handlebulk(c,c->in+2,l);
+		c->inlen-=l+2;
+		memmove(c->in,c->in+l+2,c->inlen);
+	}
+	/*half-closed: close after the last answer is out*/
+	if(c->eof && !c->streaming && c->outoff>=c->outlen && (c->inlen<2 || c->inlen<(((int)c->in[0])<<8 | c->in[1])+2)){
+		closeconn(i);
+		return -1;
+	}
+	return 0;
+}
+
+static void readconn(int i)
+{
+	struct lqconn*c=conns[i];
+	int r;
+	r=recv(c->fd,c->in+c->inlen,sizeof(c->in)-c->inlen,0);
+	if(r<0){
+		if(errno!=EAGAIN && errno!=EINTR)closeconn(i);
+		return;
+	}
+	if(r==0)
+		c->eof=1;
+	c->inlen+=r;
+	c->lastact=time(0);
+	parseconn(i);
+}
+
+static void writeconn(int i)
+{
+	struct lqconn*c=conns[i];
+	int r;
+	if(c->outoff>=c->outlen){
+		c->outoff=c->outlen=0;
+		fillstream(c);
+	}
+	if(c->outoff>=c->outlen){
+		if(!c->streaming)parseconn(i);
+		return;
+	}
+	r=send(c->fd,c->out+c->outoff,c->outlen-c->outoff,MSG_NOSIGNAL);
+	if(r<0){
+		if(errno!=EAGAIN && errno!=EINTR)closeconn(i);
+		return;
+	}
+	c->outoff+=r;
+	c->lastact=time(0);
+	if(c->outoff>=c->outlen){
+		c->outoff=c->outlen=0;
+		/*queries that arrived while we were busy*/
+		if(!c->streaming)parseconn(i);
+	}
+}
+
+static void acceptconn()
+{
+	int fd,i;
+	char a[64];
+	struct sockaddr_in6 sa;
+	socklen_t sl=sizeof(sa);
+	fd=accept(listenfd,(struct sockaddr*)&sa,&sl);
+	if(fd<0)return;
+	for(i=0;i<LQ_MAXCONN;i++)
+		if(!conns[i])break;
+	if(i>=LQ_MAXCONN){
+		td_log(LOGWARN,"bulk leasequery: too many connections, rejecting %s",inet_ntop(AF_INET6,&sa.sin6_addr,a,sizeof(a)));
+		close(fd);
+		return;
+	}
+	if(nallow?!allowed(&sa.sin6_addr):!IN6_IS_ADDR_LOOPBACK(&sa.sin6_addr)){
+		td_log(LOGWARN,"bulk leasequery: rejecting connection from %s, not an allowed requestor",inet_ntop(AF_INET6,&sa.sin6_addr,a,sizeof(a)));
+		close(fd);
+		return;
+	}
+	td_log(LOGINFO,"bulk leasequery: connection from %s",inet_ntop(AF_INET6,&sa.sin6_addr,a,sizeof(a)));
+	conns[i]=Malloc(sizeof(struct lqconn));
+	Memzero(conns[i],sizeof(struct lqconn));
+	conns[i]->fd=fd;
+	conns[i]->lastact=time(0);
+	fcntl(fd,F_SETFL,O_NONBLOCK);
+}
+
+int lqfdset(fd_set*rfd,fd_set*wfd,int maxfd)
+{
+	int i;
+	if(listenfd<0)return maxfd;
+	FD_SET(listenfd,rfd);
+	if(listenfd>maxfd)maxfd=listenfd;
+	for(i=0;i<LQ_MAXCONN;i++){
+		if(!conns[i])continue;
+		/*no more reading at the end of the stream or with a full buffer*/
+		if(!conns[i]->eof && conns[i]->inlen<sizeof(conns[i]->in))
+			FD_SET(conns[i]->fd,rfd);
+		if(conns[i]->streaming || conns[i]->outoff<conns[i]->outlen)
+			FD_SET(conns[i]->fd,wfd);
+		if(conns[i]->fd>maxfd)maxfd=conns[i]->fd;
+	}
+	return maxfd;
+}
+
+void lqpoll(fd_set*rfd,fd_set*wfd)
+{
+	int i;
+	if(listenfd<0)return;
+	for(i=0;i<LQ_MAXCONN;i++){
+		if(conns[i] && FD_ISSET(conns[i]->fd,wfd))
+			writeconn(i);
+		if(conns[i] && FD_ISSET(conns[i]->fd,rfd))
+			readconn(i);
+	}
+	if(FD_ISSET(listenfd,rfd))
+		acceptconn();
+}
+
+void lqtimer(long long now)
+{
+	int i;
+	for(i=0;i<LQ_MAXCONN;i++)
+		if(conns[i] && !conns[i]->streaming && now-conns[i]->lastact>LQ_IDLE)
+			closeconn(i);
+}
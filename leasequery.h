@@ -0,0 +1,45 @@
+/*
+// C Interface: leasequery
+//
+// Description: RFC 5007 leasequery (UDP) and RFC 5460 bulk leasequery (TCP)
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_LEASEQUERY_H
+#define TDHCP_LEASEQUERY_H
+
+#include "common.h"
+#include <sys/select.h>
+
+struct dhcp_msg;
+
+/*allow leasequeries over UDP*/
+void lqenable();
+/*accept bulk leasequery connections on "[addr]:port" or "port"; returns -1 on syntax errors*/
+int lqsetbulk(const char*);
+/*allows queries from the prefix "addr/len" (or a single address); without any,
+  only non-relayed link-local senders may query via UDP and only the loopback
+  address via TCP; returns -1 on syntax errors*/
+int lqallow(const char*);
+/*returns true if any kind of leasequery is enabled*/
+bool lqenabled();
+
+/*opens the bulk leasequery socket, returns 0 on success, -1 on error*/
+int lqinit();
+
+/*answers a LEASEQUERY received via UDP, frees the message*/
+void lqhandlemessage(struct dhcp_msg*);
+
+/*adds bulk leasequery sockets to the select sets, returns the new maximum fd*/
+int lqfdset(fd_set*rfd,fd_set*wfd,int maxfd);
+/*handles socket events after select*/
+void lqpoll(fd_set*rfd,fd_set*wfd);
+/*closes idle connections, call once per main loop iteration*/
+void lqtimer(long long now);
+
+#endif
@@ -0,0 +1,553 @@
+/*
+*  C Implementation: load
+*
+* Description: tdhcpload - load generator, simulates many DHCPv6 clients with
+* distinct DUIDs that run SOLICIT/REQUEST/RENEW/RELEASE lifecycles against a
+* server at a target rate or concurrency and reports rate, timeouts and latency
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "common.h"
+#include "sock.h"
+#include "message.h"
+
+#include <getopt.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+/*side ID: the virtual clients are clients*/
+const unsigned char SIDEID=SIDE_CLIENT;
+
+
+char shortopt[]="hn:r:c:d:s:t:R:pPaACL:";
+struct option longopt[]= {
+ {"clients",1,0,'n'},
+ {"rate",1,0,'r'},
+ {"concurrency",1,0,'c'},
+ {"duration",1,0,'d'},
+ {"sockets",1,0,'s'},
+ {"timeout",1,0,'t'},
+ {"retries",1,0,'R'},
+ {"prefix",0,0,'p'},
+ {"no-prefix",0,0,'P'},
+ {"address",0,0,'a'},
+ {"no-address",0,0,'A'},
+ {"no-rapid-commit",0,0,'C'},
+ {"log-level",1,0,'L'},
+ {"help",0,0,'h'},
+ {0,0,0,0}
+};
+
+#include "svnrev.h"
+#define HELP \
+ "Usage: %s [options] device [device...]\n" \
+ "TDHCPload - load generator for DHCPv6 servers, revision " SVNREV "\n"\
+ "(c) Konrad Rosenbaum, 2009\n"\
+ "this program is protected under the GNU GPLv3 or at your option any newer\n"\
+ "\n"\
+ "Each virtual client has its own DUID and runs lifecycles of SOLICIT (and\n"\
+ "REQUEST without rapid commit), RENEW and RELEASE. The virtual clients are\n"\
+ "spread over all sockets of all devices.\n"\
+ "\n"\
+ "TDHCPload options:\n" \
+ "  -h | --help\n" \
+ "    displays this help text and exit\n" \
+ \
+ "  -n num | --clients=num\n" \
+ "    number of virtual clients (default: %i)\n" \
+ \
+ "  -r rate | --rate=rate\n" \
+ "    start this many lifecycles per second (default: %i)\n" \
+ \
+ "  -c num | --concurrency=num\n" \
+ "    instead of a fixed rate keep num lifecycles running at any time\n" \
+ \
+ "  -d seconds | --duration=seconds\n" \
+ "    start lifecycles for this long, then wait for the running ones\n" \
+ "    (default: %i)\n" \
+ \
+ "  -s num | --sockets=num\n" \
+ "    sockets per device (default: 1)\n" \
+ \
+ "  -t ms | --timeout=ms\n" \
+ "    retransmit after this many milliseconds (default: %i)\n" \
+ \
+ "  -R num | --retries=num\n" \
+ "    transmissions per message before the lifecycle fails (default: %i)\n" \
+ \
+ "  -p | --prefix\n  -P | --no-prefix\n" \
+ "    enables (-p, default) or disables (-P) requesting a prefix\n" \
+ \
+ "  -a | --address\n  -A | --no-address\n" \
+ "    enables (-a) or disables (-A, default) requesting an address\n" \
+ \
+ "  -C | --no-rapid-commit\n" \
+ "    use the four message exchange instead of rapid commit\n" \
+ \
+ "  -L level | --log-level=level\n" \
+ "    set the log level (default is warn), must be one of:\n" \
+ "    none, error, warn, info, debug\n" \
+ "\n"
+
+static int numclients=1000,rate=100,concurrency=0,duration=10,socksperdev=1;
+static int timeout=1000,retries=3,getprefix=1,getaddress=0,userapid=1;
+
+/*output the help text*/
+static void printhelp(const char*argv0)
+{
+	fprintf(stderr,HELP,argv0,numclients,rate,duration,timeout,retries);
+}
+
+/*states of a virtual client*/
+#define VC_IDLE 0
+#define VC_SOLICIT 1
+#define VC_REQUEST 2
+#define VC_RENEW 3
+#define VC_RELEASE 4
+#define VC_NUMSTATES 5
+
+static const char*statenames[VC_NUMSTATES]={"idle","SOLICIT","REQUEST","RENEW","RELEASE"};
+static const int statemsg[VC_NUMSTATES]={0,MSG_SOLICIT,MSG_REQUEST,MSG_RENEW,MSG_RELEASE};
+
+/*one virtual client*/
+struct vclient {
+	int state,sock,tries;
+	/*message being sent and the last answer (server ID, IAs)*/
+	struct dhcp_msg*msg,*reply;
+	/*first transmission of the current message and retransmission time (us)*/
+	long long sent,deadline;
+	/*retransmission list, ordered by deadline, and transaction hash chain; -1 terminated*/
+	int prev,next,hnext;
+};
+
+static struct vclient*clients;
+/*idle clients*/
+static int*idle,numidle=0;
+/*retransmission list: all timeouts are equal, so appending keeps it sorted*/
+static int rthead=-1,rttail=-1;
+/*transaction ID -> client*/
+#define XIDHASHSIZE 65536
+static int xidhash[XIDHASHSIZE];
+
+/*sockets of all devices*/
+struct loadsock {
+	int fd,ifindex;
+};
+static struct loadsock*socks;
+static int numsocks=0;
+
+/*statistics*/
+static long long started=0,completed=0,failed=0,skipped=0,sentmsgs=0,timeouts=0,active=0;
+/*latency of each message type in us, from its first transmission to the answer*/
+static long*latency[VC_NUMSTATES];
+static int numlatency[VC_NUMSTATES],maxlatency[VC_NUMSTATES];
+
+/*current monotonic time in microseconds*/
+static long long usnow()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec*1000000LL+ts.tv_nsec/1000;
+}
+
+/*DUID of a virtual client: type 2 (enterprise), our PEN, project "LD", client number*/
+#define VC_DUIDLEN 12
+static void vcduid(int c,unsigned char*duid)
+{
+	duid[0]=0;
+	duid[1]=2;
+	duid[2]=(PEN>>24)&0xff;
+	duid[3]=(PEN>>16)&0xff;
+	duid[4]=(PEN>>8)&0xff;
+	duid[5]=PEN&0xff;
+	duid[6]='L';
+	duid[7]='D';
+	duid[8]=(c>>24)&0xff;
+	duid[9]=(c>>16)&0xff;
+	duid[10]=(c>>8)&0xff;
+	duid[11]=c&0xff;
+}
+
+static void rtremove(int c)
+{
+	struct vclient*v=&clients[c];
+	if(v->prev>=0)clients[v->prev].next=v->next;
+	else if(rthead==c)rthead=v->next;
+	else return;
+	if(v->next>=0)clients[v->next].prev=v->prev;
+	else rttail=v->prev;
+	v->prev=v->next=-1;
+}
+
+static void rtappend(int c)
+{
+	struct vclient*v=&clients[c];
+	v->prev=rttail;
+	v->next=-1;
+	if(rttail>=0)clients[rttail].next=c;
+	else rthead=c;
+	rttail=c;
+}
+
+static void xidremove(int c)
+{
+	int*p=&xidhash[clients[c].msg->msg_id%XIDHASHSIZE];
+	while(*p>=0 && *p!=c)p=&clients[*p].hnext;
+	if(*p==c)*p=clients[c].hnext;
+	xidclose(socks[clients[c].sock].ifindex,clients[c].msg->msg_id);
+}
+
+static int xidfindclient(long xid,int ifindex)
+{
+	int c=xidhash[xid%XIDHASHSIZE];
+	while(c>=0 && (clients[c].msg->msg_id!=xid || socks[clients[c].sock].ifindex!=ifindex))
+		c=clients[c].hnext;
+	return c;
+}
+
+/*sends the current message of the client (again)*/
+static void vcsend(int c)
+{
+	struct vclient*v=&clients[c];
+	sendmessage(v->msg);
+	sentmsgs++;
+	v->tries++;
+	rtremove(c);
+	v->deadline=usnow()+timeout*1000LL;
+	rtappend(c);
+}
+
+/*ends the current exchange of the client*/
+static void vcendmsg(int c)
+{
+	struct vclient*v=&clients[c];
+	if(!v->msg)return;
+	rtremove(c);
+	xidremove(c);
+	freemessage(v->msg);
+	v->msg=0;
+}
+
+/*ends the lifecycle of the client, it becomes idle*/
+static void vcfinish(int c,int ok)
+{
+	struct vclient*v=&clients[c];
+	vcendmsg(c);
+	if(v->reply)freemessage(v->reply);
+	v->reply=0;
+	if(ok)completed++;
+	else{
+		failed++;
+		td_log(LOGDEBUG,"virtual client %i failed in state %s",c,statenames[v->state]);
+	}
+	v->state=VC_IDLE;
+	idle[numidle++]=c;
+	active--;
+}
+
+/*copies an option of the last answer to msg, with T1/T2 cleared for IAs; returns -1 if there is none*/
+static int vccopyopt(struct dhcp_msg*msg,struct dhcp_msg*reply,unsigned short type)
+{
+	int p,q;
+	if(!reply || (p=messagefindoption(reply,type))<0)return -1;
+	q=messageappendopt(msg,&reply->msg_opt[p]);
+	if(q>=0 && (type==OPT_IANA || type==OPT_IAPD))
+		msg->msg_opt[q].opt_iana.t1=msg->msg_opt[q].opt_iana.t2=0;
+	return q;
+}
+
+/*starts the next exchange of the client*/
+static void vcstart(int c,int state)
+{
+	struct vclient*v=&clients[c];
+	struct dhcp_opt opt;
+	unsigned char duid[VC_DUIDLEN];
+	struct dhcp_msg*msg;
+	int p;
+	vcendmsg(c);
+	v->state=state;
+	v->tries=0;
+	msg=newmessage(statemsg[state]);
+	settargetserver(&msg->msg_peer);
+	msg->msg_peer.sin6_scope_id=socks[v->sock].ifindex;
+	msg->msg_sock=socks[v->sock].fd;
+	msg->msg_id=xidnew(socks[v->sock].ifindex);
+	xidopen(socks[v->sock].ifindex,msg->msg_id);
+	v->msg=msg;
+	v->hnext=xidhash[msg->msg_id%XIDHASHSIZE];
+	xidhash[msg->msg_id%XIDHASHSIZE]=c;
+	/*client ID*/
+	vcduid(c,duid);
+	Memzero(&opt,sizeof(opt));
+	opt.opt_type=OPT_CLIENTID;
+	opt.opt_duid.len=VC_DUIDLEN;
+	opt.opt_duid.duid=duid;
+	messageappendopt(msg,&opt);
+	/*everything after SOLICIT quotes the server and the IAs of the last answer*/
+	if(state!=VC_SOLICIT){
+		vccopyopt(msg,v->reply,OPT_SERVERID);
+		if(getprefix)vccopyopt(msg,v->reply,OPT_IAPD);
+		if(getaddress)vccopyopt(msg,v->reply,OPT_IANA);
+	}else{
+		if(getprefix){
+			p=messageaddopt(msg,OPT_IAPD);
+			msg->msg_opt[p].opt_iapd.iaid=c;
+		}
+		if(getaddress){
+			p=messageaddopt(msg,OPT_IANA);
+			msg->msg_opt[p].opt_iana.iaid=c;
+		}
+		if(userapid)messageaddopt(msg,OPT_RAPIDCOMMIT);
+	}
+	v->sent=usnow();
+	vcsend(c);
+}
+
+/*returns true if the answer binds every requested IA*/
+static int vcbound(struct dhcp_msg*msg)
+{
+	int t,p,i,ok;
+	for(t=0;t<2;t++){
+		if(t==0 && !getprefix)continue;
+		if(t==1 && !getaddress)continue;
+		p=messagefindoption(msg,t==0?OPT_IAPD:OPT_IANA);
+		if(p<0)return 0;
+		for(i=ok=0;i<msg->msg_opt[p].opt_numopts;i++){
+			struct dhcp_opt*o=&msg->msg_opt[p].subopt[i];
+			if(o->opt_type==OPT_STATUS_CODE && o->opt_status.status!=STAT_Success)return 0;
+			if(o->opt_type==OPT_IAPREFIX || o->opt_type==OPT_IAADDR)ok=1;
+		}
+		if(!ok)return 0;
+	}
+	return 1;
+}
+
+/*records the latency of the current exchange of the client*/
+static void vclatency(int c)
+{
+	struct vclient*v=&clients[c];
+	int s=v->state;
+	if(numlatency[s]>=maxlatency[s]){
+		long*n=Realloc(latency[s],(maxlatency[s]+4096)*sizeof(long));
+		if(!n)return;
+		latency[s]=n;
+		maxlatency[s]+=4096;
+	}
+	latency[s][numlatency[s]++]=usnow()-v->sent;
+}
+
+/*handles an answer*/
+static void handlemessage(struct dhcp_msg*rmsg)
+{
+	struct vclient*v;
+	int c;
+	c=xidfindclient(rmsg->msg_id,rmsg->msg_peer.sin6_scope_id);
+	if(c<0){
+		freemessage(rmsg);
+		return;
+	}
+	v=&clients[c];
+	/*only SOLICIT is answered by ADVERTISE*/
+	if(rmsg->msg_type==MSG_ADVERTISE && v->state!=VC_SOLICIT){
+		freemessage(rmsg);
+		return;
+	}
+	vclatency(c);
+	switch(v->state){
+		case VC_SOLICIT:case VC_REQUEST:case VC_RENEW:
+			if(!vcbound(rmsg)){
+				freemessage(rmsg);
+				vcfinish(c,0);
+				return;
+			}
+			if(v->reply)freemessage(v->reply);
+			v->reply=rmsg;
+			if(rmsg->msg_type==MSG_ADVERTISE)vcstart(c,VC_REQUEST);
+			else vcstart(c,v->state==VC_RENEW?VC_RELEASE:VC_RENEW);
+			break;
+		case VC_RELEASE:
+			freemessage(rmsg);
+			vcfinish(c,1);
+			break;
+		default:
+			freemessage(rmsg);
+			break;
+	}
+}
+
+/*starts the lifecycle of an idle client*/
+static void startlifecycle()
+{
+	int c;
+	if(!numidle){
+		skipped++;
+		return;
+	}
+	c=idle[--numidle];
+	started++;
+	active++;
+	vcstart(c,VC_SOLICIT);
+}
+
+/*retransmits or gives up on clients whose timeout has passed*/
+static void handletimeouts(long long now)
+{
+	int c;
+	while(rthead>=0 && clients[rthead].deadline<=now){
+		c=rthead;
+		timeouts++;
+		if(clients[c].tries<retries)vcsend(c);
+		else vcfinish(c,0);
+	}
+}
+
+static int cmplong(const void*a,const void*b)
+{
+	long x=*(const long*)a,y=*(const long*)b;
+	return x<y?-1:x>y;
+}
+
+/*prints the results*/
+static void report(long long elapsed)
+{
+	int s,n;
+	double secs=elapsed/1000000.0;
+	printf("elapsed: %.2fs, clients: %i, lifecycles started: %lli, completed: %lli, failed: %lli, skipped (no idle client): %lli\n",
+		secs,numclients,started,completed,failed,skipped);
+	printf("achieved rate: %.1f lifecycles/s, %.1f messages/s sent, %lli timeouts\n",
+		completed/secs,sentmsgs/secs,timeouts);
+	printf("latency (ms)  count      p50      p90      p99      max\n");
+	for(s=VC_SOLICIT;s<VC_NUMSTATES;s++){
+		n=numlatency[s];
+		if(!n)continue;
+		qsort(latency[s],n,sizeof(long),cmplong);
+		printf("%-10s %8i %8.2f %8.2f %8.2f %8.2f\n",statenames[s],n,
+			latency[s][(n-1)*50/100]/1000.0,latency[s][(n-1)*90/100]/1000.0,
+			latency[s][(n-1)*99/100]/1000.0,latency[s][n-1]/1000.0);
+	}
+}
+
+int main(int argc,char**argv)
+{
+	int c,i,j,optindex=1;
+	long long start,now,end,wait,due;
+	/*parse options*/
+        while(1){
+                c=getopt_long(argc,argv,shortopt,longopt,&optindex);
+                if(c==-1)break;
+                switch(c){
+                        case 'n':numclients=atoi(optarg);break;
+                        case 'r':rate=atoi(optarg);break;
+                        case 'c':concurrency=atoi(optarg);break;
+                        case 'd':duration=atoi(optarg);break;
+                        case 's':socksperdev=atoi(optarg);break;
+                        case 't':timeout=atoi(optarg);break;
+                        case 'R':retries=atoi(optarg);break;
+                        case 'p':getprefix=1;break;
+                        case 'P':getprefix=0;break;
+                        case 'a':getaddress=1;break;
+                        case 'A':getaddress=0;break;
+                        case 'C':userapid=0;break;
+                        case 'L':setloglevel(optarg);break;
+                        default:
+                                fprintf(stderr,"Syntax error in arguments.\n");
+                                printhelp(*argv);
+                                return 1;
+                                break;
+                        case 'h':
+                                printhelp(*argv);
+                                return 0;
+                                break;
+                }
+        }
+	if(optind>=argc || numclients<1 || rate<1 || concurrency<0 || duration<1 || socksperdev<1 ||
+	   timeout<1 || retries<1 || (!getprefix && !getaddress)){
+		fprintf(stderr,"Syntax error.\n");
+		printhelp(*argv);
+		return 1;
+	}
+	/*sockets on ephemeral ports: the server answers to the port a message came from*/
+	numsocks=(argc-optind)*socksperdev;
+	socks=Malloc(numsocks*sizeof(struct loadsock));
+	for(i=0;i<argc-optind;i++)
+		for(j=0;j<socksperdev;j++){
+			struct loadsock*s=&socks[i*socksperdev+j];
+			int val=1<<20;
+			s->fd=initifsocket(0,argv[optind+i],&s->ifindex);
+			if(s->fd<0){
+				td_log(LOGERROR,"unable to allocate socket for %s, exiting.",argv[optind+i]);
+				return 1;
+			}
+			setsockopt(s->fd,SOL_SOCKET,SO_RCVBUF,&val,sizeof(val));
+		}
+	/*virtual clients, all idle*/
+	clients=Malloc(numclients*sizeof(struct vclient));
+	idle=Malloc(numclients*sizeof(int));
+	Memzero(clients,numclients*sizeof(struct vclient));
+	for(i=0;i<numclients;i++){
+		clients[i].sock=i%numsocks;
+		clients[i].prev=clients[i].next=clients[i].hnext=-1;
+		idle[numidle++]=numclients-1-i;
+	}
+	for(i=0;i<XIDHASHSIZE;i++)xidhash[i]=-1;
+	clearrecvfilter();
+	addrecvfilter(MSG_ADVERTISE);
+	addrecvfilter(MSG_REPLY);
+	COMPAREMSGID=1;
+	/*main loop*/
+	start=usnow();
+	end=start+duration*1000000LL;
+	while(1){
+		fd_set rfd;
+		struct timeval tv;
+		int maxfd=-1;
+		now=usnow();
+		/*start new lifecycles*/
+		wait=-1;
+		if(now<end){
+			if(concurrency)
+				while(active<concurrency && numidle)startlifecycle();
+			else{
+				due=(now-start)*rate/1000000+1;
+				while(started+skipped<due)startlifecycle();
+				wait=start+(started+skipped)*1000000LL/rate-now;
+			}
+			if(wait<0 || wait>end-now)wait=end-now;
+		}else if(!active)break;
+		/*retransmissions*/
+		handletimeouts(now);
+		if(rthead>=0 && (wait<0 || clients[rthead].deadline-now<wait))
+			wait=clients[rthead].deadline-now;
+		if(wait<0)wait=0;
+		/*wait for answers*/
+		FD_ZERO(&rfd);
+		for(i=0;i<numsocks;i++){
+			FD_SET(socks[i].fd,&rfd);
+			if(socks[i].fd>maxfd)maxfd=socks[i].fd;
+		}
+		tv.tv_sec=wait/1000000;
+		tv.tv_usec=wait%1000000;
+		if(select(maxfd+1,&rfd,0,0,&tv)<0){
+			if(errno==EINTR)continue;
+			td_log(LOGERROR,"Error caught: %s",strerror(errno));
+			return 1;
+		}
+		for(i=0;i<numsocks;i++)
+			if(FD_ISSET(socks[i].fd,&rfd)){
+				struct dhcp_msg*msg=readmessagefrom(socks[i].fd,0);
+				if(msg)handlemessage(msg);
+			}
+	}
+	report(usnow()-start);
+	return failed?2:0;
+}
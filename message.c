@@ -17,11 +17,35 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <arpa/inet.h>
 
 /*increase allocation by ... entities*/
 #define ALLOCINCR 8
 
+/*state of the transaction ID generator (xorshift64*), seeded on first use*/
+static unsigned long long xidstate=0;
+
+/*returns a random 24bit transaction ID*/
+static long xidrandom()
+{
+	if(!xidstate){
+		int fd=open("/dev/urandom",O_RDONLY);
+		if(fd<0 || read(fd,&xidstate,sizeof(xidstate))!=sizeof(xidstate)){
+			struct timeval tv;
+			gettimeofday(&tv,0);
+			xidstate=((unsigned long long)tv.tv_sec<<20)^tv.tv_usec^((unsigned long long)getpid()<<40);
+		}
+		if(fd>=0)close(fd);
+		if(!xidstate)xidstate=0x9e3779b97f4a7c15ULL;
+	}
+	xidstate^=xidstate>>12;
+	xidstate^=xidstate<<25;
+	xidstate^=xidstate>>27;
+	return ((xidstate*0x2545f4914f6cdd1dULL)>>40)&0xffffff;
+}
+
 struct dhcp_msg* newmessage(int t)
 {
 	struct dhcp_msg *r;
@@ -30,8 +54,9 @@ struct dhcp_msg* newmessage(int t)
 	if(r==0)return 0;
 	Memzero(r,sizeof(struct dhcp_msg));
 	gettimeofday(&r->starttime,0);
-	r->msg_id=(r->starttime.tv_sec+r->starttime.tv_usec)&0xffffff;
+	r->msg_id=xidrandom();
 	r->msg_type=t;
+	r->msg_sock=-1;
 	
 	return r;
 }
@@ -96,11 +121,22 @@ void freemessage(struct dhcp_msg*m)
 	for(i=0;i<m->msg_numopts;i++)
 		freeopt(&m->msg_opt[i]);
 	Free(m->msg_opt);
+	Free(m->msg_relay);
 	/*wipe and free*/
 	Memzero(m,sizeof(struct dhcp_msg));
 	Free(m);
 }
 
+void messagemoverelay(struct dhcp_msg*to,struct dhcp_msg*from)
+{
+	if(!to || !from)return;
+	Free(to->msg_relay);
+	to->msg_relay=from->msg_relay;
+	to->msg_numrelay=from->msg_numrelay;
+	from->msg_relay=0;
+	from->msg_numrelay=0;
+}
+
 /*removes an option (and all sub-options) from the message*/
 void messageremoveoption(struct dhcp_msg*msg,unsigned short opt)
 {
@@ -363,9 +399,46 @@ static void encodeopt(struct dhcp_opt*opt,unsigned char*buf,int*pos,int max)
 			COPYINT2(buf+p+4,opt->opt_status.status);
 			Memcpy(buf+p+6,opt->opt_status.message,strlen(opt->opt_status.message));
 			break;
-		case OPT_RAPIDCOMMIT:
+		case OPT_RAPIDCOMMIT:case OPT_RECONF_ACCEPT:
 			/*nothing to do*/
 			break;
+		case OPT_AUTH:
+			*pos+=11+opt->opt_auth.infolen;
+			if(*pos>max)return;
+			buf[p+4]=opt->opt_auth.proto;
+			buf[p+5]=opt->opt_auth.alg;
+			buf[p+6]=opt->opt_auth.rdm;
+			Memcpy(buf+p+7,opt->opt_auth.replay,8);
+			Memcpy(buf+p+15,opt->opt_auth.info,opt->opt_auth.infolen);
+			break;
+		case OPT_RECONF_MSG:
+			*pos+=1;
+			if(*pos>max)return;
+			buf[p+4]=opt->opt_reconf_msg.msg_type;
+			break;
+		case OPT_UNICAST:
+			*pos+=16;
+			if(*pos>max)return;
+			Memcpy(buf+p+4,&opt->opt_unicast.addr,16);
+			break;
+		case OPT_LQ_QUERY:
+			*pos+=17;
+			if(*pos>max)return;
+			buf[p+4]=opt->opt_lq_query.query_type;
+			Memcpy(buf+p+5,&opt->opt_lq_query.link_addr,16);
+			/*sub-opts*/
+			for(l=0;l<opt->opt_numopts;l++)
+				encodeopt(&opt->subopt[l],buf,pos,max);
+			break;
+		case OPT_CLIENT_DATA:
+			for(l=0;l<opt->opt_numopts;l++)
+				encodeopt(&opt->subopt[l],buf,pos,max);
+			break;
+		case OPT_CLT_TIME:
+			*pos+=4;
+			if(*pos>max)return;
+			COPYINT4(buf+p+4,opt->opt_clt_time.secs)
+			break;
 		case OPT_OPTREQUEST:
 			*pos+=2*opt->opt_oro.numopts;
 			if(*pos>max)return;
@@ -400,15 +473,61 @@ static void encodetime(struct dhcp_msg*msg,unsigned char*buf,int*pos,int max)
 
 /*flag: compare message id on receive*/
 int COMPAREMSGID=0;
-/*remembers last sent message id for comparison*/
-static int lastmsgid=0;
 
-/*sends a message to the peer*/
-void sendmessage(struct dhcp_msg*msg)
+/*open transactions, hashed by interface index and transaction ID*/
+#define XIDBUCKETS 256
+struct xidentry {
+	int ifindex;
+	long xid;
+	struct xidentry*next;
+};
+static struct xidentry*xidtable[XIDBUCKETS];
+
+static struct xidentry**xidfind(int ifindex,long xid)
+{
+	struct xidentry**e;
+	e=&xidtable[((unsigned long)xid^(unsigned long)ifindex*2654435761UL)%XIDBUCKETS];
+	while(*e && ((*e)->ifindex!=ifindex || (*e)->xid!=xid))e=&(*e)->next;
+	return e;
+}
+
+long xidnew(int ifindex)
+{
+	long xid;
+	do xid=xidrandom(); while(*xidfind(ifindex,xid));
+	return xid;
+}
+
+void xidopen(int ifindex,long xid)
+{
+	struct xidentry**e=xidfind(ifindex,xid);
+	if(*e)return;
+	*e=Malloc(sizeof(struct xidentry));
+	if(!*e)return;
+	(*e)->ifindex=ifindex;
+	(*e)->xid=xid;
+	(*e)->next=0;
+}
+
+void xidclose(int ifindex,long xid)
+{
+	struct xidentry**e=xidfind(ifindex,xid),*d;
+	if(!*e)return;
+	d=*e;
+	*e=d->next;
+	Free(d);
+}
+
+int xidisopen(int ifindex,long xid)
+{
+	return *xidfind(ifindex,xid)!=0;
+}
+
+/*encodes the message itself, without relay headers*/
+static int encodeplain(struct dhcp_msg*msg,unsigned char*buf,int max)
 {
-	unsigned char buf[65536];
 	int i,pos;
-	if(msg==0)return;
+	if(max<4)return -1;
 	/*header*/
 	/*type*/
 	buf[0]=msg->msg_type;
@@ -419,32 +538,101 @@ void sendmessage(struct dhcp_msg*msg)
 	pos=4;
 	/*options*/
 	for(i=0;i<msg->msg_numopts;i++)
-		encodeopt(&msg->msg_opt[i],buf,&pos,sizeof(buf));
+		encodeopt(&msg->msg_opt[i],buf,&pos,max);
 	/*elapsed time for the client*/
 	if(SIDEID==SIDE_CLIENT)
-		encodetime(msg,buf,&pos,sizeof(buf));
+		encodetime(msg,buf,&pos,max);
+	/*check*/
+	if(pos>max)return -1;
+	return pos;
+}
+
+int encodemessage(struct dhcp_msg*msg,unsigned char*buf,int max)
+{
+	int i,hlen,len,pos;
+	struct dhcp_relay*r;
+	if(msg==0 || max<4)return -1;
+	if(!msg->msg_numrelay)
+		return encodeplain(msg,buf,max);
+	/*the message goes behind the relay headers, so it is not copied*/
+	for(i=hlen=0;i<msg->msg_numrelay;i++){
+		hlen+=34+4;
+		if(msg->msg_relay[i].ifid)hlen+=4+msg->msg_relay[i].ifidlen;
+	}
+	if(hlen>=max)return -1;
+	len=encodeplain(msg,buf+hlen,max-hlen);
+	if(len<0)return -1;
+	len+=hlen;
+	/*wrap, outermost relay first*/
+	for(i=pos=0;i<msg->msg_numrelay;i++){
+		r=&msg->msg_relay[i];
+		buf[pos]=MSG_RELAY_REPL;
+		buf[pos+1]=r->hopcount;
+		Memcpy(buf+pos+2,&r->linkaddr,16);
+		Memcpy(buf+pos+18,&r->peeraddr,16);
+		pos+=34;
+		if(r->ifid){
+			COPYINT2(buf+pos,OPT_INTERFACE_ID);
+			COPYINT2(buf+pos+2,r->ifidlen);
+			Memcpy(buf+pos+4,r->ifid,r->ifidlen);
+			pos+=4+r->ifidlen;
+		}
+		COPYINT2(buf+pos,OPT_RELAY_MSG);
+		COPYINT2(buf+pos+2,len-pos-4);
+		pos+=4;
+	}
+	return len;
+}
+
+/*sends a message to the peer*/
+void sendmessage(struct dhcp_msg*msg)
+{
+	unsigned char buf[65536];
+	int pos;
+	if(msg==0)return;
+	pos=encodemessage(msg,buf,sizeof(buf));
 	/*check*/
-	if(pos>sizeof(buf)){
+	if(pos<0){
 		td_log(LOGERROR,"internal problem: message is too big (>64kB) to send");
 		return;
 	}
 	/*send*/
-	i=sendto(sockfd,buf,pos,0,(struct sockaddr*)&msg->msg_peer,sizeof(msg->msg_peer));
-	if(i<0)
-		td_log(LOGERROR,"unable to send message to %s: %s", inet_ntop(AF_INET6,&msg->msg_peer.sin6_addr,(char*)buf,sizeof(buf)), strerror(errno));
-	else{
-		td_log(LOGDEBUG,"sent message of type %i, %i bytes, to %s", (int)msg->msg_type, pos, inet_ntop(AF_INET6,&msg->msg_peer.sin6_addr,(char*)buf,sizeof(buf)));
-		lastmsgid=msg->msg_id;
+	sendencoded(msg,buf,pos);
+}
+
+int sendencoded(struct dhcp_msg*msg,const unsigned char*buf,int len)
+{
+	char tmp[128];
+	int i;
+	i=sendto(msg->msg_sock>=0?msg->msg_sock:sockfd,buf,len,0,(struct sockaddr*)&msg->msg_peer,sizeof(msg->msg_peer));
+	if(i<0){
+		td_log(LOGERROR,"unable to send message to %s: %s", inet_ntop(AF_INET6,&msg->msg_peer.sin6_addr,tmp,sizeof(tmp)), strerror(errno));
+		return -1;
 	}
+	td_log(LOGDEBUG,"sent message of type %i, %i bytes, to %s", (int)msg->msg_type, len, inet_ntop(AF_INET6,&msg->msg_peer.sin6_addr,tmp,sizeof(tmp)));
+	return 0;
 }
 
 /*message types that we receive*/
-unsigned char MSGFILTER[8]={0,0,0,0, 0,0,0,0};
+unsigned char MSGFILTER[16]={0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0};
+/*message types that we receive from non-link-local senders*/
+static unsigned char GLOBALFILTER[16]={0,0,0,0, 0,0,0,0, 0,0,0,0, 0,0,0,0};
 void clearrecvfilter()
 {
 	Memzero(MSGFILTER,sizeof(MSGFILTER));
 }
 
+void addglobalfilter(unsigned char t)
+{
+	int i;
+	if(t==0)return;
+	for(i=0;i<sizeof(GLOBALFILTER);i++)
+		if(GLOBALFILTER[i]==0 || GLOBALFILTER[i]==t){
+			GLOBALFILTER[i]=t;
+			return;
+		}
+}
+
 void addrecvfilter(unsigned char t)
 {
 	int i;
@@ -474,6 +662,8 @@ static void decodesubopts(struct dhcp_opt*opt,unsigned char*buf,int max)
 		/*allocate*/
 		opt->subopt=Realloc(opt->subopt,sizeof(struct dhcp_opt)*(opt->opt_numopts+1));
 		Memzero(&opt->subopt[opt->opt_numopts],sizeof(struct dhcp_opt));
+		/*cloneopt copies priv_optlen sub-options*/
+		opt->priv_optlen=opt->opt_numopts+1;
 		/*actually decode it*/
 		opt->subopt[opt->opt_numopts].opt_type=t;
 		opt->subopt[opt->opt_numopts].opt_len=s;
@@ -554,9 +744,28 @@ static void decodeopt(struct dhcp_opt*opt,unsigned char*buf,int max)
 			opt->opt_iana.t2=GETINT4(buf+8);
 			decodesubopts(opt,buf+12,max-12);
 			break;
-		case OPT_RAPIDCOMMIT:
+		case OPT_RAPIDCOMMIT:case OPT_RECONF_ACCEPT:
 			/*nothing to do*/
 			break;
+		case OPT_AUTH:
+			if(max<11)return;
+			opt->opt_auth.proto=buf[0];
+			opt->opt_auth.alg=buf[1];
+			opt->opt_auth.rdm=buf[2];
+			Memcpy(opt->opt_auth.replay,buf+3,8);
+			opt->opt_auth.infolen=max-11;
+			if(opt->opt_auth.infolen>sizeof(opt->opt_auth.info))
+				opt->opt_auth.infolen=sizeof(opt->opt_auth.info);
+			Memcpy(opt->opt_auth.info,buf+11,opt->opt_auth.infolen);
+			break;
+		case OPT_RECONF_MSG:
+			if(max<1)return;
+			opt->opt_reconf_msg.msg_type=buf[0];
+			break;
+		case OPT_UNICAST:
+			if(max<16)return;
+			Memcpy(&opt->opt_unicast.addr,buf,16);
+			break;
 		case OPT_OPTREQUEST:
 			opt->opt_oro.numopts=max/2;
 			opt->opt_oro.opt=Malloc(opt->opt_oro.numopts*sizeof(unsigned short));
@@ -584,11 +793,24 @@ static void decodeopt(struct dhcp_opt*opt,unsigned char*buf,int max)
 			if(max<2)return;
 			opt->opt_ela_time.csecs=GETINT2(buf);
 			break;
+		case OPT_LQ_QUERY:
+			if(max<17)return;
+			opt->opt_lq_query.query_type=buf[0];
+			Memcpy(&opt->opt_lq_query.link_addr,buf+1,16);
+			decodesubopts(opt,buf+17,max-17);
+			break;
+		case OPT_CLIENT_DATA:
+			decodesubopts(opt,buf,max);
+			break;
+		case OPT_CLT_TIME:
+			if(max<4)return;
+			opt->opt_clt_time.secs=GETINT4(buf);
+			break;
 		case OPT_STATUS_CODE:
 			if(max<2)return;
 			opt->opt_status.status=GETINT2(buf);
 			opt->opt_status.message=Malloc(max-1);
-			Memcpy(opt->opt_status.message,buf,max-2);
+			Memcpy(opt->opt_status.message,buf+2,max-2);
 			opt->opt_status.message[max-2]=0;
 			break;
 		default:
@@ -603,7 +825,7 @@ static void decodemsgopt(struct dhcp_msg*msg,unsigned char*buf,int*pos,int max)
 	int p,s;
 	p=*pos;
 	*pos+=4;
-	if(*pos>=max)return;
+	if(*pos>max)return;
 	/*check option size*/
 	s=GETINT2(buf+p+2);
 	*pos+=s;
@@ -622,8 +844,84 @@ static void decodemsgopt(struct dhcp_msg*msg,unsigned char*buf,int*pos,int max)
 	msg->msg_numopts++;
 }
 
+/*unwraps RELAY-FORW messages in place: the relay headers are collected and
+  the inner message is decoded directly out of the buffer*/
+static struct dhcp_msg* decoderelayed(unsigned char*buf,int max)
+{
+	struct dhcp_relay rel[MSG_MAXRELAY];
+	struct dhcp_msg*msg;
+	unsigned char*inner,*tail;
+	int i,n=0,p,s,extra=0,innerlen=0;
+	while(max>0 && buf[0]==MSG_RELAY_FORW){
+		if(max<34){
+			td_log(LOGWARN,"received undersized relay message, dropping it");
+			return 0;
+		}
+		if(n>=MSG_MAXRELAY){
+			td_log(LOGWARN,"received message through more than %i relays, dropping it",MSG_MAXRELAY);
+			return 0;
+		}
+		Memzero(&rel[n],sizeof(rel[n]));
+		rel[n].hopcount=buf[1];
+		Memcpy(&rel[n].linkaddr,buf+2,16);
+		Memcpy(&rel[n].peeraddr,buf+18,16);
+		inner=0;
+		for(p=34;p+4<=max;p+=4+s){
+			s=GETINT2(buf+p+2);
+			if(p+4+s>max){
+				td_log(LOGWARN,"encountered relay option that spans beyond the message, dropping it");
+				return 0;
+			}
+			switch(GETINT2(buf+p)){
+				case OPT_RELAY_MSG:
+					inner=buf+p+4;
+					innerlen=s;
+					break;
+				case OPT_INTERFACE_ID:
+					rel[n].ifid=buf+p+4;
+					rel[n].ifidlen=s;
+					break;
+				case OPT_REMOTE_ID:
+					if(s<4)break;
+					rel[n].remoteent=GETINT4(buf+p+4);
+					rel[n].remoteid=buf+p+8;
+					rel[n].remoteidlen=s-4;
+					break;
+			}
+		}
+		if(!inner){
+			td_log(LOGWARN,"received relay message without relayed message, dropping it");
+			return 0;
+		}
+		extra+=rel[n].ifidlen+rel[n].remoteidlen;
+		n++;
+		buf=inner;
+		max=innerlen;
+	}
+	msg=decodemessage(buf,max);
+	if(!msg)return 0;
+	/*keep the relays, their IDs are stored behind the array*/
+	msg->msg_relay=Malloc(n*sizeof(struct dhcp_relay)+extra);
+	tail=(unsigned char*)(msg->msg_relay+n);
+	for(i=0;i<n;i++){
+		msg->msg_relay[i]=rel[i];
+		if(rel[i].ifid){
+			Memcpy(tail,rel[i].ifid,rel[i].ifidlen);
+			msg->msg_relay[i].ifid=tail;
+			tail+=rel[i].ifidlen;
+		}
+		if(rel[i].remoteid){
+			Memcpy(tail,rel[i].remoteid,rel[i].remoteidlen);
+			msg->msg_relay[i].remoteid=tail;
+			tail+=rel[i].remoteidlen;
+		}
+	}
+	msg->msg_numrelay=n;
+	return msg;
+}
+
 /*decode a DHCPv6 message*/
-static struct dhcp_msg* decodemessage(unsigned char*buf,int max)
+struct dhcp_msg* decodemessage(unsigned char*buf,int max)
 {
 	int i,p;
 	struct dhcp_msg*msg;
@@ -632,6 +930,13 @@ static struct dhcp_msg* decodemessage(unsigned char*buf,int max)
 		td_log(LOGWARN,"received undersized message, dropping it");
 		return 0;
 	}
+	if(buf[0]==MSG_RELAY_FORW){
+		for(i=0;i<(sizeof(MSGFILTER)/sizeof(unsigned char));i++)
+			if(MSGFILTER[i]==MSG_RELAY_FORW)
+				return decoderelayed(buf,max);
+		td_log(LOGINFO,"received relayed message, but relays are not accepted; dropping it");
+		return 0;
+	}
 	if(buf[0]==0){
 		td_log(LOGWARN,"received invalid message, dropping it");
 		return 0;
@@ -645,18 +950,14 @@ static struct dhcp_msg* decodemessage(unsigned char*buf,int max)
 		td_log(LOGINFO,"received unexpected message of type %i, dropping it",(int)buf[0]);
 		return 0;
 	}
-	/*decode + check MSG_ID for responses*/
+	/*decode*/
 	p=((int)buf[1])<<16 | ((int)buf[2])<<8 | buf[3];
-	if(COMPAREMSGID)
-		if(p!=lastmsgid){
-			td_log(LOGINFO,"received unexpected message with msg id %i, while expecting %i",p,lastmsgid);
-			return 0;
-		}
 	/*allocate*/
 	msg=Malloc(sizeof(struct dhcp_msg));
 	Memzero(msg,sizeof(struct dhcp_msg));
 	msg->msg_id=p;
 	msg->msg_type=buf[0];
+	msg->msg_sock=-1;
 	/*decode options*/
 	p=4;
 	while(p<max)
@@ -665,8 +966,19 @@ static struct dhcp_msg* decodemessage(unsigned char*buf,int max)
 	return msg;
 }
 
-/*read a message from the line and return it (NULL on error)*/
+static bool(*recvhook)(int,unsigned char*,int,struct sockaddr_in6*)=0;
+void setrecvhook(bool(*h)(int,unsigned char*,int,struct sockaddr_in6*))
+{
+	recvhook=h;
+}
+
 struct dhcp_msg* readmessage()
+{
+	return readmessagefrom(sockfd,0);
+}
+
+/*read a message from the line and return it (NULL on error)*/
+struct dhcp_msg* readmessagefrom(int fd,int anysender)
 {
 	char buf[65536],tmp[128];
 	int s;
@@ -676,7 +988,7 @@ struct dhcp_msg* readmessage()
 	unsigned char *llt;
 	/*receive*/
 	p=sizeof(sa);
-	s=recvfrom(sockfd,buf,sizeof(buf),MSG_TRUNC,(struct sockaddr*)&sa,&p);
+	s=recvfrom(fd,buf,sizeof(buf),MSG_TRUNC,(struct sockaddr*)&sa,&p);
 	/*check message size*/
 	if(s<0){
 		td_log(LOGWARN,"error during read: %s",strerror(errno));
@@ -689,13 +1001,33 @@ struct dhcp_msg* readmessage()
 	}
 	/*check sender*/
 	llt= (unsigned char*)&sa.sin6_addr;
-	if(llt[0]!=0xfe || (llt[1]&0xc0)!=0x80){
-		td_log(LOGWARN,"received message from non-link-local sender, dropping it");
-		return 0;
+	if(!anysender && (llt[0]!=0xfe || (llt[1]&0xc0)!=0x80)){
+		int i,ok=0;
+		if(s>0)
+			for(i=0;i<sizeof(GLOBALFILTER) && GLOBALFILTER[i];i++)
+				if(GLOBALFILTER[i]==(unsigned char)buf[0])ok=1;
+		if(!ok){
+			td_log(LOGWARN,"received message from non-link-local sender, dropping it");
+			return 0;
+		}
 	}
+	/*check MSG_ID for responses: it must belong to a transaction open on the receiving interface*/
+	if(COMPAREMSGID && s>=4){
+		long xid=((long)(unsigned char)buf[1])<<16 | ((long)(unsigned char)buf[2])<<8 | (unsigned char)buf[3];
+		if(!xidisopen(sa.sin6_scope_id,xid)){
+			td_log(LOGINFO,"received unexpected message with msg id %li on interface %i, dropping it",xid,(int)sa.sin6_scope_id);
+			return 0;
+		}
+	}
+	/*somebody else may know the answer already*/
+	if(recvhook && recvhook(fd,(unsigned char*)buf,s,&sa))
+		return 0;
 	/*decode*/
 	td_log(LOGDEBUG,"read %i bytes, decoding now",s);
 	ret=decodemessage((unsigned char*)buf,s);
-	if(ret)Memcpy(&ret->msg_peer,&sa,sizeof(sa));
+	if(ret){
+		Memcpy(&ret->msg_peer,&sa,sizeof(sa));
+		if(fd!=sockfd)ret->msg_sock=fd;
+	}
 	return ret;
 }
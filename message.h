@@ -20,20 +20,49 @@
 #define MSG_SOLICIT 1
 #define MSG_ADVERTISE 2
 #define MSG_REQUEST 3
+/*MSG_CONFIRM is a send flag in sys/socket.h*/
+#define MSG_DHCP_CONFIRM 4
+#define MSG_RENEW 5
+#define MSG_REBIND 6
 #define MSG_REPLY 7
+#define MSG_RELEASE 8
+#define MSG_DECLINE 9
+#define MSG_RECONFIGURE 10
 #define MSG_IREQUEST 11
+#define MSG_RELAY_FORW 12
+#define MSG_RELAY_REPL 13
+/*RFC 5007/5460 leasequery*/
+#define MSG_LEASEQUERY 14
+#define MSG_LEASEQUERY_REPLY 15
+#define MSG_LEASEQUERY_DONE 16
+#define MSG_LEASEQUERY_DATA 17
+
+/*maximum nesting of relay agents*/
+#define MSG_MAXRELAY 8
 
 /*currently defined maximum size of the message*/
 #define MSG_MAXSIZE 65535
 
 /*receive filter for messages - set in client.c and server.c*/
-extern unsigned char MSGFILTER[8];
+extern unsigned char MSGFILTER[16];
 void clearrecvfilter();
 void addrecvfilter(unsigned char);
+/*message types that are also accepted from non-link-local senders (default: none)*/
+void addglobalfilter(unsigned char);
 
-/*flag: if true compare the message ID of received messages with that of the last sent message*/
+/*flag: if true only messages that answer an open transaction (see xidopen) are received*/
 extern int COMPAREMSGID;
 
+/*client transactions, keyed by interface index and transaction ID*/
+/*returns a random transaction ID that is not open on the interface*/
+long xidnew(int ifindex);
+/*marks a transaction as open, answers to it are received*/
+void xidopen(int ifindex,long xid);
+/*closes a transaction, further answers are dropped*/
+void xidclose(int ifindex,long xid);
+/*returns true if the transaction is open*/
+int xidisopen(int ifindex,long xid);
+
 /*primary options*/
 #define OPT_CLIENTID 1
 #define OPT_SERVERID 2
@@ -42,13 +71,23 @@ extern int COMPAREMSGID;
 #define OPT_IANA 3
 #define OPT_IAPD 25
 #define OPT_RAPIDCOMMIT 14
+#define OPT_UNICAST 12
 #define OPT_OPTREQUEST 6
+#define OPT_RELAY_MSG 9
+#define OPT_AUTH 11
+#define OPT_RECONF_MSG 19
+#define OPT_RECONF_ACCEPT 20
+#define OPT_INTERFACE_ID 18
+#define OPT_REMOTE_ID 37
+#define OPT_LQ_QUERY 44
+#define OPT_CLIENT_DATA 45
 
 /*sub-options*/
 #define OPT_IAADDR 5
 #define OPT_IAPREFIX 26
 #define OPT_ELA_TIME 8
 #define OPT_STATUS_CODE 13
+#define OPT_CLT_TIME 46
 
 
 #define STAT_Success	     0
@@ -61,6 +100,33 @@ extern int COMPAREMSGID;
 #define STAT_NotOnLink       4 
 /*force client to use multicasting*/
 #define STAT_UseMulticast    5
+/*delegating router has no prefixes available for the IA_PD*/
+#define STAT_NoPrefixAvail   6
+/*leasequery: query type is not supported*/
+#define STAT_UnknownQueryType 7
+/*leasequery: query is malformed*/
+#define STAT_MalformedQuery  8
+/*leasequery: the server does not know the address or client*/
+#define STAT_NotConfigured   9
+/*leasequery: the requestor is not allowed to query*/
+#define STAT_NotAllowed      10
+/*bulk leasequery: the server terminated the query*/
+#define STAT_QueryTerminated 11
+
+/*authentication: reconfigure key protocol with HMAC-MD5 and a monotonic counter*/
+#define AUTH_PROTO_RECONFIGURE 3
+#define AUTH_ALG_HMAC_MD5 1
+#define AUTH_RDM_MONOTONIC 0
+/*reconfigure key authentication info types*/
+#define AUTH_RKEY_KEY 1
+#define AUTH_RKEY_HMAC 2
+
+/*leasequery query types*/
+#define LQ_QUERY_BY_ADDRESS 1
+#define LQ_QUERY_BY_CLIENTID 2
+#define LQ_QUERY_BY_RELAY_ID 3
+#define LQ_QUERY_BY_LINK_ADDRESS 4
+#define LQ_QUERY_BY_REMOTE_ID 5
 
 
 /*DHCPv6 option structure*/
@@ -111,6 +177,28 @@ struct dhcp_opt{
 			int numopts;
 			unsigned short *opt;
 		} opt_oro;
+		struct dhcp_opt_unicast {
+			struct in6_addr addr;
+		} opt_unicast;
+		struct dhcp_opt_lq_query {
+			unsigned char query_type;
+			struct in6_addr link_addr;
+			/*subopts: query options*/
+		} opt_lq_query;
+		struct dhcp_opt_auth {
+			unsigned char proto,alg,rdm;
+			unsigned char replay[8];
+			/*authentication information, eg. AUTH_RKEY_* type plus key or HMAC*/
+			unsigned short infolen;
+			unsigned char info[32];
+		} opt_auth;
+		struct dhcp_opt_reconf_msg {
+			unsigned char msg_type;
+		} opt_reconf_msg;
+		/*OPT_CLIENT_DATA only has subopts*/
+		struct dhcp_opt_clt_time {
+			unsigned long secs;
+		} opt_clt_time;
 	};
 	
 	/*amount of sub-options (eg. OPT_IA*)*/
@@ -121,6 +209,19 @@ struct dhcp_opt{
 	int priv_optlen;
 };
 
+/*one relay agent a message passed through*/
+struct dhcp_relay {
+	unsigned char hopcount;
+	struct in6_addr linkaddr,peeraddr;
+	/*Interface-ID (echoed in RELAY-REPL), NULL if not present*/
+	unsigned char*ifid;
+	unsigned short ifidlen;
+	/*Remote-ID: enterprise number and ID, NULL if not present*/
+	unsigned int remoteent;
+	unsigned char*remoteid;
+	unsigned short remoteidlen;
+};
+
 /*DHCPv6 message structure*/
 struct dhcp_msg {
 	/*message type (see MSG_* constants)*/
@@ -135,6 +236,15 @@ struct dhcp_msg {
 	/*peer info*/
 	struct sockaddr_in6 msg_peer;
 	
+	/*socket the message was received on and the reply is sent through,
+	  -1 for the default socket*/
+	int msg_sock;
+	
+	/*relay agents the message came through, outermost first; replies
+	  with relays are wrapped in RELAY-REPL messages on encoding*/
+	int msg_numrelay;
+	struct dhcp_relay*msg_relay;
+	
 	/* **** private parts **** */
 	/*opt allocation hints*/
 	int priv_optlen;
@@ -172,10 +282,27 @@ bool messagehasoptionrequest(struct dhcp_msg*,unsigned short);
 /*removes an option (and all sub-options) from the message*/
 void messageremoveoption(struct dhcp_msg*,unsigned short);
 
+/*moves the relay agent information from one message to another, eg. to a reply*/
+void messagemoverelay(struct dhcp_msg*to,struct dhcp_msg*from);
+
 /*send the message*/
 void sendmessage(struct dhcp_msg*);
+/*send an already encoded message to the peer of the message, returns 0 on success*/
+int sendencoded(struct dhcp_msg*,const unsigned char*buf,int len);
+/*encode the message into buf (wrapped for its relays), returns the length or -1 if it does not fit*/
+int encodemessage(struct dhcp_msg*,unsigned char*buf,int max);
+
+/*decode a message from a buffer (NULL on error or if the message does not fit the filters);
+  RELAY-FORW messages are unwrapped, the relays are stored in the message*/
+struct dhcp_msg* decodemessage(unsigned char*buf,int len);
 
 /*read a message from the line and return it (NULL on error or if the message does not fit the filters)*/
 struct dhcp_msg* readmessage();
+/*sets a function that sees every received packet before it is decoded (after the
+  sender check); if it returns true the packet has been handled and is dropped*/
+void setrecvhook(bool(*)(int fd,unsigned char*buf,int len,struct sockaddr_in6*peer));
+/*read a message from another socket, if anysender is set non-link-local senders are
+  accepted for all message types*/
+struct dhcp_msg* readmessagefrom(int fd,int anysender);
 
 #endif
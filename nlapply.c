@@ -0,0 +1,278 @@
+/*
+*  C Implementation: nlapply
+*
+* Description: installs leases (addresses, LAN prefixes, routes) via rtnetlink,
+*  on the server side routes for delegated prefixes
+*
+* All changes are collected in one buffer and sent as a single batch of
+* rtnetlink requests, each asking for an acknowledgement. Additions use
+* NLM_F_REPLACE, so applying the same lease again just refreshes the
+* lifetimes; removing something that is already gone is not an error.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "nlapply.h"
+#include "common.h"
+
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_addr.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#ifndef RTPROT_DHCP
+#define RTPROT_DHCP 16
+#endif
+
+/*size of the batch buffer*/
+#define NL_BATCHSIZE 16384
+
+static unsigned char batch[NL_BATCHSIZE];
+static int batchlen=0,batchcnt=0;
+static unsigned int seq=0;
+
+void nlbegin()
+{
+	batchlen=batchcnt=0;
+}
+
+/*appends a request header plus payload of len bytes, returns it or NULL if the batch is full*/
+static struct nlmsghdr* newrequest(int type,int flags,int len)
+{
+	struct nlmsghdr*nh;
+	if(batchlen+NLMSG_SPACE(len)+256>NL_BATCHSIZE){
+		td_log(LOGWARN,"netlink batch is full, dropping change");
+		return 0;
+	}
+	nh=(struct nlmsghdr*)(batch+batchlen);
+	Memzero(nh,NLMSG_SPACE(len));
+	nh->nlmsg_len=NLMSG_LENGTH(len);
+	nh->nlmsg_type=type;
+	nh->nlmsg_flags=NLM_F_REQUEST|NLM_F_ACK|flags;
+	nh->nlmsg_seq=++seq;
+	return nh;
+}
+
+static void addattr(struct nlmsghdr*nh,int type,const void*data,int len)
+{
+	struct rtattr*rta=(struct rtattr*)(((unsigned char*)nh)+NLMSG_ALIGN(nh->nlmsg_len));
+	rta->rta_type=type;
+	rta->rta_len=RTA_LENGTH(len);
+	Memcpy(RTA_DATA(rta),(void*)data,len);
+	nh->nlmsg_len=NLMSG_ALIGN(nh->nlmsg_len)+RTA_ALIGN(rta->rta_len);
+}
+
+/*closes a request that has been filled in*/
+static void endrequest(struct nlmsghdr*nh)
+{
+	batchlen+=NLMSG_ALIGN(nh->nlmsg_len);
+	batchcnt++;
+}
+
+int nladdress(const char*dev,const struct in6_addr*addr,int plen,unsigned long pref,unsigned long valid,int del)
+{
+	struct nlmsghdr*nh;
+	struct ifaddrmsg*ifa;
+	struct ifa_cacheinfo ci;
+	unsigned int idx=if_nametoindex(dev);
+	if(!idx){
+		td_log(LOGWARN,"unknown device %s, cannot configure addresses on it",dev);
+		return -1;
+	}
+	nh=newrequest(del?RTM_DELADDR:RTM_NEWADDR,del?0:NLM_F_CREATE|NLM_F_REPLACE,sizeof(struct ifaddrmsg));
+	if(!nh)return -1;
+	ifa=NLMSG_DATA(nh);
+	ifa->ifa_family=AF_INET6;
+	ifa->ifa_prefixlen=plen;
+	ifa->ifa_scope=RT_SCOPE_UNIVERSE;
+	ifa->ifa_index=idx;
+	/*DHCP assigned addresses have been checked by the server already*/
+	ifa->ifa_flags=IFA_F_NODAD;
+	addattr(nh,IFA_LOCAL,addr,16);
+	addattr(nh,IFA_ADDRESS,addr,16);
+	if(!del){
+		Memzero(&ci,sizeof(ci));
+		ci.ifa_prefered=pref;
+		ci.ifa_valid=valid;
+		addattr(nh,IFA_CACHEINFO,&ci,sizeof(ci));
+	}
+	endrequest(nh);
+	return 0;
+}
+
+int nlunreachable(const struct in6_addr*prefix,int plen,int del)
+{
+	struct nlmsghdr*nh;
+	struct rtmsg*rt;
+	nh=newrequest(del?RTM_DELROUTE:RTM_NEWROUTE,del?0:NLM_F_CREATE|NLM_F_REPLACE,sizeof(struct rtmsg));
+	if(!nh)return -1;
+	rt=NLMSG_DATA(nh);
+	rt->rtm_family=AF_INET6;
+	rt->rtm_dst_len=plen;
+	rt->rtm_table=RT_TABLE_MAIN;
+	rt->rtm_protocol=RTPROT_DHCP;
+	rt->rtm_scope=RT_SCOPE_UNIVERSE;
+	rt->rtm_type=RTN_UNREACHABLE;
+	addattr(nh,RTA_DST,prefix,16);
+	endrequest(nh);
+	return 0;
+}
+
+int nlroute(const char*dev,const struct in6_addr*prefix,int plen,const struct in6_addr*gw,int del)
+{
+	struct nlmsghdr*nh;
+	struct rtmsg*rt;
+	unsigned int idx=if_nametoindex(dev);
+	if(!idx){
+		td_log(LOGWARN,"unknown device %s, cannot route prefixes to it",dev);
+		return -1;
+	}
+	nh=newrequest(del?RTM_DELROUTE:RTM_NEWROUTE,del?0:NLM_F_CREATE|NLM_F_REPLACE,sizeof(struct rtmsg));
+	if(!nh)return -1;
+	rt=NLMSG_DATA(nh);
+	rt->rtm_family=AF_INET6;
+	rt->rtm_dst_len=plen;
+	rt->rtm_table=RT_TABLE_MAIN;
+	rt->rtm_protocol=RTPROT_DHCP;
+	rt->rtm_scope=RT_SCOPE_UNIVERSE;
+	rt->rtm_type=RTN_UNICAST;
+	addattr(nh,RTA_DST,prefix,16);
+	addattr(nh,RTA_OIF,&idx,sizeof(idx));
+	if(gw)addattr(nh,RTA_GATEWAY,gw,16);
+	endrequest(nh);
+	return 0;
+}
+
+int nlcommit()
+{
+	struct sockaddr_nl sa;
+	struct nlmsghdr*nh;
+	struct timeval tv;
+	fd_set rfd;
+	unsigned char buf[8192];
+	int fd,len,acks=0,errs=0;
+	if(!batchcnt)return 0;
+	fd=socket(AF_NETLINK,SOCK_RAW,NETLINK_ROUTE);
+	if(fd<0){
+		td_log(LOGWARN,"Cannot open netlink socket: %s.",strerror(errno));
+		return -1;
+	}
+	Memzero(&sa,sizeof(sa));
+	sa.nl_family=AF_NETLINK;
+	if(sendto(fd,batch,batchlen,0,(struct sockaddr*)&sa,sizeof(sa))!=batchlen){
+		td_log(LOGWARN,"Cannot send netlink batch: %s.",strerror(errno));
+		close(fd);
+		return -1;
+	}
+	/*every request is answered with an ACK or an error*/
+	while(acks<batchcnt){
+		FD_ZERO(&rfd);
+		FD_SET(fd,&rfd);
+		tv.tv_sec=1;tv.tv_usec=0;
+		if(select(fd+1,&rfd,0,0,&tv)<=0){
+			td_log(LOGWARN,"netlink did not answer %i of %i changes",batchcnt-acks,batchcnt);
+			errs+=batchcnt-acks;
+			break;
+		}
+		len=recv(fd,buf,sizeof(buf),0);
+		if(len<0){
+			if(errno==EINTR)continue;
+			break;
+		}
+		for(nh=(struct nlmsghdr*)buf;NLMSG_OK(nh,len);nh=NLMSG_NEXT(nh,len)){
+			struct nlmsgerr*e;
+			if(nh->nlmsg_type!=NLMSG_ERROR)continue;
+			acks++;
+			e=NLMSG_DATA(nh);
+			/*removing what is not there is fine*/
+			if(e->error==0 || e->error==-ENOENT || e->error==-EADDRNOTAVAIL || e->error==-ESRCH)
+				continue;
+			td_log(LOGWARN,"netlink change %i of %i failed: %s",(int)(e->msg.nlmsg_seq-(seq-batchcnt)),batchcnt,strerror(-e->error));
+			errs++;
+		}
+	}
+	close(fd);
+	td_log(LOGDEBUG,"applied %i netlink changes in one batch, %i failed",batchcnt,errs);
+	batchlen=batchcnt=0;
+	return errs;
+}
+
+int nlroutes(const char*dev,void(*func)(const struct in6_addr*prefix,int plen))
+{
+	struct sockaddr_nl sa;
+	struct nlmsghdr*nh;
+	struct rtmsg*rt;
+	unsigned char buf[16384];
+	unsigned int idx=if_nametoindex(dev);
+	int fd,len,cnt=0,done=0;
+	if(!idx){
+		td_log(LOGWARN,"unknown device %s, cannot read its routes",dev);
+		return -1;
+	}
+	fd=socket(AF_NETLINK,SOCK_RAW,NETLINK_ROUTE);
+	if(fd<0){
+		td_log(LOGWARN,"Cannot open netlink socket: %s.",strerror(errno));
+		return -1;
+	}
+	/*dump request for all IPv6 routes*/
+	Memzero(buf,NLMSG_SPACE(sizeof(struct rtmsg)));
+	nh=(struct nlmsghdr*)buf;
+	nh->nlmsg_len=NLMSG_LENGTH(sizeof(struct rtmsg));
+	nh->nlmsg_type=RTM_GETROUTE;
+	nh->nlmsg_flags=NLM_F_REQUEST|NLM_F_DUMP;
+	nh->nlmsg_seq=++seq;
+	rt=NLMSG_DATA(nh);
+	rt->rtm_family=AF_INET6;
+	Memzero(&sa,sizeof(sa));
+	sa.nl_family=AF_NETLINK;
+	if(sendto(fd,buf,nh->nlmsg_len,0,(struct sockaddr*)&sa,sizeof(sa))<0){
+		td_log(LOGWARN,"Cannot send netlink route dump request: %s.",strerror(errno));
+		close(fd);
+		return -1;
+	}
+	while(!done){
+		len=recv(fd,buf,sizeof(buf),0);
+		if(len<0){
+			if(errno==EINTR)continue;
+			td_log(LOGWARN,"Cannot read netlink route dump: %s.",strerror(errno));
+			cnt=-1;
+			break;
+		}
+		if(len==0)break;
+		for(nh=(struct nlmsghdr*)buf;NLMSG_OK(nh,len);nh=NLMSG_NEXT(nh,len)){
+			struct rtattr*rta;
+			struct in6_addr*dst=0;
+			unsigned int oif=0;
+			int alen;
+			if(nh->nlmsg_type==NLMSG_DONE||nh->nlmsg_type==NLMSG_ERROR){
+				done=1;
+				break;
+			}
+			if(nh->nlmsg_type!=RTM_NEWROUTE)continue;
+			rt=NLMSG_DATA(nh);
+			if(rt->rtm_family!=AF_INET6 || rt->rtm_table!=RT_TABLE_MAIN ||
+			   rt->rtm_protocol!=RTPROT_DHCP || rt->rtm_type!=RTN_UNICAST)
+				continue;
+			alen=RTM_PAYLOAD(nh);
+			for(rta=RTM_RTA(rt);RTA_OK(rta,alen);rta=RTA_NEXT(rta,alen)){
+				if(rta->rta_type==RTA_DST)dst=RTA_DATA(rta);
+				if(rta->rta_type==RTA_OIF)oif=*(unsigned int*)RTA_DATA(rta);
+			}
+			if(!dst || oif!=idx)continue;
+			func(dst,rt->rtm_dst_len);
+			cnt++;
+		}
+	}
+	close(fd);
+	return cnt;
+}
@@ -0,0 +1,37 @@
+/*
+// C Interface: nlapply
+//
+// Description: installs leases (addresses, LAN prefixes, routes) via rtnetlink
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_NLAPPLY_H
+#define TDHCP_NLAPPLY_H
+
+struct in6_addr;
+
+/*starts a new batch of changes*/
+void nlbegin();
+/*adds or replaces (del=0) or removes (del=1) an address with lifetimes in seconds
+  (0xffffffff: infinite) on a device; returns -1 if the device is unknown or the batch is full*/
+int nladdress(const char*dev,const struct in6_addr*addr,int plen,unsigned long pref,unsigned long valid,int del);
+/*adds or removes an unreachable route for a prefix, so that traffic to unused parts
+  of a delegated prefix does not loop back to the uplink; returns -1 if the batch is full*/
+int nlunreachable(const struct in6_addr*prefix,int plen,int del);
+/*adds or removes a route for a delegated prefix on a device, via gw unless gw is NULL;
+  returns -1 if the device is unknown or the batch is full*/
+int nlroute(const char*dev,const struct in6_addr*prefix,int plen,const struct in6_addr*gw,int del);
+/*sends the batch in one go and collects the acknowledgements; returns the number of failed changes
+  or -1 if netlink is not available*/
+int nlcommit();
+
+/*calls func for every DHCP route (added by nlroute) on dev in the main table;
+  returns the number of routes found or -1 on error*/
+int nlroutes(const char*dev,void(*func)(const struct in6_addr*prefix,int plen));
+
+#endif
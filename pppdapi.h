@@ -0,0 +1,89 @@
+/*
+// C Interface: pppdapi
+//
+// Description: the parts of the pppd 2.4.x plugin interface used by the tdhcp plugin;
+//  uses the real pppd headers if HAVE_PPPD_H is defined
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_PPPDAPI_H
+#define TDHCP_PPPDAPI_H
+
+#ifdef HAVE_PPPD_H
+#include <pppd/pppd.h>
+#include <pppd/patchlevel.h>
+#else
+
+/*version string compared by pppd when loading the plugin: pppd only loads
+  plugins built for exactly its own version, override it for other releases*/
+#ifndef PPPD_VERSION
+#define PPPD_VERSION "2.4.9"
+#endif
+#define VERSION PPPD_VERSION
+
+/*option types*/
+enum opt_type {
+	o_special_noarg=0,
+	o_special,
+	o_bool,
+	o_int,
+	o_uint32,
+	o_string,
+	o_wild
+};
+
+/*option table entry, the table ends with an entry whose name is 0*/
+typedef struct {
+	char *name;
+	enum opt_type type;
+	void *addr;
+	char *description;
+	unsigned int flags;
+	void *addr2;
+	int upper_limit;
+	int lower_limit;
+	const char *source;
+	short int priority;
+	short int winner;
+} option_t;
+
+/*o_special handlers get the argument in argv[0] and return 1 on success*/
+typedef int (*parser_func)(char **argv);
+
+/*notifier chains*/
+typedef void (*notify_func)(void *arg,int val);
+struct notifier {
+	struct notifier *next;
+	notify_func func;
+	void *arg;
+};
+
+/*name of the PPP interface*/
+extern char ifname[];
+
+extern struct notifier *ipv6_up_notifier;
+extern struct notifier *ipv6_down_notifier;
+extern struct notifier *exitnotify;
+
+void add_options(option_t *opt);
+void add_notifier(struct notifier **notif,notify_func func,void *arg);
+void remove_notifier(struct notifier **notif,notify_func func,void *arg);
+
+/*callouts: func(arg) is called once after secs seconds and usecs microseconds*/
+void timeout(void (*func)(void *),void *arg,int secs,int usecs);
+void untimeout(void (*func)(void *),void *arg);
+
+/*logging*/
+void dbglog(char *fmt,...);
+void info(char *fmt,...);
+void warn(char *fmt,...);
+void error(char *fmt,...);
+
+#endif
+
+#endif
@@ -0,0 +1,193 @@
+/*
+*  C Implementation: pppplugin
+*
+* Description: pppd plugin that serves DHCPv6 on the PPP interface while IPv6CP is up
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "common.h"
+#include "server.h"
+#include "pppdapi.h"
+
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+/*pppd refuses plugins built for another version*/
+char pppd_version[]=VERSION;
+
+/*maximum number of messages handled per poll, so pppd itself does not starve*/
+#define POLLBURST 32
+
+/*pppd's add_fd() only wakes its select() up, it never calls the plugin back,
+  so an unread socket would keep it spinning; the sockets are polled instead:
+  every POLLMIN milliseconds while there is traffic, backing off to pollms*/
+#define POLLMIN 10
+static int pollms=500,pollcur=POLLMIN;
+static char*duidfile=0;
+static int havelocalid=0,running=0;
+
+/*hands an option to the server core, the argument is copied since pppd may reuse it*/
+static int setoption(int opt,const char*arg)
+{
+	char*s=Malloc(strlen(arg)+1);
+	if(!s)return 0;
+	Strcpy(s,arg);
+	return serveroption(opt,s)==0;
+}
+
+#define OPTHANDLER(func,opt) \
+	static int func(char**argv){return setoption(opt,argv[0]);}
+
+OPTHANDLER(optprefix,'p')
+OPTHANDLER(optaddress,'a')
+OPTHANDLER(optdns,'d')
+OPTHANDLER(optdomain,'D')
+OPTHANDLER(optpool,'o')
+OPTHANDLER(optshm,'s')
+OPTHANDLER(optmaxbind,'b')
+OPTHANDLER(optlifetime,'t')
+OPTHANDLER(optduid,'u')
+OPTHANDLER(optloglevel,'L')
+OPTHANDLER(optrcache,'k')
+OPTHANDLER(optunicast,'U')
+OPTHANDLER(optevents,'e')
+OPTHANDLER(optipam,'I')
+
+static int optlocalid(char**argv)
+{
+	havelocalid=1;
+	return setoption('l',argv[0]);
+}
+
+static int optnorapid(char**argv)
+{
+	return serveroption('C',0)==0;
+}
+
+static int optroutes(char**argv)
+{
+	return serveroption('i',0)==0;
+}
+
+static int optduidfile(char**argv)
+{
+	duidfile=Malloc(strlen(argv[0])+1);
+	if(!duidfile)return 0;
+	Strcpy(duidfile,argv[0]);
+	return 1;
+}
+
+static option_t options[]={
+	{"tdhcp-prefix",o_special,(void*)optprefix,"DHCPv6: delegate this prefix (prefix/length) to the peer"},
+	{"tdhcp-address",o_special,(void*)optaddress,"DHCPv6: assign this address to the peer"},
+	{"tdhcp-dns",o_special,(void*)optdns,"DHCPv6: announce this DNS server"},
+	{"tdhcp-domain",o_special,(void*)optdomain,"DHCPv6: announce this DNS search domain"},
+	{"tdhcp-pool",o_special,(void*)optpool,"DHCPv6: delegate prefixes from pool (prefix/length/prefixlength)"},
+	{"tdhcp-shm",o_special,(void*)optshm,"DHCPv6: share the binding table of all sessions in this shared memory object"},
+	{"tdhcp-max-bindings",o_special,(void*)optmaxbind,"DHCPv6: size of the binding table"},
+	{"tdhcp-lifetime",o_special,(void*)optlifetime,"DHCPv6: lease lifetime in seconds, 0 for infinite"},
+	{"tdhcp-local-id",o_special,(void*)optlocalid,"DHCPv6: generate the server DUID from this ID"},
+	{"tdhcp-duid",o_special,(void*)optduid,"DHCPv6: server DUID as hex string"},
+	{"tdhcp-duid-file",o_special,(void*)optduidfile,"DHCPv6: keep the server DUID in this file"},
+	{"tdhcp-log-level",o_special,(void*)optloglevel,"DHCPv6: none, error, warn, info or debug"},
+	{"tdhcp-reply-cache",o_special,(void*)optrcache,"DHCPv6: entries in the reply cache, 0 disables it"},
+	{"tdhcp-unicast",o_special,(void*)optunicast,"DHCPv6: allow clients to use this unicast address"},
+	{"tdhcp-no-rapid-commit",o_special_noarg,(void*)optnorapid,"DHCPv6: always use the 4 message exchange"},
+	{"tdhcp-install-routes",o_special_noarg,(void*)optroutes,"DHCPv6: route delegated prefixes to the PPP interface"},
+	{"tdhcp-event-socket",o_special,(void*)optevents,"DHCPv6: stream binding events to consumers of this UNIX socket"},
+	{"tdhcp-ipam",o_special,(void*)optipam,"DHCPv6: take pool prefixes chosen by the IPAM on this UNIX socket"},
+	{"tdhcp-poll",o_int,&pollms,"DHCPv6: maximum milliseconds between socket polls while idle"},
+	{0}
+};
+
+/*pass log messages on to pppd*/
+static void pppdlog(int prio,const char*msg)
+{
+	switch(prio){
+		case LOGDEBUG:dbglog("tdhcp: %s",msg);break;
+		case LOGINFO:info("tdhcp: %s",msg);break;
+		case LOGWARN:warn("tdhcp: %s",msg);break;
+		default:error("tdhcp: %s",msg);break;
+	}
+}
+
+static void stopserver()
+{
+	if(!running)return;
+	running=0;
+	serverstats();
+	serverdone();
+}
+
+/*called by a pppd timer*/
+static void pollserver(void*arg)
+{
+	fd_set rfd,wfd,xfd;
+	struct timeval tv;
+	int i,maxfd,wait;
+	if(!running)return;
+	for(i=0;i<POLLBURST;i++){
+		FD_ZERO(&rfd);
+		FD_ZERO(&wfd);
+		FD_ZERO(&xfd);
+		maxfd=serverfdset(&rfd,&wfd,&xfd,-1);
+		tv.tv_sec=tv.tv_usec=0;
+		if(select(maxfd+1,&rfd,&wfd,&xfd,&tv)<=0)break;
+		if(serverpoll(&rfd,&wfd,&xfd)<0){
+			td_log(LOGERROR,"stopping DHCPv6 service on %s",ifname);
+			stopserver();
+			return;
+		}
+	}
+	if(servertimer()<0){
+		td_log(LOGERROR,"stopping DHCPv6 service on %s",ifname);
+		stopserver();
+		return;
+	}
+	/*quickly while messages come in, less often while idle*/
+	if(i>0)pollcur=POLLMIN;
+	else if(pollcur<pollms)pollcur=pollcur*2>pollms?pollms:pollcur*2;
+	/*poll again at once if the burst limit was hit*/
+	wait=i<POLLBURST?servertimeout():0;
+	if(wait<0 || wait>pollcur)wait=pollcur;
+	timeout(pollserver,0,wait/1000,(wait%1000)*1000);
+}
+
+static void ipv6up(void*arg,int val)
+{
+	if(running)return;
+	if(DUIDLEN==0 && !havelocalid && duidfile && loadduid(duidfile)<0){
+		initlocalid(1);
+		saveduid(duidfile);
+	}
+	if(serverinit(ifname)<0){
+		td_log(LOGERROR,"unable to serve DHCPv6 on %s",ifname);
+		serverdone();
+		return;
+	}
+	td_log(LOGINFO,"serving DHCPv6 on %s",ifname);
+	running=1;
+	timeout(pollserver,0,0,0);
+}
+
+static void ipv6down(void*arg,int val)
+{
+	if(!running)return;
+	untimeout(pollserver,0);
+	stopserver();
+}
+
+void plugin_init()
+{
+	add_options(options);
+	add_notifier(&ipv6_up_notifier,ipv6up,0);
+	add_notifier(&ipv6_down_notifier,ipv6down,0);
+	add_notifier(&exitnotify,ipv6down,0);
+	setlogfunc(pppdlog);
+}
@@ -0,0 +1,276 @@
+/*
+*  C Implementation: pppstub
+*
+* Description: minimal stand-in for pppd: loads a pppd plugin, parses its options,
+*  raises the IPv6 notifiers for an existing interface and runs the callouts;
+*  used to test the tdhcp plugin without a real PPP link
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "pppdapi.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#define HELP \
+ "Usage: %s [-s seconds] plugin.so interface [option [value]]...\n" \
+ "Loads a pppd plugin, passes the options to it and signals IPv6 up on the\n" \
+ "interface. SIGHUP toggles the link down and up, SIGINT/SIGTERM end it.\n" \
+ "  -s seconds  end the link after this many seconds (default: never)\n"
+
+/*pppd globals used by plugins*/
+char ifname[32];
+struct notifier *ipv6_up_notifier=0;
+struct notifier *ipv6_down_notifier=0;
+struct notifier *exitnotify=0;
+
+/*option tables registered by the plugin*/
+#define MAXTABLES 16
+static option_t*opttables[MAXTABLES];
+static int numtables=0;
+
+void add_options(option_t*opt)
+{
+	if(numtables<MAXTABLES)opttables[numtables++]=opt;
+}
+
+static option_t*findoption(const char*name)
+{
+	int i;
+	option_t*o;
+	for(i=0;i<numtables;i++)
+		for(o=opttables[i];o->name;o++)
+			if(strcmp(o->name,name)==0)return o;
+	return 0;
+}
+
+void add_notifier(struct notifier**notif,notify_func func,void*arg)
+{
+	struct notifier*n=malloc(sizeof(struct notifier));
+	if(!n)return;
+	n->func=func;
+	n->arg=arg;
+	n->next=*notif;
+	*notif=n;
+}
+
+void remove_notifier(struct notifier**notif,notify_func func,void*arg)
+{
+	struct notifier*n;
+	for(;(n=*notif)!=0;notif=&n->next)
+		if(n->func==func && n->arg==arg){
+			*notif=n->next;
+			free(n);
+			return;
+		}
+}
+
+static void notify(struct notifier*n,int val)
+{
+	struct notifier*next;
+	for(;n;n=next){
+		next=n->next;
+		n->func(n->arg,val);
+	}
+}
+
+/*callouts, sorted by due time*/
+struct callout {
+	struct timeval due;
+	void(*func)(void*);
+	void*arg;
+	struct callout*next;
+};
+static struct callout*callouts=0;
+
+void timeout(void(*func)(void*),void*arg,int secs,int usecs)
+{
+	struct callout*c,**p;
+	c=malloc(sizeof(struct callout));
+	if(!c)return;
+	gettimeofday(&c->due,0);
+	c->due.tv_sec+=secs+usecs/1000000;
+	c->due.tv_usec+=usecs%1000000;
+	if(c->due.tv_usec>=1000000){
+		c->due.tv_sec++;
+		c->due.tv_usec-=1000000;
+	}
+	c->func=func;
+	c->arg=arg;
+	for(p=&callouts;*p && !timercmp(&c->due,&(*p)->due,<);p=&(*p)->next);
+	c->next=*p;
+	*p=c;
+}
+
+void untimeout(void(*func)(void*),void*arg)
+{
+	struct callout*c,**p;
+	for(p=&callouts;(c=*p)!=0;)
+		if(c->func==func && c->arg==arg){
+			*p=c->next;
+			free(c);
+		}else
+			p=&c->next;
+}
+
+/*runs all callouts that are due*/
+static void calltimeout()
+{
+	struct timeval now;
+	struct callout*c;
+	while(callouts){
+		gettimeofday(&now,0);
+		if(timercmp(&callouts->due,&now,>))break;
+		c=callouts;
+		callouts=c->next;
+		c->func(c->arg);
+		free(c);
+	}
+}
+
+static void logmsg(const char*lvl,char*fmt,va_list ap)
+{
+	fprintf(stderr,"%s: ",lvl);
+	vfprintf(stderr,fmt,ap);
+	fputc('\n',stderr);
+}
+
+#define LOGFUNC(func,lvl) \
+	void func(char*fmt,...){va_list ap;va_start(ap,fmt);logmsg(lvl,fmt,ap);va_end(ap);}
+
+LOGFUNC(dbglog,"debug")
+LOGFUNC(info,"info")
+LOGFUNC(warn,"warning")
+LOGFUNC(error,"error")
+
+static volatile int doexit=0,dotoggle=0;
+
+static void sighandler(int sig)
+{
+	if(sig==SIGHUP)dotoggle=1;
+	else doexit=1;
+}
+
+/*applies the options in argv, returns 0 on success*/
+static int parseoptions(int argc,char**argv)
+{
+	int i;
+	option_t*o;
+	char*arg[2];
+	for(i=0;i<argc;i++){
+		o=findoption(argv[i]);
+		if(!o){
+			fprintf(stderr,"unknown option %s\n",argv[i]);
+			return -1;
+		}
+		arg[0]=arg[1]=0;
+		if(o->type!=o_special_noarg && o->type!=o_bool){
+			if(++i>=argc){
+				fprintf(stderr,"option %s needs an argument\n",o->name);
+				return -1;
+			}
+			arg[0]=argv[i];
+		}
+		switch(o->type){
+			case o_special_noarg:
+			case o_special:
+				if(!((parser_func)o->addr)(arg)){
+					fprintf(stderr,"invalid argument for option %s\n",o->name);
+					return -1;
+				}
+				break;
+			case o_bool:*(int*)o->addr=1;break;
+			case o_int:*(int*)o->addr=atoi(arg[0]);break;
+			case o_uint32:*(unsigned int*)o->addr=strtoul(arg[0],0,0);break;
+			case o_string:*(char**)o->addr=arg[0];break;
+			default:
+				fprintf(stderr,"option %s has an unsupported type\n",o->name);
+				return -1;
+		}
+	}
+	return 0;
+}
+
+int main(int argc,char**argv)
+{
+	void*plugin;
+	void(*init)();
+	char*ver;
+	int c,up,secs=0;
+	long long end=0;
+	while((c=getopt(argc,argv,"+s:h"))!=-1)switch(c){
+		case 's':secs=atoi(optarg);break;
+		default:
+			fprintf(stderr,HELP,argv[0]);
+			return c=='h'?0:1;
+	}
+	if(argc-optind<2){
+		fprintf(stderr,HELP,argv[0]);
+		return 1;
+	}
+	/*load the plugin like pppd does*/
+	plugin=dlopen(argv[optind],RTLD_GLOBAL|RTLD_NOW);
+	if(!plugin){
+		fprintf(stderr,"unable to load plugin: %s\n",dlerror());
+		return 1;
+	}
+	ver=dlsym(plugin,"pppd_version");
+	if(!ver || strcmp(ver,VERSION)!=0){
+		fprintf(stderr,"plugin was built for pppd version %s, not %s\n",ver?ver:"(unknown)",VERSION);
+		return 1;
+	}
+	init=(void(*)())dlsym(plugin,"plugin_init");
+	if(!init){
+		fprintf(stderr,"plugin has no plugin_init\n");
+		return 1;
+	}
+	init();
+	strncpy(ifname,argv[optind+1],sizeof(ifname)-1);
+	if(parseoptions(argc-optind-2,argv+optind+2)<0)return 1;
+	signal(SIGTERM,sighandler);
+	signal(SIGINT,sighandler);
+	signal(SIGHUP,sighandler);
+	if(secs>0)end=time(0)+secs;
+	/*bring the link up*/
+	notify(ipv6_up_notifier,0);
+	up=1;
+	while(!doexit){
+		struct timeval now,tv;
+		calltimeout();
+		if(dotoggle){
+			dotoggle=0;
+			up=!up;
+			info("link %s",up?"up":"down");
+			notify(up?ipv6_up_notifier:ipv6_down_notifier,0);
+		}
+		if(end && time(0)>=end)break;
+		/*sleep until the next callout, at most a second*/
+		tv.tv_sec=1;tv.tv_usec=0;
+		if(callouts){
+			gettimeofday(&now,0);
+			if(timercmp(&callouts->due,&now,>)){
+				timersub(&callouts->due,&now,&tv);
+				if(tv.tv_sec>1){tv.tv_sec=1;tv.tv_usec=0;}
+			}else
+				tv.tv_sec=tv.tv_usec=0;
+		}
+		if(select(0,0,0,0,&tv)<0 && errno!=EINTR)break;
+	}
+	if(up)notify(ipv6_down_notifier,0);
+	notify(exitnotify,0);
+	return 0;
+}
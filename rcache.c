@@ -0,0 +1,169 @@
+/*
+*  C Implementation: rcache
+*
+* Description: cache of encoded replies to answer retransmissions
+*
+* Entries are keyed by client DUID, transaction ID, message type and sender
+* address. The table is direct mapped: a new reply simply replaces whatever
+* was in its place. Lookups work on the raw packet, so a retransmission is
+* answered without decoding it or building a new reply.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "rcache.h"
+#include "message.h"
+#include "common.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+/*maximum DUID length we cache, longer ones are never cached*/
+#define RC_MAXDUID 130
+
+struct rcentry {
+	/*time the reply was stored, 0 for unused entries*/
+	long long stamp;
+	unsigned int xid;
+	unsigned char type;
+	unsigned short duidlen;
+	unsigned char duid[RC_MAXDUID];
+	struct in6_addr peer;
+	/*the encoded reply*/
+	unsigned char*reply;
+	int len,alloc;
+};
+
+static struct rcentry*cache=0;
+static unsigned int cachesize=0;
+static unsigned long long lookups=0,hits=0;
+
+void rcinit(int size)
+{
+	unsigned int i;
+	/*drop a previous cache*/
+	if(cache){
+		for(i=0;i<cachesize;i++)
+			if(cache[i].reply)Free(cache[i].reply);
+		Free(cache);
+		cache=0;cachesize=0;
+	}
+	if(size<=0)return;
+	cachesize=size;
+	cache=Malloc(cachesize*sizeof(struct rcentry));
+	Memzero(cache,cachesize*sizeof(struct rcentry));
+}
+
+/*FNV-1a over the key*/
+static unsigned int rchash(const unsigned char*duid,int duidlen,unsigned int xid,unsigned char type)
+{
+	unsigned int h=2166136261U;
+	int i;
+	for(i=0;i<duidlen;i++)h=(h^duid[i])*16777619U;
+	h=(h^type)*16777619U;
+	h=(h^(xid>>16))*16777619U;
+	h=(h^((xid>>8)&0xff))*16777619U;
+	h=(h^(xid&0xff))*16777619U;
+	return h;
+}
+
+/*finds the client message inside relay headers and its client ID without decoding;
+  returns the client message or NULL if the packet is not cacheable*/
+static unsigned char* rawkey(unsigned char*buf,int len,unsigned char**duid,int*duidlen)
+{
+	int p,s,depth=0;
+	unsigned char*inner;
+	/*unwrap relays*/
+	while(len>0 && buf[0]==MSG_RELAY_FORW){
+		if(++depth>MSG_MAXRELAY)return 0;
+		inner=0;
+		for(p=34;p+4<=len;p+=4+s){
+			s=(buf[p+2]<<8)|buf[p+3];
+			if(p+4+s>len)return 0;
+			if(((buf[p]<<8)|buf[p+1])==OPT_RELAY_MSG){
+				inner=buf+p+4;
+				len=s;
+				break;
+			}
+		}
+		if(!inner)return 0;
+		buf=inner;
+	}
+	if(len<4)return 0;
+	/*find the client ID*/
+	for(p=4;p+4<=len;p+=4+s){
+		s=(buf[p+2]<<8)|buf[p+3];
+		if(p+4+s>len)return 0;
+		if(((buf[p]<<8)|buf[p+1])==OPT_CLIENTID){
+			if(s<=0 || s>RC_MAXDUID)return 0;
+			*duid=buf+p+4;
+			*duidlen=s;
+			return buf;
+		}
+	}
+	return 0;
+}
+
+bool rcreply(int fd,unsigned char*buf,int len,struct sockaddr_in6*peer)
+{
+	unsigned char*msg,*duid;
+	int duidlen;
+	unsigned int xid;
+	struct rcentry*e;
+	char tmp[64];
+	if(!cache)return false;
+	msg=rawkey(buf,len,&duid,&duidlen);
+	if(!msg)return false;
+	lookups++;
+	xid=(msg[1]<<16)|(msg[2]<<8)|msg[3];
+	e=&cache[rchash(duid,duidlen,xid,msg[0])%cachesize];
+	if(!e->stamp || time(0)-e->stamp>=RC_TTL)return false;
+	if(e->xid!=xid || e->type!=msg[0] || e->duidlen!=duidlen)return false;
+	if(Memcmp(e->duid,duid,duidlen)!=0 || Memcmp(&e->peer,&peer->sin6_addr,16)!=0)return false;
+	hits++;
+	td_log(LOGDEBUG,"answering retransmission of message type %i from %s from the reply cache",
+		(int)msg[0],inet_ntop(AF_INET6,&peer->sin6_addr,tmp,sizeof(tmp)));
+	if(sendto(fd,e->reply,e->len,0,(struct sockaddr*)peer,sizeof(struct sockaddr_in6))<0)
+		td_log(LOGERROR,"unable to send cached reply to %s: %s",tmp,strerror(errno));
+	return true;
+}
+
+void rcstore(struct dhcp_msg*rmsg,const unsigned char*reply,int len)
+{
+	struct rcentry*e;
+	int p;
+	struct dhcp_opt*id;
+	if(!cache || len<=0)return;
+	p=messagefindoption(rmsg,OPT_CLIENTID);
+	if(p<0)return;
+	id=&rmsg->msg_opt[p];
+	if(id->opt_duid.len<=0 || id->opt_duid.len>RC_MAXDUID)return;
+	e=&cache[rchash(id->opt_duid.duid,id->opt_duid.len,rmsg->msg_id,rmsg->msg_type)%cachesize];
+	if(e->alloc<len){
+		e->reply=Realloc(e->reply,len);
+		e->alloc=len;
+	}
+	Memcpy(e->reply,(void*)reply,len);
+	e->len=len;
+	e->xid=rmsg->msg_id;
+	e->type=rmsg->msg_type;
+	e->duidlen=id->opt_duid.len;
+	Memcpy(e->duid,id->opt_duid.duid,id->opt_duid.len);
+	Memcpy(&e->peer,&rmsg->msg_peer.sin6_addr,16);
+	e->stamp=time(0);
+}
+
+void rcstats(unsigned long long*l,unsigned long long*h)
+{
+	*l=lookups;
+	*h=hits;
+}
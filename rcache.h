@@ -0,0 +1,39 @@
+/*
+// C Interface: rcache
+//
+// Description: cache of encoded replies to answer retransmissions
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_RCACHE_H
+#define TDHCP_RCACHE_H
+
+#include "common.h"
+
+struct dhcp_msg;
+struct sockaddr_in6;
+
+/*default amount of cached replies*/
+#define RC_DEFSIZE 1024
+/*seconds a reply is kept for retransmissions*/
+#define RC_TTL 60
+
+/*allocates the cache with size entries, 0 disables it; replaces an earlier cache*/
+void rcinit(int size);
+
+/*looks up a received packet (before decoding it) and sends the cached reply
+  if it is a retransmission; returns true if the packet has been answered*/
+bool rcreply(int fd,unsigned char*buf,int len,struct sockaddr_in6*peer);
+
+/*remembers the encoded reply to a received message*/
+void rcstore(struct dhcp_msg*rmsg,const unsigned char*reply,int len);
+
+/*returns the amount of lookups and hits*/
+void rcstats(unsigned long long*lookups,unsigned long long*hits);
+
+#endif
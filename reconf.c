@@ -0,0 +1,306 @@
+/*
+*  C Implementation: reconf
+*
+* Description: RECONFIGURE fan-out with reconfigure key authentication
+*
+* Clients that send Reconfigure Accept get a random key in the Authentication
+* option of their REPLY (RFC 8415 section 20.4). After a configuration change
+* every binding that has a key is sent a RECONFIGURE asking it to RENEW. The
+* messages are encoded from one template, signed with HMAC-MD5 and handed to
+* the kernel in batches via sendmmsg(), paced to a fixed rate so that a large
+* fleet is not hit all at once. Clients behind one relay agent get the message
+* wrapped in a RELAY-REPL to the relay; clients behind nested relays are not
+* remembered and cannot be reconfigured.
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#define _GNU_SOURCE
+#include "reconf.h"
+#include "binding.h"
+#include "message.h"
+#include "sock.h"
+#include "common.h"
+#include "md5.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/*messages per sendmmsg call*/
+#define RECONF_BATCH 64
+/*maximum size of one RECONFIGURE*/
+#define RECONF_MAXLEN 512
+/*size of the auth option content: proto, alg, rdm, replay, type and HMAC*/
+#define RECONF_AUTHLEN (3+8+1+16)
+
+static int rate=RECONF_DEFRATE;
+
+/*fan-out state*/
+static int active=0;
+static unsigned int cursor=0;
+static struct timeval starttime;
+static unsigned long long sent=0,skipped=0;
+/*the current batch: messages pendoff up to pending are not sent yet;
+  tabledone is set once the cursor reached the end of the table*/
+static unsigned char bufs[RECONF_BATCH][RECONF_MAXLEN];
+static struct sockaddr_in6 peers[RECONF_BATCH];
+static struct iovec iov[RECONF_BATCH];
+static struct mmsghdr mm[RECONF_BATCH];
+static int pending=0,pendoff=0,tabledone=0;
+/*replay detection counter*/
+static unsigned long long replay=0;
+/*message template and the index of its client ID option*/
+static struct dhcp_msg*tmpl=0;
+static int tmplcid=-1;
+
+void reconfsetrate(int r)
+{
+	if(r>0)rate=r;
+}
+
+/*fills buf with random bytes*/
+static void randombytes(unsigned char*buf,int len)
+{
+	int fd,i;
+	fd=open("/dev/urandom",O_RDONLY);
+	if(fd>=0){
+		i=read(fd,buf,len);
+		close(fd);
+		if(i==len)return;
+	}
+	td_log(LOGWARN,"cannot read /dev/urandom, reconfigure keys are weak");
+	for(i=0;i<len;i++)buf[i]=random();
+}
+
+/*remembers how to reach the client: directly or through its relay agent;
+  the relay headers have already been moved to the reply*/
+static void reconfpeer(struct binding*b,struct dhcp_msg*smsg)
+{
+	struct dhcp_relay*r=smsg->msg_relay;
+	if(!smsg->msg_numrelay){
+		/*direct clients must have used the multicast socket to be on our link*/
+		if(smsg->msg_sock>=0)return;
+		b->relayed=0;
+	}else if(smsg->msg_numrelay==1 && r->ifidlen<=BIND_MAXIFID){
+		b->relayhops=r->hopcount;
+		Memcpy(&b->relaylink,&r->linkaddr,16);
+		Memcpy(&b->relaypeer,&r->peeraddr,16);
+		b->relayifidlen=r->ifid?r->ifidlen:0;
+		if(r->ifid)Memcpy(b->relayifid,r->ifid,r->ifidlen);
+		b->relayed=1;
+	}else{
+		/*too many relays (or a too long Interface-ID) to remember*/
+		Memzero(&b->peer,sizeof(b->peer));
+		b->relayed=0;
+		return;
+	}
+	Memcpy(&b->peer,&smsg->msg_peer.sin6_addr,16);
+	b->peerscope=smsg->msg_peer.sin6_scope_id;
+}
+
+void reconfbind(struct binding*b,struct dhcp_msg*rmsg,struct dhcp_msg*smsg)
+{
+	int p;
+	if(!b)return;
+	reconfpeer(b,smsg);
+	if(messagefindoption(rmsg,OPT_RECONF_ACCEPT)<0)return;
+	if(!b->haskey){
+		randombytes(b->rkey,16);
+		b->haskey=1;
+	}
+	/*send the key every time, the client may have missed the first one*/
+	if(messagefindoption(smsg,OPT_AUTH)<0){
+		p=messageaddopt(smsg,OPT_AUTH);
+		smsg->msg_opt[p].opt_auth.proto=AUTH_PROTO_RECONFIGURE;
+		smsg->msg_opt[p].opt_auth.alg=AUTH_ALG_HMAC_MD5;
+		smsg->msg_opt[p].opt_auth.rdm=AUTH_RDM_MONOTONIC;
+		smsg->msg_opt[p].opt_auth.info[0]=AUTH_RKEY_KEY;
+		Memcpy(smsg->msg_opt[p].opt_auth.info+1,b->rkey,16);
+		smsg->msg_opt[p].opt_auth.infolen=17;
+	}
+	if(messagefindoption(smsg,OPT_RECONF_ACCEPT)<0)
+		messageaddopt(smsg,OPT_RECONF_ACCEPT);
+}
+
+/*RFC 2104 HMAC-MD5*/
+static void hmacmd5(const unsigned char*key,int keylen,unsigned char*data,int len,unsigned char*digest)
+{
+	MD5_CTX ctx;
+	unsigned char pad[64];
+	int i;
+	Memzero(pad,64);
+	Memcpy(pad,(void*)key,keylen);
+	for(i=0;i<64;i++)pad[i]^=0x36;
+	MD5Init(&ctx);
+	MD5Update(&ctx,pad,64);
+	MD5Update(&ctx,data,len);
+	MD5Final(digest,&ctx);
+	for(i=0;i<64;i++)pad[i]^=0x36^0x5c;
+	MD5Init(&ctx);
+	MD5Update(&ctx,pad,64);
+	MD5Update(&ctx,digest,16);
+	MD5Final(digest,&ctx);
+}
+
+void reconfstart()
+{
+	int p;
+	if(!tmpl){
+		/*Server ID, Client ID, Reconfigure Message and (last) Authentication*/
+		tmpl=newmessage(MSG_RECONFIGURE);
+		tmpl->msg_id=0;
+		messageaddopt(tmpl,OPT_SERVERID);
+		tmplcid=messageaddopt(tmpl,OPT_CLIENTID);
+		p=messageaddopt(tmpl,OPT_RECONF_MSG);
+		tmpl->msg_opt[p].opt_reconf_msg.msg_type=MSG_RENEW;
+		p=messageaddopt(tmpl,OPT_AUTH);
+		tmpl->msg_opt[p].opt_auth.proto=AUTH_PROTO_RECONFIGURE;
+		tmpl->msg_opt[p].opt_auth.alg=AUTH_ALG_HMAC_MD5;
+		tmpl->msg_opt[p].opt_auth.rdm=AUTH_RDM_MONOTONIC;
+		tmpl->msg_opt[p].opt_auth.info[0]=AUTH_RKEY_HMAC;
+		tmpl->msg_opt[p].opt_auth.infolen=17;
+		/*the client ID points into the binding table, never free it*/
+		Free(tmpl->msg_opt[tmplcid].opt_duid.duid);
+		tmpl->msg_opt[tmplcid].opt_duid.duid=0;
+	}
+	if(!replay)replay=((unsigned long long)time(0))<<32;
+	if(active)
+		td_log(LOGINFO,"restarting RECONFIGURE, %llu clients had been reached",sent);
+	active=1;
+	cursor=0;
+	sent=skipped=0;
+	pending=pendoff=tabledone=0;
+	gettimeofday(&starttime,0);
+	td_log(LOGINFO,"sending RECONFIGURE to all clients, %i per second",rate);
+}
+
+bool reconfactive()
+{
+	return active;
+}
+
+/*encodes the RECONFIGURE for a binding (in a RELAY-REPL if the client is
+  relayed), returns the length or -1*/
+static int encodereconf(struct binding*b,unsigned char*buf)
+{
+	struct dhcp_opt*auth=&tmpl->msg_opt[tmpl->msg_numopts-1];
+	struct dhcp_relay relay;
+	int i,len,hlen=0;
+	replay++;
+	for(i=0;i<8;i++)auth->opt_auth.replay[i]=replay>>(56-i*8);
+	Memzero(auth->opt_auth.info+1,16);
+	tmpl->msg_opt[tmplcid].opt_duid.duid=b->duid;
+	tmpl->msg_opt[tmplcid].opt_duid.len=b->duidlen;
+	if(b->relayed){
+		/*the relay header points into the binding, it is not freed*/
+		Memzero(&relay,sizeof(relay));
+		relay.hopcount=b->relayhops;
+		Memcpy(&relay.linkaddr,&b->relaylink,16);
+		Memcpy(&relay.peeraddr,&b->relaypeer,16);
+		if(b->relayifidlen){
+			relay.ifid=b->relayifid;
+			relay.ifidlen=b->relayifidlen;
+		}
+		tmpl->msg_relay=&relay;
+		tmpl->msg_numrelay=1;
+		/*header and Relay Message option in front of the RECONFIGURE*/
+		hlen=34+4+(b->relayifidlen?4+b->relayifidlen:0);
+	}
+	len=encodemessage(tmpl,buf,RECONF_MAXLEN);
+	tmpl->msg_opt[tmplcid].opt_duid.duid=0;
+	tmpl->msg_relay=0;
+	tmpl->msg_numrelay=0;
+	if(len<hlen+RECONF_AUTHLEN)return -1;
+	/*the HMAC covers the RECONFIGURE only, calculated with a zero HMAC field,
+	  and goes to the very end*/
+	hmacmd5(b->rkey,16,buf+hlen,len-hlen,buf+len-16);
+	return len;
+}
+
+/*sends what is left of the batch, returns false if the socket is full*/
+static bool flushbatch()
+{
+	int r;
+	while(pendoff<pending){
+		r=sendmmsg(sockfd,mm+pendoff,pending-pendoff,0);
+		if(r>0){
+			pendoff+=r;
+			sent+=r;
+			continue;
+		}
+		if(r<0 && errno==EINTR)continue;
+		/*full: try the rest on the next tick*/
+		if(r==0 || errno==EAGAIN || errno==EWOULDBLOCK || errno==ENOBUFS || errno==ENOMEM)
+			return false;
+		/*this client cannot be reached, go on with the next one*/
+		td_log(LOGWARN,"unable to send RECONFIGURE: %s",strerror(errno));
+		pendoff++;
+		skipped++;
+	}
+	pending=pendoff=0;
+	return true;
+}
+
+void reconftimer()
+{
+	struct timeval now;
+	struct binding*b;
+	long long due;
+	int n,i,me=getpid();
+	if(!active)return;
+	if(!flushbatch())return;
+	/*how many should be out by now?*/
+	gettimeofday(&now,0);
+	due=((now.tv_sec-starttime.tv_sec)*1000000LL+(now.tv_usec-starttime.tv_usec))*rate/1000000+1;
+	while(!tabledone && sent<due){
+		/*collect a batch*/
+		for(n=0;n<RECONF_BATCH && sent+n<due;){
+			b=bindnext(&cursor);
+			if(!b){
+				tabledone=1;
+				break;
+			}
+			/*only clients that gave us a key and that sit behind our own interface
+			  or one relay agent*/
+			if(!b->haskey || IN6_IS_ADDR_UNSPECIFIED(&b->peer) || b->pid!=me){
+				skipped++;
+				continue;
+			}
+			i=encodereconf(b,bufs[n]);
+			if(i<0)continue;
+			Memzero(&peers[n],sizeof(peers[n]));
+			peers[n].sin6_family=AF_INET6;
+			peers[n].sin6_port=htons(b->relayed?DHCP_SERVERPORT:DHCP_CLIENTPORT);
+			peers[n].sin6_scope_id=b->peerscope;
+			Memcpy(&peers[n].sin6_addr,&b->peer,16);
+			iov[n].iov_base=bufs[n];
+			iov[n].iov_len=i;
+			Memzero(&mm[n],sizeof(mm[n]));
+			mm[n].msg_hdr.msg_name=&peers[n];
+			mm[n].msg_hdr.msg_namelen=sizeof(peers[n]);
+			mm[n].msg_hdr.msg_iov=&iov[n];
+			mm[n].msg_hdr.msg_iovlen=1;
+			n++;
+		}
+		/*send it, only what actually went out counts*/
+		pending=n;
+		pendoff=0;
+		if(!flushbatch())return;
+	}
+	if(tabledone){
+		td_log(LOGINFO,"RECONFIGURE done: %llu clients reached, %llu skipped",sent,skipped);
+		active=0;
+	}
+}
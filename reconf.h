@@ -0,0 +1,38 @@
+/*
+// C Interface: reconf
+//
+// Description: RECONFIGURE fan-out with reconfigure key authentication
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_RECONF_H
+#define TDHCP_RECONF_H
+
+#include "common.h"
+
+struct dhcp_msg;
+struct binding;
+
+/*default RECONFIGURE messages per second*/
+#define RECONF_DEFRATE 1000
+
+/*sets the amount of RECONFIGURE messages sent per second*/
+void reconfsetrate(int);
+
+/*remembers the client address (or its relay agent) of a binding; if the client accepts
+  reconfiguration the reconfigure key is created and put into the reply*/
+void reconfbind(struct binding*,struct dhcp_msg*rmsg,struct dhcp_msg*smsg);
+
+/*starts sending RECONFIGURE to all clients that gave us a key (restarts a running one)*/
+void reconfstart();
+/*returns true while RECONFIGURE messages are being sent*/
+bool reconfactive();
+/*sends the next batch, call once per main loop iteration*/
+void reconftimer();
+
+#endif
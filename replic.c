@@ -0,0 +1,697 @@
+/*
+*  C Implementation: replic
+*
+* Description: binding replication
+*
+* The standby connects to the primary via TCP and tells it the epoch and
+* the last sequence number it has applied. If the primary still has all
+* later changes in its delta log it continues the stream from there,
+* otherwise it sends a snapshot of the binding table first. Changes are
+* collected per main loop iteration and sent as one batch of compact
+* binary records.
+*
+* A standby only takes over with a complete copy of one primary epoch and,
+* if a fence command is configured, after it succeeded in cutting off the
+* primary. After the takeover it keeps calling the primary: a primary that
+* was only unreachable (network partition) learns from the hello that its
+* epoch was taken over and stops serving clients.
+*
+* Frames: length (4 bytes, includes the type), type (1 byte), payload
+*  'H' hello (standby): epoch (8), last applied sequence (8),
+*      epoch taken over (8, 0 while passive)
+*  'S' snapshot begin: epoch (8), sequence the stream continues with (8)
+*  'R' snapshot records: records
+*  'E' snapshot end
+*  'D' deltas: sequence of the first record (8), count (2), records
+*  'K' keep alive
+* Records: op (1), DUID length (1), DUID, IAID (4) and for binds only:
+*  pool slot (4), expiry time (8, 0 is infinite)
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "replic.h"
+#include "binding.h"
+#include "sock.h"
+#include "common.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <stdlib.h>
+#include <signal.h>
+
+/*amount of changes the primary remembers for catching up*/
+#define REPL_LOGSIZE 16384
+/*maximum frame size*/
+#define REPL_BUFSIZE 65536
+/*maximum size of one encoded record*/
+#define REPL_MAXREC (1+1+BIND_MAXDUID+16)
+/*seconds between keep alives, the peer is considered dead after 3 missing*/
+#define REPL_KEEPALIVE 5
+/*seconds between connection attempts of the standby*/
+#define REPL_RECONNECT 5
+/*seconds a connection attempt may take*/
+#define REPL_CONNTIMEOUT 5
+/*seconds the fence command may run before it is killed and counts as failed*/
+#define REPL_FENCETIMEOUT 30
+
+#define FRM_HELLO 'H'
+#define FRM_SNAPBEGIN 'S'
+#define FRM_RECORDS 'R'
+#define FRM_SNAPEND 'E'
+#define FRM_DELTA 'D'
+#define FRM_KEEPALIVE 'K'
+
+#define REC_BIND 1
+#define REC_UNBIND 2
+
+#define ROLE_NONE 0
+#define ROLE_PRIMARY 1
+#define ROLE_STANDBY 2
+
+/*connection states of the primary*/
+#define CONN_HELLO 0
+#define CONN_SNAPBEGIN 1
+#define CONN_SNAPSHOT 2
+#define CONN_STREAM 3
+
+#define PUT8(p,v) {int _i;for(_i=0;_i<8;_i++)(p)[_i]=((v)>>(56-_i*8))&0xff;}
+#define PUT4(p,v) (p)[0]=((v)>>24)&0xff;(p)[1]=((v)>>16)&0xff;(p)[2]=((v)>>8)&0xff;(p)[3]=(v)&0xff;
+#define PUT2(p,v) (p)[0]=((v)>>8)&0xff;(p)[1]=(v)&0xff;
+#define GET4(p) (((unsigned int)(p)[0])<<24 | ((unsigned int)(p)[1])<<16 | ((unsigned int)(p)[2])<<8 | (p)[3])
+#define GET2(p) (((unsigned int)(p)[0])<<8 | (p)[1])
+#define GET8(p) (((unsigned long long)GET4(p))<<32 | GET4((p)+4))
+
+/*one remembered change*/
+struct repldelta {
+	unsigned char op,duidlen;
+	unsigned char duid[BIND_MAXDUID];
+	unsigned int iaid,slot;
+	long long expires;
+};
+
+static int role=ROLE_NONE;
+static struct sockaddr_in6 peeraddr;
+static int listenfd=-1,connfd=-1;
+
+/*connection buffers*/
+static unsigned char outbuf[REPL_BUFSIZE],inbuf[REPL_BUFSIZE+4];
+static int outoff=0,outlen=0,inlen=0;
+static long long lastsend=0,lastrecv=0;
+
+/*primary side*/
+static struct repldelta*dlog=0;
+static unsigned long long epoch=0,nextseq=1,logfirst=1,sendseq=0,snapseq=0;
+static unsigned int snapcursor=0;
+static int connstate=CONN_HELLO;
+/*a standby took over our epoch, we no longer serve clients*/
+static int steppeddown=0;
+
+/*standby side*/
+static unsigned long long peerepoch=0,lastseq=0,peersnapseq=0;
+/*epoch of the primary we took over from, 0 while passive*/
+static unsigned long long tookover=0;
+/*a snapshot of peerepoch is complete*/
+static int synced=0,nosyncwarned=0;
+static int takeover=10,active=0,connecting=0;
+static const char*fencecmd=0;
+/*running fence command and when it gets killed*/
+static pid_t fencepid=0;
+static long long fencedeadline=0;
+static long long lostsince=0,lastattempt=0;
+static unsigned int applied=0;
+
+int replsetlisten(const char*s)
+{
+	if(parseaddrport(s,&peeraddr,REPL_DEFPORT)<0){
+		td_log(LOGERROR,"invalid replication listen address %s",s);
+		return -1;
+	}
+	role=ROLE_PRIMARY;
+	return 0;
+}
+
+int replsetprimary(const char*s)
+{
+	if(parseaddrport(s,&peeraddr,REPL_DEFPORT)<0){
+		td_log(LOGERROR,"invalid replication primary address %s",s);
+		return -1;
+	}
+	role=ROLE_STANDBY;
+	return 0;
+}
+
+void replsettakeover(int t)
+{
+	if(t>0)takeover=t;
+}
+
+void replsetfence(const char*cmd)
+{
+	fencecmd=cmd;
+}
+
+bool replpassive()
+{
+	return (role==ROLE_STANDBY && !active) || steppeddown;
+}
+
+/*remembers a binding change in the delta log*/
+static void repllistener(int ev,struct binding*b)
+{
+	struct repldelta*d=&dlog[nextseq%REPL_LOGSIZE];
+	d->op=(ev==BINDEV_BIND || ev==BINDEV_RENEW)?REC_BIND:REC_UNBIND;
+	d->duidlen=b->duidlen;
+	Memcpy(d->duid,b->duid,b->duidlen);
+	d->iaid=b->iaid;
+	d->slot=b->slot;
+	d->expires=b->expires;
+	nextseq++;
+	if(nextseq-logfirst>REPL_LOGSIZE)
+		logfirst=nextseq-REPL_LOGSIZE;
+}
+
+int replinit()
+{
+	int val=1;
+	if(role==ROLE_STANDBY){
+		lostsince=time(0);
+		td_log(LOGINFO,"replication: standby, taking over after %i seconds without primary",takeover);
+		if(!fencecmd)
+			td_log(LOGWARN,"replication: no fence command, a primary that is only cut off keeps serving until it is reachable again");
+		return 0;
+	}
+	if(role!=ROLE_PRIMARY)return 0;
+	/*delta log*/
+	dlog=Malloc(REPL_LOGSIZE*sizeof(struct repldelta));
+	if(!dlog)return -1;
+	epoch=((unsigned long long)time(0))<<20 ^ getpid();
+	bindaddlistener(repllistener);
+	/*listen*/
+	listenfd=socket(PF_INET6,SOCK_STREAM,0);
+	if(listenfd<0){
+		td_log(LOGERROR,"replication: unable to allocate socket: %s",strerror(errno));
+		return -1;
+	}
+	setsockopt(listenfd,SOL_SOCKET,SO_REUSEADDR,&val,sizeof(val));
+	if(bind(listenfd,(struct sockaddr*)&peeraddr,sizeof(peeraddr))<0 || listen(listenfd,2)<0){
+		td_log(LOGERROR,"replication: unable to listen: %s",strerror(errno));
+		close(listenfd);
+		listenfd=-1;
+		return -1;
+	}
+	fcntl(listenfd,F_SETFL,O_NONBLOCK);
+	return 0;
+}
+
+static void closeconn(const char*why)
+{
+	if(connfd<0)return;
+	/*after a takeover the old primary is usually gone for good*/
+	td_log(active?LOGDEBUG:LOGWARN,"replication: connection closed: %s",why);
+	close(connfd);
+	connfd=-1;
+	connecting=0;
+	outoff=outlen=inlen=0;
+	if(role==ROLE_STANDBY && !lostsince)
+		lostsince=time(0);
+}
+
+/*starts a frame in outbuf, returns the position of its payload*/
+static int beginframe(int type)
+{
+	outbuf[outlen+4]=type;
+	outlen+=5;
+	return outlen;
+}
+
+/*finishes the frame whose payload started at pos*/
+static void endframe(int pos)
+{
+	unsigned int l=outlen-pos+1;
+	PUT4(outbuf+pos-5,l);
+	lastsend=time(0);
+}
+
+static int encoderec(unsigned char*buf,struct repldelta*d)
+{
+	int p=0;
+	buf[p++]=d->op;
+	buf[p++]=d->duidlen;
+	Memcpy(buf+p,d->duid,d->duidlen);
+	p+=d->duidlen;
+	PUT4(buf+p,d->iaid);
+	p+=4;
+	if(d->op==REC_BIND){
+		PUT4(buf+p,d->slot);
+		PUT8(buf+p+4,d->expires);
+		p+=12;
+	}
+	return p;
+}
+
+/*primary: refills the (empty) output buffer*/
+static void fillout()
+{
+	int pos,cntpos,cnt,done;
+	struct repldelta d;
+	struct binding*b;
+	unsigned int c;
+	outoff=outlen=0;
+	switch(connstate){
+		case CONN_SNAPBEGIN:
+			snapseq=nextseq;
+			snapcursor=0;
+			pos=beginframe(FRM_SNAPBEGIN);
+			PUT8(outbuf+outlen,epoch);
+			PUT8(outbuf+outlen+8,snapseq);
+			outlen+=16;
+			endframe(pos);
+			connstate=CONN_SNAPSHOT;
+			td_log(LOGINFO,"replication: sending snapshot of %u bindings",bindcount());
+			/*fall through*/
+		case CONN_SNAPSHOT:
+			pos=beginframe(FRM_RECORDS);
+			done=0;
+			while(outlen+REPL_MAXREC+5<=REPL_BUFSIZE){
+				c=snapcursor;
+				b=bindnext(&c);
+				if(!b){
+					done=1;
+					break;
+				}
+				snapcursor=c;
+				d.op=REC_BIND;
+				d.duidlen=b->duidlen;
+				Memcpy(d.duid,b->duid,b->duidlen);
+				d.iaid=b->iaid;
+				d.slot=b->slot;
+				d.expires=b->expires;
+				outlen+=encoderec(outbuf+outlen,&d);
+			}
+			endframe(pos);
+			if(done){
+				/*done, continue with the changes made since the snapshot started*/
+				pos=beginframe(FRM_SNAPEND);
+				endframe(pos);
+				sendseq=snapseq;
+				connstate=CONN_STREAM;
+			}
+			break;
+		case CONN_STREAM:
+			if(sendseq>=nextseq)break;
+			if(sendseq<logfirst){
+				td_log(LOGWARN,"replication: standby fell behind the delta log, sending a new snapshot");
+				connstate=CONN_SNAPBEGIN;
+				fillout();
+				return;
+			}
+			pos=beginframe(FRM_DELTA);
+			PUT8(outbuf+outlen,sendseq);
+			cntpos=outlen+8;
+			outlen+=10;
+			for(cnt=0;sendseq<nextseq && cnt<0xffff && outlen+REPL_MAXREC<=REPL_BUFSIZE;cnt++,sendseq++)
+				outlen+=encoderec(outbuf+outlen,&dlog[sendseq%REPL_LOGSIZE]);
+			PUT2(outbuf+cntpos,cnt);
+			endframe(pos);
+			break;
+	}
+	/*keep the connection alive*/
+	if(outlen==0 && connstate!=CONN_HELLO && time(0)-lastsend>=REPL_KEEPALIVE){
+		pos=beginframe(FRM_KEEPALIVE);
+		endframe(pos);
+	}
+}
+
+/*does the connection have something to send?*/
+static bool wantwrite()
+{
+	if(outoff<outlen)return true;
+	if(role==ROLE_STANDBY)return connecting || time(0)-lastsend>=REPL_KEEPALIVE;
+	switch(connstate){
+		case CONN_SNAPBEGIN:case CONN_SNAPSHOT:return true;
+		case CONN_STREAM:return sendseq<nextseq || time(0)-lastsend>=REPL_KEEPALIVE;
+	}
+	return false;
+}
+
+/*applies one record on the standby, returns its length or -1 on error*/
+static int applyrec(unsigned char*buf,int max)
+{
+	int op,l,p;
+	unsigned int iaid,slot;
+	long long exp;
+	struct binding*b;
+	if(max<2)return -1;
+	op=buf[0];l=buf[1];
+	p=2+l+4;
+	if(op==REC_BIND)p+=12;
+	if(l<1 || l>BIND_MAXDUID || p>max)return -1;
+	iaid=GET4(buf+2+l);
+	if(op==REC_BIND){
+		slot=GET4(buf+6+l);
+		exp=GET8(buf+10+l);
+		if(bindrestore(buf+2,l,iaid,slot,exp))applied++;
+	}else if(op==REC_UNBIND){
+		b=bindfind(buf+2,l,iaid);
+		if(b)bindrelease(b);
+	}else
+		return -1;
+	return p;
+}
+
+/*handles a complete frame, returns -1 on protocol errors*/
+static int handleframe(int type,unsigned char*buf,int len)
+{
+	unsigned long long e,sq;
+	unsigned int c,i,cnt;
+	int p,r;
+	struct binding*b;
+	if(role==ROLE_PRIMARY){
+		if(type!=FRM_HELLO)return 0;
+		if(len<16)return -1;
+		e=GET8(buf);sq=GET8(buf+8);
+		/*a standby that already took over owns the bindings now*/
+		if(len>=24 && GET8(buf+16)){
+			td_log(LOGERROR,"replication: standby took over epoch %llx (ours is %llx), no longer serving clients",
+				GET8(buf+16),epoch);
+			steppeddown=1;
+			close(listenfd);
+			listenfd=-1;
+			return -1;
+		}
+		if(e==epoch && sq+1>=logfirst && sq<nextseq){
+			td_log(LOGINFO,"replication: standby catches up from sequence %llu",sq+1);
+			sendseq=sq+1;
+			connstate=CONN_STREAM;
+		}else
+			connstate=CONN_SNAPBEGIN;
+		return 0;
+	}
+	/*standby; after the takeover we only talk to tell the old primary*/
+	if(active)return 0;
+	lostsince=0;
+	switch(type){
+		case FRM_SNAPBEGIN:
+			if(len<16)return -1;
+			e=GET8(buf);sq=GET8(buf+8);
+			peerepoch=e;
+			synced=0;
+			peersnapseq=sq;
+			/*the snapshot replaces everything we know*/
+			c=0;
+			while((b=bindnext(&c))!=0)
+				bindrelease(b);
+			applied=0;
+			break;
+		case FRM_RECORDS:
+			for(p=0;p<len;p+=r)
+				if((r=applyrec(buf+p,len-p))<0)return -1;
+			break;
+		case FRM_SNAPEND:
+			lastseq=peersnapseq-1;
+			synced=1;
+			td_log(LOGINFO,"replication: snapshot received, %u bindings",applied);
+			break;
+		case FRM_DELTA:
+			if(len<10)return -1;
+			sq=GET8(buf);
+			cnt=GET2(buf+8);
+			if(sq>lastseq+1){
+				td_log(LOGWARN,"replication: gap in delta stream (%llu after %llu)",sq,lastseq);
+				return -1;
+			}
+			for(p=10,i=0;i<cnt;i++,sq++,p+=r){
+				/*skip records we already have, but parse them for their length*/
+				if(sq<=lastseq){
+					if(len-p<2)return -1;
+					r=2+buf[p+1]+4+(buf[p]==REC_BIND?12:0);
+					continue;
+				}
+				if((r=applyrec(buf+p,len-p))<0)return -1;
+				lastseq=sq;
+			}
+			td_log(LOGDEBUG,"replication: applied deltas up to %llu",lastseq);
+			break;
+		case FRM_KEEPALIVE:
+			break;
+		default:
+			return -1;
+	}
+	return 0;
+}
+
+/*reads from the connection and handles complete frames*/
+static void readconn()
+{
+	int r,l;
+	r=recv(connfd,inbuf+inlen,sizeof(inbuf)-inlen,0);
+	if(r==0){
+		closeconn("peer closed connection");
+		return;
+	}
+	if(r<0){
+		if(errno!=EAGAIN && errno!=EINTR)closeconn(strerror(errno));
+		return;
+	}
+	inlen+=r;
+	lastrecv=time(0);
+	while(inlen>=4){
+		l=GET4(inbuf);
+		if(l<1 || l>REPL_BUFSIZE){
+			closeconn("invalid frame");
+			return;
+		}
+		if(inlen<l+4)break;
+		if(handleframe(inbuf[4],inbuf+5,l-1)<0){
+			closeconn("protocol error");
+			return;
+		}
+		inlen-=l+4;
+		memmove(inbuf,inbuf+l+4,inlen);
+	}
+}
+
+/*writes pending output*/
+static void writeconn()
+{
+	int r,e;
+	socklen_t sl=sizeof(e);
+	if(connecting){
+		/*non-blocking connect finished*/
+		if(getsockopt(connfd,SOL_SOCKET,SO_ERROR,&e,&sl)<0 || e!=0){
+			closeconn(strerror(e));
+			return;
+		}
+		connecting=0;
+		if(tookover)
+			td_log(LOGWARN,"replication: primary of epoch %llx is reachable again, telling it about the takeover",tookover);
+		else
+			td_log(LOGINFO,"replication: connected to primary, last sequence %llu",lastseq);
+		r=beginframe(FRM_HELLO);
+		PUT8(outbuf+outlen,peerepoch);
+		PUT8(outbuf+outlen+8,lastseq);
+		PUT8(outbuf+outlen+16,tookover);
+		outlen+=24;
+		endframe(r);
+		lastrecv=time(0);
+	}
+	if(outoff>=outlen){
+		if(role==ROLE_PRIMARY)
+			fillout();
+		else if(time(0)-lastsend>=REPL_KEEPALIVE){
+			outoff=outlen=0;
+			r=beginframe(FRM_KEEPALIVE);
+			endframe(r);
+		}
+	}
+	if(outoff>=outlen)return;
+	r=send(connfd,outbuf+outoff,outlen-outoff,MSG_NOSIGNAL);
+	if(r<0){
+		if(errno!=EAGAIN && errno!=EINTR)closeconn(strerror(errno));
+		return;
+	}
+	outoff+=r;
+	if(outoff>=outlen)outoff=outlen=0;
+}
+
+static void acceptconn()
+{
+	int fd,val=1;
+	char a[64];
+	struct sockaddr_in6 sa;
+	socklen_t sl=sizeof(sa);
+	fd=accept(listenfd,(struct sockaddr*)&sa,&sl);
+	if(fd<0)return;
+	/*only one standby at a time, a new one replaces the old one*/
+	if(connfd>=0)closeconn("new standby connected");
+	td_log(LOGINFO,"replication: standby %s connected",inet_ntop(AF_INET6,&sa.sin6_addr,a,sizeof(a)));
+	connfd=fd;
+	fcntl(connfd,F_SETFL,O_NONBLOCK);
+	setsockopt(connfd,IPPROTO_TCP,TCP_NODELAY,&val,sizeof(val));
+	connstate=CONN_HELLO;
+	outoff=outlen=inlen=0;
+	lastrecv=lastsend=time(0);
+}
+
+static void connectprimary()
+{
+	int val=1;
+	lastattempt=time(0);
+	connfd=socket(PF_INET6,SOCK_STREAM,0);
+	if(connfd<0)return;
+	fcntl(connfd,F_SETFL,O_NONBLOCK);
+	setsockopt(connfd,IPPROTO_TCP,TCP_NODELAY,&val,sizeof(val));
+	if(connect(connfd,(struct sockaddr*)&peeraddr,sizeof(peeraddr))<0 && errno!=EINPROGRESS){
+		td_log(LOGDEBUG,"replication: cannot connect to primary: %s",strerror(errno));
+		close(connfd);
+		connfd=-1;
+		return;
+	}
+	connecting=1;
+	outoff=outlen=inlen=0;
+}
+
+int replfdset(fd_set*rfd,fd_set*wfd,int maxfd)
+{
+	if(listenfd>=0){
+		FD_SET(listenfd,rfd);
+		if(listenfd>maxfd)maxfd=listenfd;
+	}
+	if(connfd>=0){
+		if(!connecting)FD_SET(connfd,rfd);
+		if(wantwrite())FD_SET(connfd,wfd);
+		if(connfd>maxfd)maxfd=connfd;
+	}
+	return maxfd;
+}
+
+void replpoll(fd_set*rfd,fd_set*wfd)
+{
+	if(listenfd>=0 && FD_ISSET(listenfd,rfd))
+		acceptconn();
+	if(connfd>=0 && FD_ISSET(connfd,wfd))
+		writeconn();
+	if(connfd>=0 && !connecting && FD_ISSET(connfd,rfd))
+		readconn();
+}
+
+/*starts the fence command without waiting for it, returns false if it cannot run*/
+static bool startfence(long long now)
+{
+	fencepid=fork();
+	if(fencepid<0){
+		td_log(LOGERROR,"replication: cannot start fence command: %s",strerror(errno));
+		fencepid=0;
+		return false;
+	}
+	if(fencepid==0){
+		/*the child must not keep our sockets open*/
+		int fd;
+		for(fd=3;fd<1024;fd++)close(fd);
+		execl("/bin/sh","sh","-c",fencecmd,(char*)0);
+		_exit(127);
+	}
+	fencedeadline=now+REPL_FENCETIMEOUT;
+	td_log(LOGINFO,"replication: primary lost, running fence command (pid %i)",(int)fencepid);
+	return true;
+}
+
+/*checks the fence command: 1 if it succeeded, 0 while it runs, -1 if it failed*/
+static int checkfence(long long now)
+{
+	int st;
+	pid_t r=waitpid(fencepid,&st,WNOHANG);
+	if(r==0){
+		if(now<fencedeadline)return 0;
+		td_log(LOGERROR,"replication: fence command did not finish within %i seconds, killing it",REPL_FENCETIMEOUT);
+		kill(fencepid,SIGKILL);
+		waitpid(fencepid,&st,0);
+		fencepid=0;
+		return -1;
+	}
+	fencepid=0;
+	if(r<0){
+		td_log(LOGERROR,"replication: lost the fence command: %s",strerror(errno));
+		return -1;
+	}
+	if(WIFEXITED(st) && WEXITSTATUS(st)==0)return 1;
+	if(WIFEXITED(st))
+		td_log(LOGERROR,"replication: fence command failed (exit code %i), not taking over",WEXITSTATUS(st));
+	else
+		td_log(LOGERROR,"replication: fence command killed by signal %i, not taking over",WIFSIGNALED(st)?WTERMSIG(st):0);
+	return -1;
+}
+
+/*takes over if we have a complete copy and the primary is fenced, returns true on success;
+  the fence command runs in the background, this is called again until it finished*/
+static bool trytakeover(long long now)
+{
+	int r;
+	if(!synced){
+		/*an incomplete table would hand out prefixes the primary already gave away*/
+		if(!nosyncwarned)
+			td_log(LOGERROR,"replication: primary lost, but there is no complete copy of its bindings, not taking over");
+		nosyncwarned=1;
+		return false;
+	}
+	if(fencecmd){
+		if(!fencepid && !startfence(now))r=-1;
+		else r=checkfence(now);
+		if(r==0)return false;
+		if(r<0){
+			/*try again after another takeover period*/
+			lostsince=now;
+			return false;
+		}
+	}
+	td_log(LOGWARN,"replication: primary lost for %i seconds, taking over epoch %llx with %u bindings",
+		(int)(now-lostsince),peerepoch,bindcount());
+	active=1;
+	tookover=peerepoch;
+	if(connfd>=0){
+		close(connfd);
+		connfd=-1;
+		connecting=0;
+	}
+	lastattempt=now;
+	return true;
+}
+
+void repltimer(long long now)
+{
+	if(role==ROLE_NONE)return;
+	/*dead peer?*/
+	if(connfd>=0 && !connecting && now-lastrecv>3*REPL_KEEPALIVE)
+		closeconn("peer timed out");
+	/*an unanswered connect would otherwise block all further attempts*/
+	if(connfd>=0 && connecting && now-lastattempt>=REPL_CONNTIMEOUT)
+		closeconn("connect timed out");
+	if(role!=ROLE_STANDBY)return;
+	/*after the takeover: keep calling the old primary so it steps down once it is reachable*/
+	if(active){
+		if(connfd<0 && now-lastattempt>=REPL_RECONNECT)
+			connectprimary();
+		return;
+	}
+	/*take over if the primary is gone for too long; this is final*/
+	if(lostsince && now-lostsince>=takeover && trytakeover(now))
+		return;
+	/*do not connect while the primary is being fenced*/
+	if(fencepid)return;
+	if(connfd<0 && now-lastattempt>=REPL_RECONNECT)
+		connectprimary();
+}
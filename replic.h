@@ -0,0 +1,46 @@
+/*
+// C Interface: replic
+//
+// Description: binding replication from a primary to a standby server
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_REPLIC_H
+#define TDHCP_REPLIC_H
+
+#include "common.h"
+#include <sys/select.h>
+
+/*default TCP port for replication*/
+#define REPL_DEFPORT 6547
+
+/*primary: accept a standby on "[addr]:port" or "port"; returns -1 on syntax errors*/
+int replsetlisten(const char*);
+/*standby: replicate from the primary at "[addr]:port" or "addr"; returns -1 on syntax errors*/
+int replsetprimary(const char*);
+/*standby: seconds without primary before the standby starts serving clients*/
+void replsettakeover(int);
+/*standby: command that cuts off the primary (eg. powers it down) before a takeover,
+  the takeover only happens if it exits with 0*/
+void replsetfence(const char*cmd);
+
+/*opens the listening socket and registers for binding changes, call after bindinit;
+  returns 0 on success, -1 on error*/
+int replinit();
+
+/*adds replication sockets to the select sets, returns the new maximum fd*/
+int replfdset(fd_set*rfd,fd_set*wfd,int maxfd);
+/*handles socket events after select*/
+void replpoll(fd_set*rfd,fd_set*wfd);
+/*timeouts, reconnects and takeover, call once per main loop iteration*/
+void repltimer(long long now);
+
+/*returns true while this server is a standby that must not answer clients*/
+bool replpassive();
+
+#endif
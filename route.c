@@ -0,0 +1,298 @@
+/*
+*  C Implementation: route
+*
+* Description: routes for delegated prefixes
+*
+* Binding changes of this process are queued and sent to the kernel as one
+* rtnetlink batch per main loop iteration, so a reconnect storm costs a few
+* netlink messages instead of one "ip route" process per session. At
+* startup the DHCP routes on the device are compared with the binding
+* table: missing routes are added, stale ones from an earlier run removed
+* (only inside the pool and the static prefixes, other DHCP routes on the
+* device are left alone). Bindings of this process may expire in another
+* one, which does not tell us; so the routed slots are checked against the
+* table on a timer.
+* A passive replication standby (or a primary that stepped down) routes
+* nothing: the bindings it restores belong to the active server. Whenever
+* that state changes the routes are reconciled again, so a takeover installs
+* the routes of all bindings it took over.
+* Routes lead to the link-local address of the client if it is known
+* (multi-access links), otherwise just to the device (PPP).
+*
+*
+* Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+*
+* Copyright: See COPYING file that comes with this distribution
+*
+*/
+
+#include "route.h"
+#include "binding.h"
+#include "nlapply.h"
+#include "replic.h"
+#include "common.h"
+
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/*maximum number of routes per netlink batch, fits into its buffer*/
+#define ROUTE_BATCH 128
+/*seconds between checks of the routed slots*/
+#define ROUTE_CHECK 30
+
+/*a queued route change*/
+struct routeop {
+	struct in6_addr prefix;
+	/*binding the route leads to (for the address of the client) and its slot,
+	  NULL for static prefixes and withdrawals*/
+	struct binding*bind;
+	unsigned int slot;
+	unsigned char plen,del;
+};
+
+static int enabled=0,listening=0,mypid=0;
+static const char*routedev=0;
+static struct routeop*pending=0;
+static int npending=0,maxpending=0,nwanted=0;
+/*prefixes given to every client*/
+static struct in6_addr*statics=0;
+static unsigned char*staticlens=0;
+static int nstatics=0;
+/*pool slots routed by this process, one bit per slot*/
+static unsigned long long*routed=0;
+static unsigned int routedwords=0;
+static long long lastcheck=0;
+/*replication state the routes were last reconciled for*/
+static bool passive=false;
+
+void routeenable()
+{
+	enabled=1;
+}
+
+bool routeenabled()
+{
+	return enabled;
+}
+
+void routestatic(const struct in6_addr*prefix,int plen)
+{
+	int i;
+	for(i=0;i<nstatics;i++)
+		if(staticlens[i]==plen && Memcmp(&statics[i],(void*)prefix,16)==0)return;
+	statics=Realloc(statics,(nstatics+1)*sizeof(struct in6_addr));
+	staticlens=Realloc(staticlens,nstatics+1);
+	Memcpy(&statics[nstatics],(void*)prefix,16);
+	staticlens[nstatics++]=plen;
+}
+
+/*appends a change to the queue*/
+static void queue(const struct in6_addr*prefix,int plen,struct binding*b,int del)
+{
+	struct routeop*op;
+	if(npending>=maxpending){
+		maxpending=maxpending?maxpending*2:64;
+		pending=Realloc(pending,maxpending*sizeof(struct routeop));
+	}
+	op=&pending[npending++];
+	Memcpy(&op->prefix,(void*)prefix,16);
+	op->plen=plen;
+	op->bind=b;
+	op->slot=b?b->slot:BIND_NOSLOT;
+	op->del=del;
+}
+
+void routereplacestatic(const struct in6_addr*prefixes,const unsigned char*plens,int n)
+{
+	int i,j;
+	if(enabled && routedev && !passive){
+		/*withdraw the prefixes that are gone...*/
+		for(i=0;i<nstatics;i++){
+			for(j=0;j<n;j++)
+				if(plens[j]==staticlens[i] && Memcmp((void*)&prefixes[j],&statics[i],16)==0)break;
+			if(j>=n)queue(&statics[i],staticlens[i],0,1);
+		}
+		/*...and route the new ones*/
+		for(j=0;j<n;j++){
+			for(i=0;i<nstatics;i++)
+				if(plens[j]==staticlens[i] && Memcmp((void*)&prefixes[j],&statics[i],16)==0)break;
+			if(i>=nstatics)queue(&prefixes[j],plens[j],0,0);
+		}
+	}
+	nstatics=0;
+	for(j=0;j<n;j++)routestatic(&prefixes[j],plens[j]);
+}
+
+/*remembers whether a slot is routed by us*/
+static void markrouted(unsigned int slot,int on)
+{
+	if(slot/64>=routedwords)return;
+	if(on)routed[slot/64]|=1ULL<<(slot%64);
+	else routed[slot/64]&=~(1ULL<<(slot%64));
+}
+
+static void routelistener(int ev,struct binding*b)
+{
+	struct in6_addr prefix;
+	/*bindings of other processes are routed to their own devices,
+	  those restored by a standby by the active server*/
+	if(b->slot==BIND_NOSLOT || b->pid!=mypid || passive)return;
+	bindslotprefix(b->slot,&prefix);
+	if(ev==BINDEV_BIND){
+		queue(&prefix,bindpoollen(),b,0);
+		markrouted(b->slot,1);
+	}else if(ev==BINDEV_RELEASE || ev==BINDEV_EXPIRE){
+		queue(&prefix,bindpoollen(),0,1);
+		markrouted(b->slot,0);
+	}
+	/*renewals keep their route*/
+}
+
+/*orders queued changes by prefix*/
+static int opcmp(const void*a,const void*b)
+{
+	const struct routeop*x=a,*y=b;
+	int r=memcmp(&x->prefix,&y->prefix,16);
+	if(r)return r;
+	return (int)x->plen-(int)y->plen;
+}
+
+/*returns true if addr/alen lies inside prefix/plen*/
+static bool inprefix(const struct in6_addr*addr,int alen,const struct in6_addr*prefix,int plen)
+{
+	const unsigned char*a=(const unsigned char*)addr,*p=(const unsigned char*)prefix;
+	int i;
+	if(alen<plen)return false;
+	for(i=0;i<plen;i++)
+		if((a[i/8]^p[i/8])&(0x80>>(i%8)))return false;
+	return true;
+}
+
+/*called for every DHCP route found on the device at startup*/
+static void stale(const struct in6_addr*prefix,int plen)
+{
+	struct routeop key;
+	int i;
+	/*only routes we may have installed: pool prefixes and the static ones*/
+	if(plen!=bindpoollen() || bindprefixslot(prefix)==BIND_NOSLOT){
+		for(i=0;i<nstatics;i++)
+			if(inprefix(prefix,plen,&statics[i],staticlens[i]))break;
+		if(i>=nstatics)return;
+	}
+	Memcpy(&key.prefix,(void*)prefix,16);
+	key.plen=plen;
+	if(bsearch(&key,pending,nwanted,sizeof(struct routeop),opcmp))return;
+	queue(prefix,plen,0,1);
+}
+
+/*compares the routes on the device with what should be routed and queues
+  the differences; returns -1 if the routes cannot be read*/
+static int reconcile()
+{
+	struct binding*b;
+	struct in6_addr prefix;
+	unsigned int cursor=0;
+	int i,n;
+	npending=0;
+	if(routed)Memzero(routed,routedwords*sizeof(unsigned long long));
+	passive=replpassive();
+	/*what should be routed...*/
+	for(i=0;i<nstatics && !passive;i++)
+		queue(&statics[i],staticlens[i],0,0);
+	while(!passive && (b=bindnext(&cursor))!=0)
+		if(b->slot!=BIND_NOSLOT && b->pid==mypid){
+			bindslotprefix(b->slot,&prefix);
+			queue(&prefix,bindpoollen(),b,0);
+			markrouted(b->slot,1);
+		}
+	nwanted=npending;
+	if(nwanted>1)qsort(pending,nwanted,sizeof(struct routeop),opcmp);
+	/*...and what is still routed there from an earlier run*/
+	n=nlroutes(routedev,stale);
+	if(n<0){
+		td_log(LOGERROR,"routes: unable to read the routes of %s",routedev);
+		return -1;
+	}
+	td_log(LOGINFO,"routes: %i prefixes to route on %s%s, found %i routes, %i of them stale",
+		nwanted,routedev,passive?" (passive)":"",n,npending-nwanted);
+	routeflush();
+	return 0;
+}
+
+int routeinit(const char*dev)
+{
+	if(!enabled)return 0;
+	routedev=dev;
+	mypid=getpid();
+	Free(routed);
+	routed=0;
+	routedwords=0;
+	if(bindhaspool()){
+		routedwords=(bindpoolsize()+63)/64;
+		routed=Malloc(routedwords*sizeof(unsigned long long));
+	}
+	if(!listening){
+		if(bindaddlistener(routelistener)<0){
+			td_log(LOGERROR,"routes: cannot register for binding changes");
+			return -1;
+		}
+		listening=1;
+	}
+	return reconcile();
+}
+
+void routetimer(long long now)
+{
+	struct binding*b;
+	struct in6_addr prefix;
+	unsigned int w,slot;
+	unsigned long long m;
+	if(!routedev)return;
+	/*took over or stepped down: route what is ours now*/
+	if(passive!=replpassive()){
+		routeflush();
+		reconcile();
+		return;
+	}
+	if(!routedwords || now-lastcheck<ROUTE_CHECK)return;
+	lastcheck=now;
+	for(w=0;w<routedwords;w++)
+		for(m=routed[w];m;m&=m-1){
+			slot=w*64+__builtin_ctzll(m);
+			b=bindbyslot(slot);
+			if(b && b->pid==mypid)continue;
+			/*expired (or reaped) by another process*/
+			td_log(LOGDEBUG,"routes: binding of slot %u is gone, withdrawing its route",slot);
+			bindslotprefix(slot,&prefix);
+			queue(&prefix,bindpoollen(),0,1);
+			markrouted(slot,0);
+		}
+}
+
+/*returns the address of the client behind a route, NULL for a device route*/
+static const struct in6_addr* gateway(struct routeop*op)
+{
+	struct binding*b=op->bind;
+	/*the binding may have been released again since*/
+	if(!b || b->state!=BIND_VALID || b->slot!=op->slot)return 0;
+	if(!IN6_IS_ADDR_LINKLOCAL(&b->peer))return 0;
+	return &b->peer;
+}
+
+void routeflush()
+{
+	struct routeop*op;
+	int i,j;
+	if(!npending)return;
+	for(i=0;i<npending;i+=ROUTE_BATCH){
+		nlbegin();
+		for(j=i;j<npending && j<i+ROUTE_BATCH;j++){
+			op=&pending[j];
+			nlroute(routedev,&op->prefix,op->plen,op->del?0:gateway(op),op->del);
+		}
+		nlcommit();
+	}
+	npending=0;
+}
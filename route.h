@@ -0,0 +1,40 @@
+/*
+// C Interface: route
+//
+// Description: routes for delegated prefixes, installed via rtnetlink
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_ROUTE_H
+#define TDHCP_ROUTE_H
+
+#include "common.h"
+
+struct in6_addr;
+
+/*install and withdraw routes for delegated prefixes*/
+void routeenable();
+/*returns true if routes are installed*/
+bool routeenabled();
+
+/*routes a prefix that is handed to every client, call before routeinit*/
+void routestatic(const struct in6_addr*prefix,int plen);
+/*replaces the static prefixes, routes that are no longer wanted are withdrawn
+  and new ones installed with the next routeflush*/
+void routereplacestatic(const struct in6_addr*prefixes,const unsigned char*plens,int n);
+/*registers for binding changes and reconciles the routes on dev with the
+  binding table, call after bindinit; returns 0 on success, -1 on error*/
+int routeinit(const char*dev);
+/*withdraws the routes of bindings that another process expired,
+  call periodically*/
+void routetimer(long long now);
+/*sends the changes collected since the last call as one netlink batch,
+  call once per main loop iteration*/
+void routeflush();
+
+#endif
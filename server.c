@@ -13,6 +13,16 @@
 #include "common.h"
 #include "sock.h"
 #include "message.h"
+#include "binding.h"
+#include "cluster.h"
+#include "replic.h"
+#include "leasequery.h"
+#include "rcache.h"
+#include "reconf.h"
+#include "route.h"
+#include "event.h"
+#include "ipam.h"
+#include "server.h"
 
 #include <getopt.h>
 #include <stdio.h>
@@ -24,12 +34,16 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <ctype.h>
+#include <limits.h>
 
 /*side ID, allocated in server.c (0x00) and client.c (0x01) respectively*/
 const unsigned char SIDEID=SIDE_SERVER;
 
-
-char shortopt[]="hl:p:a:d:D:u:L:fP:";
+#ifndef TDHCP_PLUGIN
+char shortopt[]="hl:p:a:d:D:u:L:fP:o:s:b:n:N:R:S:T:qQ:cCU:k:r:t:ie:I:F:x:A:";
 struct option longopt[]= {
  {"local-id",1,0,'l'},
  {"log-level",1,0,'L'},
@@ -42,6 +56,28 @@ struct option longopt[]= {
  {"pid-file",1,0,'P'},
  {"help",0,0,'h'},
  {"duid",1,0,'u'},
+ {"pool",1,0,'o'},
+ {"shm",1,0,'s'},
+ {"max-bindings",1,0,'b'},
+ {"node-id",1,0,'n'},
+ {"cluster-node",1,0,'N'},
+ {"repl-listen",1,0,'R'},
+ {"repl-primary",1,0,'S'},
+ {"repl-takeover",1,0,'T'},
+ {"repl-fence",1,0,'x'},
+ {"leasequery",0,0,'q'},
+ {"bulk-leasequery",1,0,'Q'},
+ {"leasequery-allow",1,0,'A'},
+ {"rapid-commit",0,0,'c'},
+ {"no-rapid-commit",0,0,'C'},
+ {"unicast",1,0,'U'},
+ {"reply-cache",1,0,'k'},
+ {"reconfigure-rate",1,0,'r'},
+ {"lifetime",1,0,'t'},
+ {"install-routes",0,0,'i'},
+ {"event-socket",1,0,'e'},
+ {"ipam",1,0,'I'},
+ {"config",1,0,'F'},
  {0,0,0,0}
 };
 
@@ -62,6 +98,97 @@ struct option longopt[]= {
  "  -p prefix/length | --prefix=prefix/length\n" \
  "    sets a prefix that is sent via prefix delegation\n" \
  \
+ "  -o prefix/length/plen | --pool=prefix/length/plen\n" \
+ "    delegates one prefix of length plen out of prefix/length to each\n" \
+ "    client instead of the static prefixes given with -p\n" \
+ \
+ "  -s name | --shm=name\n" \
+ "    keep bindings and pool in the POSIX shared memory segment name, all\n" \
+ "    servers using the same name (and pool) hand out unique prefixes\n" \
+ \
+ "  -b num | --max-bindings=num\n" \
+ "    size of the binding table (default: pool size plus 25%%, or 1024)\n" \
+ \
+ "  -n ID | --node-id=ID\n  -N ID | --cluster-node=ID\n" \
+ "    cluster mode: the pool is sharded between all nodes given with -N\n" \
+ "    (repeat for each node, all nodes need the same list) by consistent\n" \
+ "    hashing, this server (-n, must be in the list) only allocates from\n" \
+ "    its own slices\n" \
+ \
+ "  -R [addr]:port | --repl-listen=[addr]:port\n" \
+ "    primary: accept a standby server on this TCP address and stream\n" \
+ "    all binding changes to it\n" \
+ \
+ "  -S [addr]:port | --repl-primary=[addr]:port\n" \
+ "    standby: replicate bindings from this primary, do not answer clients\n" \
+ "    while the primary is alive\n" \
+ \
+ "  -T seconds | --repl-takeover=seconds\n" \
+ "    standby: take over after the primary is lost this long (default: 10)\n" \
+ "    if it has a complete copy of the primary's bindings; a primary that\n" \
+ "    is reachable again stops serving clients\n" \
+ \
+ "  -x command | --repl-fence=command\n" \
+ "    standby: run command before a takeover to cut off the primary (eg.\n" \
+ "    switch off its port or power), only take over if it exits with 0;\n" \
+ "    it runs in the background and is killed after 30 seconds\n" \
+ \
+ "  -q | --leasequery\n" \
+ "    answer RFC 5007 leasequeries (by address or client ID) via UDP\n" \
+ \
+ "  -Q [addr]:port | --bulk-leasequery=[addr]:port\n" \
+ "    accept RFC 5460 bulk leasequeries via TCP (default port 547)\n" \
+ \
+ "  -A prefix/len | --leasequery-allow=prefix/len\n" \
+ "    only answer leasequeries from these requestors (repeat for more),\n" \
+ "    without it UDP queries are only answered for link-local senders that\n" \
+ "    are not relayed and TCP connections only accepted from ::1\n" \
+ \
+ "  -c | --rapid-commit\n  -C | --no-rapid-commit\n" \
+ "    enables (-c, default) or disables (-C) rapid commit: a SOLICIT with\n" \
+ "    the rapid commit option is answered with a REPLY and bound at once\n" \
+ \
+ "  -U addr | --unicast=addr\n" \
+ "    tell clients to send REQUEST, RENEW, RELEASE and DECLINE directly to\n" \
+ "    this global address of the server, relays may use it too\n" \
+ \
+ "  -k num | --reply-cache=num\n" \
+ "    keep the last num replies to answer retransmitted messages without\n" \
+ "    handling them again (default: 1024, 0 disables the cache)\n" \
+ \
+ "  -r num | --reconfigure-rate=num\n" \
+ "    on SIGUSR2 all clients that accept reconfiguration are sent a\n" \
+ "    RECONFIGURE, num per second (default: 1000); relayed clients get it\n" \
+ "    via their relay agent, clients behind nested relays are skipped\n" \
+ \
+ "  -t seconds | --lifetime=seconds\n" \
+ "    valid lifetime of prefixes and addresses, clients renew after half\n" \
+ "    of it (T1) and rebind after 80%% (T2); pool bindings that are not\n" \
+ "    renewed expire (default: 0, infinite lifetimes)\n" \
+ \
+ "  -i | --install-routes\n" \
+ "    route delegated prefixes to the device via netlink (to the link-local\n" \
+ "    address of the client if it is known), remove the routes again when\n" \
+ "    the binding ends and reconcile them with the bindings at startup\n" \
+ \
+ "  -e path | --event-socket=path\n" \
+ "    stream bind, renew, release and expire events as lines of JSON to\n" \
+ "    consumers connecting to the UNIX socket path; consumers that do not\n" \
+ "    keep up lose events instead of slowing down the server; %%i in path is\n" \
+ "    replaced by the device name\n" \
+ \
+ "  -I path | --ipam=path\n" \
+ "    new bindings get the pool prefix (-o) chosen by the IPAM listening on\n" \
+ "    the UNIX socket path; messages wait while it is asked, its answers\n" \
+ "    are cached for the TTL it gives\n" \
+ \
+ "  -F file | --config=file\n" \
+ "    read more options from file, one per line as long option name and\n" \
+ "    value (eg. \"dns-server 2001:db8::53\"), # starts a comment; on SIGHUP\n" \
+ "    the file is read again and its prefixes, addresses, DNS settings,\n" \
+ "    lifetime, rapid commit and log level replace the old ones; if what\n" \
+ "    clients get has changed they are sent a RECONFIGURE as on SIGUSR2\n" \
+ \
  "  -a addr | --address=addr\n" \
  "    sets the address that is delegated to the client\n" \
  \
@@ -85,47 +212,62 @@ struct option longopt[]= {
  "    set the log level (default is warn), must be one of:\n" \
  "    none, error, warn, info, debug\n"
 
-static char*argv0=0,*localid=0,*device=0,*pidfile=0;
+static char*argv0=0,*device=0,*pidfile=0,*configfile=0;
 static int dofork=1;
+/*set by the signal handlers to leave the main loop, to log statistics, to reconfigure clients
+  or to reload the config file*/
+static volatile int doexit=0,dostats=0,doreconf=0,doreload=0;
 
 /*output the help text*/
 static void printhelp()
 {
 	fprintf(stderr,HELP,argv0);
 }
+#endif
 
+static char*localid=0,*shmname=0;
+static int maxbindings=0,rcachesize=RC_DEFSIZE;
+/*unicast address (server unicast option) and its socket*/
+static struct in6_addr unicastaddr;
+static int haveunicast=0,ucastfd=-1;
+/*exchanges completed with SOLICIT/REPLY (rapid commit) and with REQUEST/REPLY*/
+static unsigned long long twomsgcnt=0,fourmsgcnt=0;
 
-/*maximum amount of any item that we can handle: 16 is sensitive for addresses, prefixes and DNS settings*/
-#define MAXITEMS 16
-
-static struct in6_addr addresses[MAXITEMS], prefixes[MAXITEMS], dnsservers[MAXITEMS];
-static char **dnsnames;
-static unsigned char prefixlens[MAXITEMS];
+/*settings that can be replaced while running: what goes into the replies*/
+struct srvconfig {
+	struct in6_addr*addresses,*prefixes,*dnsservers;
+	unsigned char*prefixlens;
+	char**dnsnames;
+	int addresscnt,prefixcnt,dnsservercnt,dnsnamecnt;
+	/*lease lifetime in seconds, 0 for infinite*/
+	long lifetime;
+	int userapid;
+};
+/*active settings and those being set up by serveroption*/
+static struct srvconfig*cfg=0,*setup=0;
 static struct in6_addr NULLADDR;
-static int addresscnt=0,prefixcnt=0,dnsservercnt=0,dnsnamecnt=0;
+/*prefix pool: poolprefix/poollen is split into prefixes of length poolplen*/
+static struct in6_addr poolprefix;
+static int poollen=0,poolplen=0;
 
-static void inititems()
+static struct srvconfig* newconfig()
 {
-	dnsnames=Malloc(MAXITEMS*sizeof(char*));
-	Memzero(dnsnames,MAXITEMS*sizeof(char*));
-	Memzero(addresses,16*MAXITEMS);
-	Memzero(prefixes,16*MAXITEMS);
-	Memzero(dnsservers,16*MAXITEMS);
-	Memzero(prefixlens,MAXITEMS);
-	Memzero(&NULLADDR,16);
+	struct srvconfig*c=Malloc(sizeof(struct srvconfig));
+	Memzero(c,sizeof(struct srvconfig));
+	c->userapid=1;
+	return c;
 }
 
-static void countitems()
+static void inititems()
 {
-	int i;
-	for(i=0;i<MAXITEMS;i++)if(Memcmp(&addresses[i],&NULLADDR,16)==0)break;addresscnt=i;
-	for(i=0;i<MAXITEMS;i++)if(Memcmp(&prefixes[i],&NULLADDR,16)==0)break;prefixcnt=i;
-	for(i=0;i<MAXITEMS;i++)if(Memcmp(&dnsservers[i],&NULLADDR,16)==0)break;dnsservercnt=i;
-	for(i=0;i<MAXITEMS;i++)if(dnsnames[i]==0)break;dnsnamecnt=i;
+	if(setup)return;
+	setup=newconfig();
+	Memzero(&NULLADDR,16);
 }
 
-
-static int addaddr(struct in6_addr*list,const char*addr,const char*atype)
+/*appends an address to a list of the settings being set up unless it is already there,
+  returns its position or -1 on error*/
+static int addaddr(struct in6_addr**list,int*cnt,const char*addr,const char*atype)
 {
 	int i;
 	struct in6_addr itm;
@@ -138,27 +280,20 @@ static int addaddr(struct in6_addr*list,const char*addr,const char*atype)
 		td_log(LOGWARN,"cannot add a null address (%s) as %s",addr,atype);
 		return -1;
 	}
-	/*go through list...*/
-	for(i=0;i<MAXITEMS;i++){
-		/*if the current one is a null addr, insert it here*/
-		if(Memcmp(&list[i],&NULLADDR,16)==0){
-			Memcpy(&list[i],&itm,16);
+	/*check whether it is already known*/
+	for(i=0;i<*cnt;i++)
+		if(Memcmp(&(*list)[i],&itm,16)==0)
 			return i;
-		}
-		/*otherwise: check whether it is already known*/
-		if(Memcmp(&list[i],&itm,16)==0)
-			return i;
-	}
-	/*no free space*/
-	td_log(LOGWARN,"unable to add yet another %s (%s), a maximum of %i is allowed",atype,addr,MAXITEMS);
-	return -1;
+	*list=Realloc(*list,(*cnt+1)*sizeof(struct in6_addr));
+	Memcpy(&(*list)[*cnt],&itm,16);
+	return (*cnt)++;
 }
 
 static int addprefix(const char*pre)
 {
 	/*copy*/
 	char buf[1024],*p,*e;
-	int i,j;
+	int i,j,n;
 	Strncpy(buf,pre,sizeof(buf));
 	/*find slash, get prefix length*/
 	p=strchr(buf,'/');
@@ -178,108 +313,871 @@ static int addprefix(const char*pre)
 		i=64;
 	}
 	/*add prefix*/
-	j=addaddr(prefixes,buf,"prefix");
-	if(j>=0)prefixlens[j]=i;
+	n=setup->prefixcnt;
+	j=addaddr(&setup->prefixes,&setup->prefixcnt,buf,"prefix");
+	if(j>=0 && setup->prefixcnt>n)
+		setup->prefixlens=Realloc(setup->prefixlens,setup->prefixcnt);
+	if(j>=0)setup->prefixlens[j]=i;
 	return j;
 }
 
+static int setpool(const char*pool)
+{
+	char buf[1024],*p,*q,*e;
+	Strncpy(buf,pool,sizeof(buf));
+	buf[sizeof(buf)-1]=0;
+	/*split into prefix, length and delegated length*/
+	p=strchr(buf,'/');
+	if(!p || !(q=strchr(p+1,'/'))){
+		td_log(LOGERROR,"pool %s must be given as prefix/length/delegated-length",pool);
+		return -1;
+	}
+	*p++=0;*q++=0;
+	poollen=strtol(p,&e,10);
+	if(*e==0)poolplen=strtol(q,&e,10);
+	if(*e!=0 || poollen<1 || poollen>128 || poolplen<=poollen || poolplen>128){
+		td_log(LOGERROR,"invalid lengths in pool %s",pool);
+		poollen=poolplen=0;
+		return -1;
+	}
+	if(!inet_pton(AF_INET6,buf,&poolprefix)){
+		td_log(LOGERROR,"while parsing pool \"%s\" - not a valid IPv6 prefix",pool);
+		poollen=poolplen=0;
+		return -1;
+	}
+	return 0;
+}
+
 static int adddomain(const char*itm)
 {
 	int i;
 	/*check for null items*/
 	if(!itm)return -1;
 	if(*itm==0)return -1;
-	/*go through list...*/
-	for(i=0;i<MAXITEMS;i++){
-		/*if current position is empty, insert here*/
-		if(!dnsnames[i]){
-			dnsnames[i]=Malloc(strlen(itm)+1);
-			Strcpy(dnsnames[i],itm);
+	/*check whether item is known*/
+	for(i=0;i<setup->dnsnamecnt;i++)
+		if(strcmp(setup->dnsnames[i],itm)==0)
 			return i;
+	setup->dnsnames=Realloc(setup->dnsnames,(i+1)*sizeof(char*));
+	setup->dnsnames[i]=Malloc(strlen(itm)+1);
+	Strcpy(setup->dnsnames[i],itm);
+	return setup->dnsnamecnt++;
+}
+
+/*returns the client DUID option of a message or NULL*/
+static struct dhcp_opt* clientid(struct dhcp_msg*msg)
+{
+	int p=messagefindoption(msg,OPT_CLIENTID);
+	if(p<0){
+		td_log(LOGINFO,"message without client ID, cannot bind it");
+		return 0;
+	}
+	return &msg->msg_opt[p];
+}
+
+/*returns the pool slot of the first prefix quoted in an IA_PD or BIND_NOSLOT*/
+static unsigned int quotedslot(struct dhcp_opt*ia)
+{
+	int i;
+	for(i=0;i<ia->opt_numopts;i++)
+		if(ia->subopt[i].opt_type==OPT_IAPREFIX)
+			return bindprefixslot(&ia->subopt[i].opt_iaprefix.prefix);
+	return BIND_NOSLOT;
+}
+
+/*returns the slot to advertise for an IA_PD, does not create any state*/
+static unsigned int clientoffer(struct dhcp_msg*msg,unsigned int iaid)
+{
+	struct dhcp_opt*id=clientid(msg);
+	struct binding*b;
+	unsigned int slot;
+	if(!id)return BIND_NOSLOT;
+	if(!ipamenabled())
+		return bindoffer(id->opt_duid.duid,id->opt_duid.len,iaid);
+	/*the IPAM chooses for new bindings*/
+	b=bindfind(id->opt_duid.duid,id->opt_duid.len,iaid);
+	if(b)return b->slot;
+	slot=ipamslot(id->opt_duid.duid,id->opt_duid.len,iaid);
+	if(slot!=BIND_NOSLOT && bindbyslot(slot))return BIND_NOSLOT;
+	return slot;
+}
+
+/*commits the binding for an IA_PD, preferring the prefix the client quotes*/
+static struct binding* clientbinding(struct dhcp_msg*msg,struct dhcp_opt*ia)
+{
+	struct dhcp_opt*id=clientid(msg);
+	struct binding*b;
+	unsigned int slot;
+	if(!id)return 0;
+	if(ipamenabled())
+		b=bindclaimexact(id->opt_duid.duid,id->opt_duid.len,ia->opt_iapd.iaid,
+			ipamslot(id->opt_duid.duid,id->opt_duid.len,ia->opt_iapd.iaid));
+	else{
+		/*only the prefix we would offer may be claimed, the offer is always
+		  free and inside our cluster slice; anything else is allocated anew*/
+		slot=quotedslot(ia);
+		if(slot!=BIND_NOSLOT && slot!=bindoffer(id->opt_duid.duid,id->opt_duid.len,ia->opt_iapd.iaid)){
+			td_log(LOGDEBUG,"client quoted pool slot %u which was not offered to it, ignoring it",slot);
+			slot=BIND_NOSLOT;
 		}
-		/*otherwise: check whether item is known*/
-		if(strcmp(dnsnames[i],itm)==0)
-			return i;
+		b=bindclaim(id->opt_duid.duid,id->opt_duid.len,ia->opt_iapd.iaid,slot);
 	}
-	/*no free space*/
-	td_log(LOGWARN,"unable to add yet another domain (%s) to the search list, a maximum of %i is allowed",itm,MAXITEMS);
-	return -1;
+	if(b && cfg->lifetime)bindrenew(b,time(0)+cfg->lifetime);
+	return b;
 }
 
-/*parse the response message and manipulate the send message*/
-static void handlemessage(struct dhcp_msg*rmsg)
+/*renews the binding of an IA_PD, returns NULL if the client has none*/
+static struct binding* clientrenew(struct dhcp_msg*msg,struct dhcp_opt*ia)
 {
-	int i,j,p;
-	struct dhcp_msg*smsg;
-	/*create reply*/
-	if(rmsg->msg_type==MSG_SOLICIT)
-		smsg=newmessage(MSG_ADVERTISE);
+	struct dhcp_opt*id=clientid(msg);
+	struct binding*b;
+	if(!id)return 0;
+	b=bindfind(id->opt_duid.duid,id->opt_duid.len,ia->opt_iapd.iaid);
+	if(b)bindrenew(b,cfg->lifetime?time(0)+cfg->lifetime:0);
+	return b;
+}
+
+/*static prefixes and addresses need no binding, but clients that accept
+  reconfiguration get one without pool slot to keep their key and address;
+  one per client message, keyed by the IAID of its IA_PD (or IA_NA)*/
+static void staticreconf(struct dhcp_msg*rmsg,struct dhcp_msg*smsg)
+{
+	struct dhcp_opt*id;
+	struct binding*b;
+	unsigned int iaid;
+	int j;
+	if(messagefindoption(rmsg,OPT_RECONF_ACCEPT)<0)return;
+	if((j=messagefindoption(rmsg,OPT_IAPD))>=0)
+		iaid=rmsg->msg_opt[j].opt_iapd.iaid;
+	else if((j=messagefindoption(rmsg,OPT_IANA))>=0)
+		iaid=rmsg->msg_opt[j].opt_iana.iaid;
 	else
-		smsg=newmessage(MSG_REPLY);
-	/*copy...*/
+		return;
+	if((id=clientid(rmsg))==0)return;
+	b=bindclaim(id->opt_duid.duid,id->opt_duid.len,iaid,BIND_NOSLOT);
+	if(!b)return;
+	bindrenew(b,cfg->lifetime?time(0)+cfg->lifetime:0);
+	reconfbind(b,rmsg,smsg);
+}
+
+/*sets T1 and T2 of an IA according to the lifetime, 0 lets the client choose*/
+static void iatimers(struct dhcp_opt*ia)
+{
+	ia->opt_iapd.t1=cfg->lifetime/2;
+	ia->opt_iapd.t2=cfg->lifetime*4/5;
+}
+
+/*returns true if the message carries our server ID*/
+static bool forus(struct dhcp_msg*msg)
+{
+	int p=messagefindoption(msg,OPT_SERVERID);
+	if(p<0)return false;
+	return msg->msg_opt[p].opt_duid.len==DUIDLEN &&
+		Memcmp(msg->msg_opt[p].opt_duid.duid,DUID,DUIDLEN)==0;
+}
+
+/*appends a status code to a message*/
+static void msgstatus(struct dhcp_msg*msg,int code,const char*text)
+{
+	struct dhcp_opt st;
+	Memzero(&st,sizeof(st));
+	st.opt_type=OPT_STATUS_CODE;
+	st.opt_status.status=code;
+	st.opt_status.message=(char*)text;
+	messageappendopt(msg,&st);
+}
+
+/*appends a status code to an IA option*/
+static void iastatus(struct dhcp_opt*ia,int code,const char*text)
+{
+	struct dhcp_opt st;
+	Memzero(&st,sizeof(st));
+	st.opt_type=OPT_STATUS_CODE;
+	st.opt_status.status=code;
+	st.opt_status.message=(char*)text;
+	optappendopt(ia,&st);
+}
+
+/*creates a reply to rmsg with the server and client IDs, relayed messages
+  are answered through the same relays*/
+static struct dhcp_msg* newreply(struct dhcp_msg*rmsg,int type)
+{
+	struct dhcp_msg*smsg=newmessage(type);
+	int p;
 	smsg->msg_id=rmsg->msg_id;
 	Memcpy(&smsg->msg_peer,&rmsg->msg_peer,sizeof(rmsg->msg_peer));
+	smsg->msg_sock=rmsg->msg_sock;
+	messagemoverelay(smsg,rmsg);
 	messageaddopt(smsg,OPT_SERVERID);
 	p=messagefindoption(rmsg,OPT_CLIENTID);
 	if(p>=0)
 		messageappendopt(smsg,&rmsg->msg_opt[p]);
-	if(messagefindoption(rmsg,OPT_RAPIDCOMMIT)>=0)
+	return smsg;
+}
+
+/*sends and frees the reply, frees the received message;
+  the encoded reply is kept for retransmissions*/
+static int sendreply(struct dhcp_msg*rmsg,struct dhcp_msg*smsg)
+{
+	unsigned char buf[65536];
+	int len=encodemessage(smsg,buf,sizeof(buf)),r=-1;
+	if(len<0)
+		td_log(LOGERROR,"internal problem: message is too big (>64kB) to send");
+	else if((r=sendencoded(smsg,buf,len))==0)
+		rcstore(rmsg,buf,len);
+	freemessage(rmsg);
+	freemessage(smsg);
+	return r;
+}
+
+/*RELEASE and DECLINE: return the prefixes to the pool at once*/
+static void handlerelease(struct dhcp_msg*rmsg)
+{
+	struct dhcp_msg*smsg=newreply(rmsg,MSG_REPLY);
+	struct dhcp_opt*id=clientid(rmsg);
+	struct binding*b;
+	int i,p;
+	for(i=0;i<rmsg->msg_numopts;i++){
+		/*IA_NA only has a binding with static addresses for reconfiguration*/
+		if(rmsg->msg_opt[i].opt_type==OPT_IANA){
+			b=id?bindfind(id->opt_duid.duid,id->opt_duid.len,rmsg->msg_opt[i].opt_iana.iaid):0;
+			if(b && b->slot==BIND_NOSLOT)bindrelease(b);
+			continue;
+		}
+		if(rmsg->msg_opt[i].opt_type!=OPT_IAPD)continue;
+		b=id?bindfind(id->opt_duid.duid,id->opt_duid.len,rmsg->msg_opt[i].opt_iapd.iaid):0;
+		if(b){
+			if(rmsg->msg_type==MSG_DECLINE)
+				td_log(LOGWARN,"client declined prefix of pool slot %u",b->slot);
+			bindrelease(b);
+		}else if(bindhaspool()){
+			p=messageaddopt(smsg,OPT_IAPD);
+			smsg->msg_opt[p].opt_iapd.iaid=rmsg->msg_opt[i].opt_iapd.iaid;
+			iastatus(&smsg->msg_opt[p],STAT_NoBinding,"no binding for this IA");
+		}
+	}
+	msgstatus(smsg,STAT_Success,rmsg->msg_type==MSG_DECLINE?"declined":"released");
+	sendreply(rmsg,smsg);
+}
+
+/*returns true if addr is one of the n entries of list*/
+static bool inlist(struct in6_addr*addr,struct in6_addr*list,int n)
+{
+	int i;
+	for(i=0;i<n;i++)
+		if(Memcmp(addr,&list[i],16)==0)return true;
+	return false;
+}
+
+/*CONFIRM: check whether the client's addresses and prefixes still fit*/
+static void handleconfirm(struct dhcp_msg*rmsg)
+{
+	struct dhcp_msg*smsg;
+	struct dhcp_opt*ia,*o;
+	int i,k,cnt=0,ok=1;
+	for(i=0;i<rmsg->msg_numopts;i++){
+		ia=&rmsg->msg_opt[i];
+		if(ia->opt_type!=OPT_IANA && ia->opt_type!=OPT_IAPD)continue;
+		for(k=0;k<ia->opt_numopts;k++){
+			o=&ia->subopt[k];
+			if(o->opt_type==OPT_IAADDR){
+				cnt++;
+				if(!inlist(&o->opt_iaaddress.addr,cfg->addresses,cfg->addresscnt))ok=0;
+			}else if(o->opt_type==OPT_IAPREFIX){
+				cnt++;
+				if(!inlist(&o->opt_iaprefix.prefix,cfg->prefixes,cfg->prefixcnt) &&
+				   bindprefixslot(&o->opt_iaprefix.prefix)==BIND_NOSLOT)ok=0;
+			}
+		}
+	}
+	/*nothing to confirm: stay silent*/
+	if(!cnt){
+		freemessage(rmsg);
+		return;
+	}
+	smsg=newreply(rmsg,MSG_REPLY);
+	if(ok)msgstatus(smsg,STAT_Success,"all addresses on link");
+	else msgstatus(smsg,STAT_NotOnLink,"addresses not on link");
+	sendreply(rmsg,smsg);
+}
+
+/*parse the response message and manipulate the send message*/
+static void handlemessage(struct dhcp_msg*rmsg)
+{
+	int i,j,p,rapid,commit,request,bound=0;
+	struct dhcp_msg*smsg;
+	struct binding*b;
+	if(rmsg->msg_numrelay){
+		char tmp[128];
+		td_log(LOGDEBUG,"message relayed by %i agent(s), link %s",rmsg->msg_numrelay,
+			inet_ntop(AF_INET6,&rmsg->msg_relay[rmsg->msg_numrelay-1].linkaddr,tmp,sizeof(tmp)));
+	}
+	/*messages meant for another server*/
+	switch(rmsg->msg_type){
+		case MSG_REQUEST:case MSG_RENEW:case MSG_RELEASE:case MSG_DECLINE:
+			if(!forus(rmsg)){
+				td_log(LOGDEBUG,"ignoring message for another server");
+				freemessage(rmsg);
+				return;
+			}
+			break;
+	}
+	switch(rmsg->msg_type){
+		/*leasequeries have their own reply format*/
+		case MSG_LEASEQUERY:
+			lqhandlemessage(rmsg);
+			return;
+		case MSG_RELEASE:case MSG_DECLINE:
+			handlerelease(rmsg);
+			return;
+		case MSG_DHCP_CONFIRM:
+			handleconfirm(rmsg);
+			return;
+	}
+	/*new IAs wait for the IPAM, the message comes back here with the answers*/
+	if(ipampark(rmsg))return;
+	/*create reply: a SOLICIT is only committed with rapid commit*/
+	rapid=rmsg->msg_type==MSG_SOLICIT && cfg->userapid && messagefindoption(rmsg,OPT_RAPIDCOMMIT)>=0;
+	commit=rmsg->msg_type!=MSG_SOLICIT || rapid;
+	request=rmsg->msg_type==MSG_REQUEST;
+	smsg=newreply(rmsg,commit?MSG_REPLY:MSG_ADVERTISE);
+	if(rapid)
 		messageaddopt(smsg,OPT_RAPIDCOMMIT);
+	if(haveunicast){
+		p=messageaddopt(smsg,OPT_UNICAST);
+		Memcpy(&smsg->msg_opt[p].opt_unicast.addr,&unicastaddr,16);
+	}
 	/*find DNS info*/
-	if(dnsservercnt && messagehasoptionrequest(rmsg,OPT_DNS_SERVER)){
+	if(cfg->dnsservercnt && messagehasoptionrequest(rmsg,OPT_DNS_SERVER)){
 		p=messageaddopt(smsg,OPT_DNS_SERVER);
-		smsg->msg_opt[p].opt_dns_server.num_dns=dnsservercnt;
-		smsg->msg_opt[p].opt_dns_server.addr=Malloc(dnsservercnt*sizeof(struct in6_addr));
-		Memcpy(smsg->msg_opt[p].opt_dns_server.addr,dnsservers,dnsservercnt*sizeof(struct in6_addr));
+		smsg->msg_opt[p].opt_dns_server.num_dns=cfg->dnsservercnt;
+		smsg->msg_opt[p].opt_dns_server.addr=Malloc(cfg->dnsservercnt*sizeof(struct in6_addr));
+		Memcpy(smsg->msg_opt[p].opt_dns_server.addr,cfg->dnsservers,cfg->dnsservercnt*sizeof(struct in6_addr));
 	}
-	if(dnsnamecnt && messagehasoptionrequest(rmsg,OPT_DNS_NAME)){
+	if(cfg->dnsnamecnt && messagehasoptionrequest(rmsg,OPT_DNS_NAME)){
 		p=messageaddopt(smsg,OPT_DNS_NAME);
-		smsg->msg_opt[p].opt_dns_name.num_dns=dnsnamecnt;
-		smsg->msg_opt[p].opt_dns_name.namelist=Malloc(dnsnamecnt*sizeof(char*));
-		for(i=0;i<dnsnamecnt;i++){
-			smsg->msg_opt[p].opt_dns_name.namelist[i]=Malloc(strlen(dnsnames[i])+1);
-			Strcpy(smsg->msg_opt[p].opt_dns_name.namelist[i],dnsnames[i]);
+		smsg->msg_opt[p].opt_dns_name.num_dns=cfg->dnsnamecnt;
+		smsg->msg_opt[p].opt_dns_name.namelist=Malloc(cfg->dnsnamecnt*sizeof(char*));
+		for(i=0;i<cfg->dnsnamecnt;i++){
+			smsg->msg_opt[p].opt_dns_name.namelist[i]=Malloc(strlen(cfg->dnsnames[i])+1);
+			Strcpy(smsg->msg_opt[p].opt_dns_name.namelist[i],cfg->dnsnames[i]);
 		}
 	}
 	/*find PREFIX info*/
-	if(prefixcnt && (j=messagefindoption(rmsg,OPT_IAPD))>=0){
+	if((cfg->prefixcnt || bindhaspool()) && (j=messagefindoption(rmsg,OPT_IAPD))>=0){
 		struct dhcp_opt pref;
 		Memzero(&pref,sizeof(pref));
 		/*create opt, copy IAID*/
 		p=messageaddopt(smsg,OPT_IAPD);
 		smsg->msg_opt[p].opt_iapd.iaid=rmsg->msg_opt[j].opt_iapd.iaid;
+		iatimers(&smsg->msg_opt[p]);
 		/*insert prefixes*/
 		pref.opt_type=OPT_IAPREFIX;
-		pref.opt_iaprefix.preferred_lifetime=0xffffffff;
-		pref.opt_iaprefix.valid_lifetime=0xffffffff;
-		for(i=0;i<prefixcnt;i++){
-			pref.opt_iaprefix.prefixlen=prefixlens[i];
-			Memcpy(&pref.opt_iaprefix.prefix,&prefixes[i],16);
+		pref.opt_iaprefix.preferred_lifetime=cfg->lifetime?cfg->lifetime:0xffffffff;
+		pref.opt_iaprefix.valid_lifetime=cfg->lifetime?cfg->lifetime:0xffffffff;
+		if(bindhaspool()){
+			/*one prefix out of the pool per client;
+			  SOLICIT only gets an offer, the binding is made when the REQUEST quotes it*/
+			unsigned int slot=BIND_NOSLOT;
+			int renew=rmsg->msg_type==MSG_RENEW || rmsg->msg_type==MSG_REBIND;
+			if(!commit)
+				slot=clientoffer(rmsg,rmsg->msg_opt[j].opt_iapd.iaid);
+			else if((b=renew?clientrenew(rmsg,&rmsg->msg_opt[j]):clientbinding(rmsg,&rmsg->msg_opt[j]))!=0){
+				slot=b->slot;
+				bound++;
+				reconfbind(b,rmsg,smsg);
+			}
+			if(slot!=BIND_NOSLOT){
+				pref.opt_iaprefix.prefixlen=bindpoollen();
+				bindslotprefix(slot,&pref.opt_iaprefix.prefix);
+				optappendopt(&smsg->msg_opt[p],&pref);
+			}else if(renew)
+				iastatus(&smsg->msg_opt[p],STAT_NoBinding,"no binding for this IA");
+			else
+				iastatus(&smsg->msg_opt[p],STAT_NoPrefixAvail,"no prefixes available");
+		}else
+		for(i=0;i<cfg->prefixcnt;i++){
+			bound++;
+			pref.opt_iaprefix.prefixlen=cfg->prefixlens[i];
+			Memcpy(&pref.opt_iaprefix.prefix,&cfg->prefixes[i],16);
 			optappendopt(&smsg->msg_opt[p],&pref);
 		}
 	}
 	/*find IANA info*/
-	if(addresscnt && (j=messagefindoption(rmsg,OPT_IANA))>=0){
+	if(cfg->addresscnt && (j=messagefindoption(rmsg,OPT_IANA))>=0){
 		struct dhcp_opt addr;
 		Memzero(&addr,sizeof(addr));
 		/*create opt, copy IAID*/
 		p=messageaddopt(smsg,OPT_IANA);
 		smsg->msg_opt[p].opt_iana.iaid=rmsg->msg_opt[j].opt_iana.iaid;
+		iatimers(&smsg->msg_opt[p]);
 		/*insert prefixes*/
 		addr.opt_type=OPT_IAADDR;
-		addr.opt_iaaddress.preferred_lifetime=0xffffffff;
-		addr.opt_iaaddress.valid_lifetime=0xffffffff;
-		for(i=0;i<addresscnt;i++){
-			Memcpy(&addr.opt_iaaddress.addr,&addresses[i],16);
+		addr.opt_iaaddress.preferred_lifetime=cfg->lifetime?cfg->lifetime:0xffffffff;
+		addr.opt_iaaddress.valid_lifetime=cfg->lifetime?cfg->lifetime:0xffffffff;
+		for(i=0;i<cfg->addresscnt;i++){
+			bound++;
+			Memcpy(&addr.opt_iaaddress.addr,&cfg->addresses[i],16);
 			optappendopt(&smsg->msg_opt[p],&addr);
 		}
 	}
-	/*free received msg*/
-	freemessage(rmsg);
-	/*send*/
-	sendmessage(smsg);
-	/*free sent msg*/
-	freemessage(smsg);
+	if(commit && bound && !bindhaspool())
+		staticreconf(rmsg,smsg);
+	/*only completed exchanges count: something was bound and the reply went out*/
+	if(sendreply(rmsg,smsg)==0 && bound){
+		if(rapid)twomsgcnt++;
+		else if(request)fourmsgcnt++;
+	}
+}
+
+/*sets the unicast address*/
+static int setunicast(const char*a)
+{
+	if(inet_pton(AF_INET6,a,&unicastaddr)<=0 || IN6_IS_ADDR_LINKLOCAL(&unicastaddr) || IN6_IS_ADDR_MULTICAST(&unicastaddr)){
+		td_log(LOGERROR,"unicast address %s must be a global IPv6 address",a);
+		return -1;
+	}
+	haveunicast=1;
+	return 0;
+}
+
+/*returns true if clients may send this message directly to the unicast address*/
+static bool unicastallowed(struct dhcp_msg*msg)
+{
+	/*the relays take care of multicast*/
+	if(msg->msg_numrelay)return true;
+	switch(msg->msg_type){
+		case MSG_REQUEST:case MSG_RENEW:case MSG_RELEASE:case MSG_DECLINE:
+		case MSG_IREQUEST:case MSG_LEASEQUERY:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*log counters*/
+void serverstats()
+{
+	unsigned long long lookups,hits;
+	td_log(LOGINFO,"statistics: %llu bindings, %llu rapid commit (2 message) and %llu 4 message exchanges",
+		(unsigned long long)bindcount(),twomsgcnt,fourmsgcnt);
+	rcstats(&lookups,&hits);
+	td_log(LOGINFO,"statistics: reply cache %llu hits of %llu lookups (%.1f%%)",
+		hits,lookups,lookups?hits*100.0/lookups:0.0);
+	eventstats();
+	ipamstats();
+}
+
+int serveroption(int c,const char*arg)
+{
+	inititems();
+	switch(c){
+		case 'p':return addprefix(arg)<0?-1:0;
+		case 'a':return addaddr(&setup->addresses,&setup->addresscnt,arg,"address")<0?-1:0;
+		case 'd':return addaddr(&setup->dnsservers,&setup->dnsservercnt,arg,"DNS server address")<0?-1:0;
+		case 'D':return adddomain(arg)<0?-1:0;
+		case 'l':localid=(char*)arg;break;
+		case 'u':setduid(arg);break;
+		case 'L':setloglevel(arg);break;
+		case 'o':return setpool(arg);
+		case 's':shmname=(char*)arg;break;
+		case 'b':maxbindings=atoi(arg);break;
+		case 'n':clustersetnode(arg);break;
+		case 'N':clusteraddnode(arg);break;
+		case 'R':return replsetlisten(arg);
+		case 'S':return replsetprimary(arg);
+		case 'T':replsettakeover(atoi(arg));break;
+		case 'x':replsetfence(arg);break;
+		case 'q':lqenable();break;
+		case 'Q':return lqsetbulk(arg);
+		case 'A':return lqallow(arg);
+		case 'c':setup->userapid=1;break;
+		case 'C':setup->userapid=0;break;
+		case 'U':return setunicast(arg);
+		case 'k':rcachesize=atoi(arg);break;
+		case 'r':reconfsetrate(atoi(arg));break;
+		case 't':setup->lifetime=atol(arg);if(setup->lifetime<0)setup->lifetime=0;break;
+		case 'i':routeenable();break;
+		case 'e':eventsetsocket(arg);break;
+		case 'I':ipamsetsocket(arg);break;
+		default:return 1;
+	}
+	return 0;
+}
+
+/*seconds between two sweeps over the binding table*/
+#define REAPINTERVAL 60
+static long long lastreap;
+
+int serverinit(const char*dev)
+{
+	int i;
+	/*the settings given so far become active*/
+	if(!cfg){
+		inititems();
+		cfg=setup;
+		setup=0;
+	}
+	/*check for DUID*/
+	if(DUIDLEN==0){
+		if(localid)
+			setlocalid(localid);
+		else
+			initlocalid(1);
+	}
+	/*attach bindings (after the fork, bindings remember our PID)*/
+	if(bindinit(shmname,poollen?&poolprefix:0,poollen,poolplen,maxbindings)<0){
+		td_log(LOGERROR,"unable to initialize binding table.");
+		return -1;
+	}
+	if(clusterinit()<0){
+		td_log(LOGERROR,"unable to initialize cluster mode.");
+		return -1;
+	}
+	if(replinit()<0){
+		td_log(LOGERROR,"unable to initialize replication.");
+		return -1;
+	}
+	if(lqinit()<0){
+		td_log(LOGERROR,"unable to initialize bulk leasequery.");
+		return -1;
+	}
+	/*static prefixes go to whoever is on the link*/
+	if(routeenabled() && !poollen)
+		for(i=0;i<cfg->prefixcnt;i++)
+			routestatic(&cfg->prefixes[i],cfg->prefixlens[i]);
+	if(routeinit(dev)<0){
+		td_log(LOGERROR,"unable to initialize routes.");
+		return -1;
+	}
+	if(eventinit(dev)<0){
+		td_log(LOGERROR,"unable to open event socket.");
+		return -1;
+	}
+	if(ipaminit(dev,handlemessage)<0){
+		td_log(LOGERROR,"unable to initialize IPAM.");
+		return -1;
+	}
+	/*init socket*/
+	initsocket(DHCP_SERVERPORT,dev);
+	if(sockfd<0){
+		td_log(LOGERROR,"unable to allocate socket.");
+		return -1;
+	}
+	joindhcp();
+	if(sockfd<0){
+		td_log(LOGERROR,"unable to joind DHCP multicast group.");
+		return -1;
+	}
+	if(haveunicast){
+		ucastfd=initunicast(&unicastaddr,DHCP_SERVERPORT);
+		if(ucastfd<0){
+			td_log(LOGERROR,"unable to open unicast socket.");
+			return -1;
+		}
+	}
+	/*answer retransmissions from the cache*/
+	rcinit(rcachesize);
+	setrecvhook(rcreply);
+	/*init filter*/
+	clearrecvfilter();
+	addrecvfilter(MSG_SOLICIT);
+	addrecvfilter(MSG_REQUEST);
+	addrecvfilter(MSG_IREQUEST);
+	addrecvfilter(MSG_DHCP_CONFIRM);
+	addrecvfilter(MSG_RENEW);
+	addrecvfilter(MSG_REBIND);
+	addrecvfilter(MSG_RELEASE);
+	addrecvfilter(MSG_DECLINE);
+	/*relay agents usually talk to us from global addresses*/
+	addrecvfilter(MSG_RELAY_FORW);
+	addglobalfilter(MSG_RELAY_FORW);
+	if(lqenabled()){
+		/*requestors are usually not on the link*/
+		addrecvfilter(MSG_LEASEQUERY);
+		addglobalfilter(MSG_LEASEQUERY);
+	}
+	lastreap=time(0);
+	return 0;
+}
+
+int serverfdset(fd_set*rfd,fd_set*wfd,fd_set*xfd,int maxfd)
+{
+	FD_SET(sockfd,rfd);
+	FD_SET(sockfd,xfd);
+	if(sockfd>maxfd)maxfd=sockfd;
+	if(ucastfd>=0){
+		FD_SET(ucastfd,rfd);
+		if(ucastfd>maxfd)maxfd=ucastfd;
+	}
+	maxfd=replfdset(rfd,wfd,maxfd);
+	maxfd=lqfdset(rfd,wfd,maxfd);
+	maxfd=eventfdset(rfd,wfd,maxfd);
+	maxfd=ipamfdset(rfd,wfd,maxfd);
+	return maxfd;
+}
+
+int servertimeout()
+{
+	/*pace RECONFIGURE in small steps*/
+	return reconfactive()?10:1000;
+}
+
+int serverpoll(fd_set*rfd,fd_set*wfd,fd_set*xfd)
+{
+	if(FD_ISSET(sockfd,rfd)){
+		struct dhcp_msg*msg2;
+		msg2=readmessage();
+		if(msg2){
+			/*a standby stays silent while the primary is alive*/
+			if(replpassive())
+				freemessage(msg2);
+			else
+				handlemessage(msg2);
+		}
+	}
+	if(ucastfd>=0 && FD_ISSET(ucastfd,rfd)){
+		struct dhcp_msg*msg2;
+		msg2=readmessagefrom(ucastfd,1);
+		if(msg2){
+			if(replpassive())
+				freemessage(msg2);
+			else if(!unicastallowed(msg2)){
+				td_log(LOGINFO,"message of type %i must not be sent via unicast, dropping it",(int)msg2->msg_type);
+				freemessage(msg2);
+			}else
+				handlemessage(msg2);
+		}
+	}
+	if(FD_ISSET(sockfd,xfd)){
+		td_log(LOGERROR,"Exception on socket caught.");
+		return -1;
+	}
+	replpoll(rfd,wfd);
+	lqpoll(rfd,wfd);
+	eventpoll(rfd,wfd);
+	ipampoll(rfd,wfd);
+	return 0;
+}
+
+int servertimer()
+{
+	long long now;
+	//check that the interface still exists
+	if(!checkiface()){
+		td_log(LOGERROR,"Interface lost.");
+		return -1;
+	}
+	//clean up the binding table once in a while
+	now=time(0);
+	repltimer(now);
+	lqtimer(now);
+	ipamtimer(now);
+	if(now-lastreap>=REAPINTERVAL && !replpassive()){
+		bindreap(now);
+		lastreap=now;
+	}
+	reconftimer();
+	routetimer(now);
+	/*one netlink batch for all route changes of this iteration*/
+	routeflush();
+	eventflush();
+	return 0;
+}
+
+void serverdone()
+{
+	if(sockfd>=0)close(sockfd);
+	if(ucastfd>=0)close(ucastfd);
+	sockfd=ucastfd=-1;
+	ipamdone();
+	binddone();
+	/*shared bindings released by binddone*/
+	routeflush();
+	eventdone();
+}
+
+#ifndef TDHCP_PLUGIN
+/*options of the config file that a reload may change*/
+#define RELOADOPTS "padDtcCL"
+
+/*settings and log level from the command line, the config file is applied on top of them*/
+static struct srvconfig*cmdline=0;
+static int cmdloglevel;
+/*options of the config file that only take effect at startup, as "\nname value\n" lines*/
+static char*fixedopts=0;
+
+/*returns a copy of len bytes at p, NULL for none*/
+static void* copyitems(void*p,int len)
+{
+	void*r;
+	if(len<=0)return 0;
+	r=Malloc(len);
+	Memcpy(r,p,len);
+	return r;
+}
+
+static void freeconfig(struct srvconfig*c)
+{
+	int i;
+	if(!c)return;
+	for(i=0;i<c->dnsnamecnt;i++)Free(c->dnsnames[i]);
+	Free(c->dnsnames);
+	Free(c->addresses);
+	Free(c->prefixes);
+	Free(c->prefixlens);
+	Free(c->dnsservers);
+	Free(c);
+}
+
+static struct srvconfig* copyconfig(struct srvconfig*c)
+{
+	struct srvconfig*n=newconfig();
+	int i;
+	Memcpy(n,c,sizeof(struct srvconfig));
+	n->addresses=copyitems(c->addresses,c->addresscnt*sizeof(struct in6_addr));
+	n->prefixes=copyitems(c->prefixes,c->prefixcnt*sizeof(struct in6_addr));
+	n->prefixlens=copyitems(c->prefixlens,c->prefixcnt);
+	n->dnsservers=copyitems(c->dnsservers,c->dnsservercnt*sizeof(struct in6_addr));
+	n->dnsnames=copyitems(c->dnsnames,c->dnsnamecnt*sizeof(char*));
+	for(i=0;i<c->dnsnamecnt;i++)
+		n->dnsnames[i]=copyitems(c->dnsnames[i],strlen(c->dnsnames[i])+1);
+	return n;
+}
+
+/*returns true if the settings differ in what clients get: prefixes,
+  addresses, DNS settings or lifetimes*/
+static bool clientconfigdiffers(struct srvconfig*a,struct srvconfig*b)
+{
+	int i;
+	if(a->prefixcnt!=b->prefixcnt || a->addresscnt!=b->addresscnt ||
+	   a->dnsservercnt!=b->dnsservercnt || a->dnsnamecnt!=b->dnsnamecnt || a->lifetime!=b->lifetime)
+		return true;
+	if(Memcmp(a->prefixes,b->prefixes,a->prefixcnt*sizeof(struct in6_addr)) ||
+	   Memcmp(a->prefixlens,b->prefixlens,a->prefixcnt) ||
+	   Memcmp(a->addresses,b->addresses,a->addresscnt*sizeof(struct in6_addr)) ||
+	   Memcmp(a->dnsservers,b->dnsservers,a->dnsservercnt*sizeof(struct in6_addr)))
+		return true;
+	for(i=0;i<a->dnsnamecnt;i++)
+		if(strcmp(a->dnsnames[i],b->dnsnames[i])!=0)return true;
+	return false;
+}
+
+/*returns the short option for a long option name, 0 if there is none*/
+static int optionchar(const char*name,int*hasarg)
+{
+	int i;
+	for(i=0;longopt[i].name;i++)
+		if(strcmp(longopt[i].name,name)==0){
+			*hasarg=longopt[i].has_arg;
+			return longopt[i].val;
+		}
+	return 0;
+}
+
+/*reads the config file into the settings being set up; a reload skips options that
+  need a restart; returns 0 on success, -1 if the file is missing or has errors*/
+static int readconfig(int reload)
+{
+	FILE*f;
+	char line[1024],opt[2*sizeof(line)+4],*name,*val,*e;
+	int c,hasarg,l,ln=0,ret=0;
+	f=fopen(configfile,"r");
+	if(!f){
+		td_log(LOGERROR,"cannot read config file %s: %s",configfile,strerror(errno));
+		return -1;
+	}
+	while(fgets(line,sizeof(line),f)){
+		ln++;
+		/*strip comment and white space*/
+		if((e=strchr(line,'#'))!=0)*e=0;
+		for(e=line+strlen(line);e>line && isspace((unsigned char)e[-1]);e--);
+		*e=0;
+		for(name=line;isspace((unsigned char)*name);name++);
+		if(!*name)continue;
+		/*split "name value" or "name=value"*/
+		for(val=name;*val && *val!='=' && !isspace((unsigned char)*val);val++);
+		if(*val){
+			*val++=0;
+			while(isspace((unsigned char)*val) || *val=='=')val++;
+		}
+		c=optionchar(name,&hasarg);
+		if(!c || c=='f' || c=='P' || c=='h' || c=='F'){
+			td_log(LOGERROR,"%s:%i: unknown option \"%s\" (use the long option names)",configfile,ln,name);
+			ret=-1;
+			continue;
+		}
+		if(hasarg!=(*val!=0)){
+			td_log(LOGERROR,"%s:%i: option %s %s",configfile,ln,name,hasarg?"needs a value":"takes no value");
+			ret=-1;
+			continue;
+		}
+		if(!strchr(RELOADOPTS,c)){
+			snprintf(opt,sizeof(opt),"\n%s %s\n",name,val);
+			if(reload){
+				/*already in effect since startup, or a change that needs a restart*/
+				if(!fixedopts || !strstr(fixedopts,opt))
+					td_log(LOGWARN,"%s:%i: option %s can only be changed by a restart, ignoring it",configfile,ln,name);
+				continue;
+			}
+			l=fixedopts?strlen(fixedopts):0;
+			fixedopts=Realloc(fixedopts,l+strlen(opt)+1);
+			Strcpy(fixedopts+l,opt);
+		}
+		c=serveroption(c,val);
+		if(c!=0){
+			td_log(LOGERROR,"%s:%i: invalid value for option %s",configfile,ln,name);
+			ret=-1;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+
+/*SIGHUP: reads the config file again and swaps in the new settings between two
+  messages; sockets, bindings and the pool stay as they are*/
+static void reloadconfig()
+{
+	struct srvconfig*old;
+	int oldlevel=loglevel,changed;
+	if(!configfile){
+		td_log(LOGINFO,"SIGHUP: no config file to reload");
+		return;
+	}
+	/*parse into a copy of the command line settings, the active ones stay in use*/
+	freeconfig(setup);
+	setup=copyconfig(cmdline);
+	loglevel=cmdloglevel;
+	if(readconfig(1)<0){
+		loglevel=oldlevel;
+		td_log(LOGERROR,"errors in %s, keeping the old settings",configfile);
+		freeconfig(setup);
+		setup=0;
+		return;
+	}
+	old=cfg;
+	cfg=setup;
+	setup=0;
+	changed=clientconfigdiffers(old,cfg);
+	freeconfig(old);
+	/*cached replies carry the old settings*/
+	rcinit(rcachesize);
+	if(routeenabled() && !poollen)
+		routereplacestatic(cfg->prefixes,cfg->prefixlens,cfg->prefixcnt);
+	td_log(LOGINFO,"reloaded %s: %i prefixes, %i addresses, %i DNS servers, %i domains",configfile,
+		cfg->prefixcnt,cfg->addresscnt,cfg->dnsservercnt,cfg->dnsnamecnt);
+	/*clients that accept it pick the changes up right away*/
+	if(changed && !replpassive())reconfstart();
+}
+
+/*termination signals: leave the main loop so bindings get released;
+  SIGUSR1: log statistics; SIGUSR2: reconfigure all clients; SIGHUP: reload the config file*/
+static void sighandler(int sig)
+{
+	if(sig==SIGUSR1)dostats=1;
+	else if(sig==SIGUSR2)doreconf=1;
+	else if(sig==SIGHUP)doreload=1;
+	else doexit=1;
 }
 
 /*switch to daemon mode*/
@@ -334,24 +1232,22 @@ int main(int argc,char**argv)
                 c=getopt_long(argc,argv,shortopt,longopt,&optindex);
                 if(c==-1)break;
                 switch(c){
-                        case 'p':addprefix(optarg);break;
-                        case 'a':addaddr(addresses,optarg,"address");break;
-                        case 'd':addaddr(dnsservers,optarg,"DNS server address");break;
-                        case 'D':adddomain(optarg);break;
-                        case 'l':localid=optarg;break;
-                        case 'u':setduid(optarg);break;
-                        case 'L':setloglevel(optarg);break;
                         case 'f':dofork=0;break;
                         case 'P':pidfile=optarg;break;
-                        default:
-                                fprintf(stderr,"Syntax error in arguments.\n");
-                                printhelp();
-                                return 1;
-                                break;
+                        case 'F':configfile=optarg;break;
                         case 'h':
                                 printhelp();
                                 return 0;
                                 break;
+                        default:
+                                c=serveroption(c,optarg);
+                                if(c<0)return 1;
+                                if(c>0){
+                                        fprintf(stderr,"Syntax error in arguments.\n");
+                                        printhelp();
+                                        return 1;
+                                }
+                                break;
                 }
         }
         if((optind+1)!=argc){
@@ -360,72 +1256,79 @@ int main(int argc,char**argv)
         	return 1;
 	}
 	device=argv[optind];
-	/*check for DUID*/
-	if(DUIDLEN==0){
-		if(localid)
-			setlocalid(localid);
-		else
-			initlocalid();
+	/*the config file adds to the command line, reloads start again from the command line*/
+	if(configfile){
+		char path[PATH_MAX];
+		cmdline=copyconfig(setup);
+		cmdloglevel=loglevel;
+		if(readconfig(0)<0)return 1;
+		/*the daemon changes to the root directory*/
+		if(realpath(configfile,path)){
+			configfile=Malloc(strlen(path)+1);
+			Strcpy(configfile,path);
+		}
 	}
-	/*count my options*/
-	countitems();
 	/*switch to daemon mode*/
 	daemonize();
-	/*init socket*/
-	initsocket(DHCP_SERVERPORT,device);
-	if(sockfd<0){
-		td_log(LOGERROR,"unable to allocate socket, exiting.");
+	/*exit handlers run backwards: withdraw the routes of released bindings last*/
+	atexit(routeflush);
+	atexit(eventdone);
+	atexit(binddone);
+	if(serverinit(device)<0){
+		td_log(LOGERROR,"exiting.");
 		return 1;
 	}
-	joindhcp();
-	if(sockfd<0){
-		td_log(LOGERROR,"unable to joind DHCP multicast group, exiting.");
-		return 1;
-	}
-	/*init filter*/
-	clearrecvfilter();
-	addrecvfilter(MSG_SOLICIT);
-	addrecvfilter(MSG_REQUEST);
-	addrecvfilter(MSG_IREQUEST);
+	signal(SIGTERM,sighandler);
+	signal(SIGINT,sighandler);
+	signal(SIGUSR1,sighandler);
+	signal(SIGUSR2,sighandler);
+	signal(SIGHUP,sighandler);
 	/*start main loop*/
-	while(1){
-		fd_set rfd,xfd;
-		int sret;
+	while(!doexit){
+		fd_set rfd,wfd,xfd;
+		int sret,maxfd,wait;
 		struct timeval tv;
 		//wait for event
 		FD_ZERO(&rfd);
+		FD_ZERO(&wfd);
 		FD_ZERO(&xfd);
-		FD_SET(sockfd,&rfd);
-		FD_SET(sockfd,&xfd);
-		tv.tv_sec=1;tv.tv_usec=0;
-		sret=select(sockfd+1,&rfd,0,&xfd,&tv);
+		maxfd=serverfdset(&rfd,&wfd,&xfd,-1);
+		wait=servertimeout();
+		tv.tv_sec=wait/1000;
+		tv.tv_usec=(wait%1000)*1000;
+		sret=select(maxfd+1,&rfd,&wfd,&xfd,&tv);
 		//check for errors
 		if(sret<0){
 			int e=errno;
-			if(e==EAGAIN)continue;
-			td_log(LOGERROR,"Error caught: %s",strerror(e));
-			return 1;
-		}
-		//check for event
-		if(sret>0){
-			if(FD_ISSET(sockfd,&rfd)){
-				struct dhcp_msg*msg2;
-				msg2=readmessage();
-				if(msg2)
-					handlemessage(msg2);
-			}
-			if(FD_ISSET(sockfd,&xfd)){
-				td_log(LOGERROR,"Exception on socket caught.");
+			if(e!=EAGAIN && e!=EINTR){
+				td_log(LOGERROR,"Error caught: %s",strerror(e));
 				return 1;
 			}
+			/*a signal: go on to the flags below*/
+			sret=0;
+		}
+		//check for event
+		if(sret>0 && serverpoll(&rfd,&wfd,&xfd)<0)
+			return 1;
+		if(dostats){
+			dostats=0;
+			serverstats();
+		}
+		if(doreconf){
+			doreconf=0;
+			if(!replpassive())reconfstart();
+		}
+		if(doreload){
+			doreload=0;
+			reloadconfig();
 		}
-		//check that the interface still exists
-		if(!checkiface()){
-			td_log(LOGERROR,"Interface lost, exiting.");
+		if(servertimer()<0){
+			td_log(LOGERROR,"exiting.");
 			return 1;
 		}
 	}
-	/*should not be reachable*/
-	td_log(LOGDEBUG,"hmm, Konrad needs better coffee - this line should not be reachable");
+	td_log(LOGINFO,"terminating on signal");
+	serverstats();
 	return 0;
 }
+#endif
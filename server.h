@@ -0,0 +1,37 @@
+/*
+// C Interface: server
+//
+// Description: DHCPv6 server core, driven by tdhcpd or by a host program (pppd plugin)
+//
+//
+// Author: Konrad Rosenbaum <konrad@silmor.de>, (C) 2009
+//
+// Copyright: See COPYING file that comes with this distribution
+//
+*/
+
+#ifndef TDHCP_SERVER_H
+#define TDHCP_SERVER_H
+
+#include <sys/select.h>
+
+/*applies a server option by its tdhcpd short option character, the string must stay valid;
+  returns 0 on success, -1 on a bad argument, 1 if the option is unknown*/
+int serveroption(int opt,const char*arg);
+
+/*sets up DUID, bindings and the socket on dev; returns 0 on success, -1 on error*/
+int serverinit(const char*dev);
+/*adds the server sockets to the select sets, returns the new maximum fd*/
+int serverfdset(fd_set*rfd,fd_set*wfd,fd_set*xfd,int maxfd);
+/*handles socket events after select, returns -1 if the server socket failed*/
+int serverpoll(fd_set*rfd,fd_set*wfd,fd_set*xfd);
+/*housekeeping, call after every poll; returns -1 if the interface is gone*/
+int servertimer();
+/*maximum time in milliseconds until servertimer should run again*/
+int servertimeout();
+/*logs binding and cache counters*/
+void serverstats();
+/*closes the sockets and releases the bindings*/
+void serverdone();
+
+#endif
@@ -21,6 +21,10 @@
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <ifaddrs.h>
+#include <sys/select.h>
+#include <time.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 
 #include <errno.h>
 #include <string.h>
@@ -58,6 +62,107 @@ static void get_if_lladdr(const char*dev,struct sockaddr_in6*sa)
 	freeifaddrs(ifa);
 }
 
+/*returns true if a netlink address message announces a usable link-local address on dev*/
+static int lladdrready(const char*dev,struct ifaddrmsg*ifa,int len)
+{
+	struct rtattr*rta;
+	struct in6_addr*addr=0;
+	unsigned int flags=ifa->ifa_flags;
+	char name[IF_NAMESIZE];
+	if(ifa->ifa_family!=AF_INET6)return 0;
+	for(rta=IFA_RTA(ifa);RTA_OK(rta,len);rta=RTA_NEXT(rta,len)){
+		if(rta->rta_type==IFA_ADDRESS)addr=RTA_DATA(rta);
+		if(rta->rta_type==IFA_FLAGS)flags=*(unsigned int*)RTA_DATA(rta);
+	}
+	if(!addr || !IN6_IS_ADDR_LINKLOCAL(addr))return 0;
+	/*still doing DAD or DAD failed: the address cannot be bound yet*/
+	if(flags&(IFA_F_TENTATIVE|IFA_F_DADFAILED))return 0;
+	/*the device may have been created after we started, so compare names*/
+	if(!if_indextoname(ifa->ifa_index,name) || strcmp(name,dev)!=0)return 0;
+	return 1;
+}
+
+/*asks the kernel for all IPv6 addresses*/
+static int lladdrdump(int fd)
+{
+	struct {
+		struct nlmsghdr nh;
+		struct ifaddrmsg ifa;
+	} req;
+	Memzero(&req,sizeof(req));
+	req.nh.nlmsg_len=NLMSG_LENGTH(sizeof(struct ifaddrmsg));
+	req.nh.nlmsg_type=RTM_GETADDR;
+	req.nh.nlmsg_flags=NLM_F_REQUEST|NLM_F_DUMP;
+	req.ifa.ifa_family=AF_INET6;
+	return send(fd,&req,req.nh.nlmsg_len,0);
+}
+
+int waitlladdr(char*const*devs,int num,int secs)
+{
+	struct sockaddr_nl sa;
+	struct nlmsghdr*nh;
+	struct timespec ts;
+	struct timeval tv;
+	fd_set rfd;
+	long long end,now;
+	int fd,len,i,missing=num;
+	char*ready;
+	static char buf[16384];
+	fd=socket(AF_NETLINK,SOCK_RAW,NETLINK_ROUTE);
+	if(fd<0){
+		td_log(LOGWARN,"Cannot open netlink socket: %s.",strerror(errno));
+		return -1;
+	}
+	/*subscribe first, then dump: no address can slip through in between*/
+	Memzero(&sa,sizeof(sa));
+	sa.nl_family=AF_NETLINK;
+	sa.nl_groups=RTMGRP_IPV6_IFADDR;
+	if(bind(fd,(struct sockaddr*)&sa,sizeof(sa))<0 || lladdrdump(fd)<0){
+		td_log(LOGWARN,"Cannot listen for address events: %s.",strerror(errno));
+		close(fd);
+		return -1;
+	}
+	ready=Malloc(num);
+	if(!ready){
+		close(fd);
+		return num;
+	}
+	Memzero(ready,num);
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	end=ts.tv_sec*1000LL+ts.tv_nsec/1000000+secs*1000LL;
+	while(missing>0){
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		now=ts.tv_sec*1000LL+ts.tv_nsec/1000000;
+		if(now>=end)break;
+		FD_ZERO(&rfd);
+		FD_SET(fd,&rfd);
+		tv.tv_sec=(end-now)/1000;
+		tv.tv_usec=((end-now)%1000)*1000;
+		if(select(fd+1,&rfd,0,0,&tv)<=0)continue;
+		len=recv(fd,buf,sizeof(buf),0);
+		if(len<0){
+			/*events were lost, start over with a new dump*/
+			if(errno==ENOBUFS)lladdrdump(fd);
+			continue;
+		}
+		for(nh=(struct nlmsghdr*)buf;NLMSG_OK(nh,len);nh=NLMSG_NEXT(nh,len)){
+			if(nh->nlmsg_type!=RTM_NEWADDR)continue;
+			for(i=0;i<num;i++)
+				if(!ready[i] && lladdrready(devs[i],NLMSG_DATA(nh),IFA_PAYLOAD(nh))){
+					td_log(LOGDEBUG,"link-local address on %s is ready",devs[i]);
+					ready[i]=1;
+					missing--;
+				}
+		}
+	}
+	close(fd);
+	for(i=0;i<num;i++)
+		if(!ready[i])
+			td_log(LOGWARN,"no usable link-local address on %s after %i seconds",devs[i],secs);
+	Free(ready);
+	return missing;
+}
+
 int checkiface()
 {
 	struct ifreq ifr;
@@ -72,59 +177,64 @@ int checkiface()
 	return 1;
 }
 
-/*initializes the socket on port*/
-void initsocket(short port,const char*dev)
+int initifsocket(short port,const char*dev,int*idx)
 {
 	struct sockaddr_in6 sa;
 	struct ifreq ifr;
-	int val=0;
+	int fd,val=0;
 	//allocate
-	sockfd=socket(PF_INET6,SOCK_DGRAM,0);
-	if(sockfd<0){
+	fd=socket(PF_INET6,SOCK_DGRAM,0);
+	if(fd<0){
 		td_log(LOGERROR,"Error allocating socket: %s.",strerror(errno));
-		close(sockfd);
-		sockfd=-1;
-		return;
+		return -1;
 	}
 	val=1;
-	if(setsockopt(sockfd,IPPROTO_IPV6,IPV6_V6ONLY,&val,sizeof(val))<0){
+	if(setsockopt(fd,IPPROTO_IPV6,IPV6_V6ONLY,&val,sizeof(val))<0){
 		fprintf(stderr,"Warning: cannot restrict socket to IPv6.");
 	}
 	//get interface
 	Memzero(&ifr,sizeof(ifr));
 	Strncpy(ifr.ifr_name,dev,IFNAMSIZ);
-	if(ioctl(sockfd,SIOCGIFINDEX,&ifr)<0){
+	if(ioctl(fd,SIOCGIFINDEX,&ifr)<0){
 		td_log(LOGERROR,"Error getting device index for %s: %s.",dev,strerror(errno));
-		close(sockfd);
-		sockfd=-1;
-		return;
+		close(fd);
+		return -1;
 	}
-	ifindex=ifr.ifr_ifindex;
-	td_log(LOGDEBUG,"Interface %s has index %i.",dev,ifindex);
+	*idx=ifr.ifr_ifindex;
+	td_log(LOGDEBUG,"Interface %s has index %i.",dev,*idx);
 	//set interface for mcast output
-	if(setsockopt(sockfd,IPPROTO_IPV6,IPV6_MULTICAST_IF,&ifindex,sizeof(ifindex))<0){
+	if(setsockopt(fd,IPPROTO_IPV6,IPV6_MULTICAST_IF,idx,sizeof(*idx))<0){
 		td_log(LOGERROR,"Error setting multicast interface: %s.",strerror(errno));
-		close(sockfd);
-		sockfd=-1;
-		return;
+		close(fd);
+		return -1;
 	}
 	//set overall interface
-	if(setsockopt(sockfd,SOL_SOCKET,SO_BINDTODEVICE,dev,strlen(dev))<0){
+	if(setsockopt(fd,SOL_SOCKET,SO_BINDTODEVICE,dev,strlen(dev))<0){
 		td_log(LOGWARN,"Cannot bind to device %s: %s",dev,strerror(errno));
 	}
+	//the server may share the port with its unicast socket
+	if(SIDEID==SIDE_SERVER){
+		val=1;
+		setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&val,sizeof(val));
+	}
 	//bind
 	Memzero(&sa,sizeof(sa));
 	sa.sin6_family=AF_INET6;
 	sa.sin6_port=htons(port);
 	if(SIDEID!=SIDE_SERVER)
 		get_if_lladdr(dev,&sa);
-	if(bind(sockfd,(struct sockaddr*)&sa,sizeof(sa))<0){
+	if(bind(fd,(struct sockaddr*)&sa,sizeof(sa))<0){
 		td_log(LOGERROR,"Error binding socket: %s.\n",strerror(errno));
-		close(sockfd);
-		sockfd=-1;
-		return;
+		close(fd);
+		return -1;
 	}
+	return fd;
+}
 
+/*initializes the socket on port*/
+void initsocket(short port,const char*dev)
+{
+	sockfd=initifsocket(port,dev,&ifindex);
 }
 
 /*joins DHCP multicast group (server only)*/
@@ -140,6 +250,30 @@ void joindhcp()
 	}
 }
 
+int initunicast(const struct in6_addr*addr,short port)
+{
+	struct sockaddr_in6 sa;
+	int fd,val=1;
+	char buf[64];
+	fd=socket(PF_INET6,SOCK_DGRAM,0);
+	if(fd<0){
+		td_log(LOGERROR,"Error allocating unicast socket: %s.",strerror(errno));
+		return -1;
+	}
+	setsockopt(fd,IPPROTO_IPV6,IPV6_V6ONLY,&val,sizeof(val));
+	setsockopt(fd,SOL_SOCKET,SO_REUSEADDR,&val,sizeof(val));
+	Memzero(&sa,sizeof(sa));
+	sa.sin6_family=AF_INET6;
+	sa.sin6_port=htons(port);
+	Memcpy(&sa.sin6_addr,(void*)addr,16);
+	if(bind(fd,(struct sockaddr*)&sa,sizeof(sa))<0){
+		td_log(LOGERROR,"Error binding unicast socket to %s: %s.",inet_ntop(AF_INET6,addr,buf,sizeof(buf)),strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
 void settargetserver(struct sockaddr_in6*sa)
 {
 	Memzero(sa,sizeof(struct sockaddr_in6));
@@ -148,3 +282,33 @@ void settargetserver(struct sockaddr_in6*sa)
 	sa->sin6_scope_id=ifindex;
 	inet_pton(AF_INET6,DHCP_GROUP,&sa->sin6_addr);
 }
+
+int parseaddrport(const char*str,struct sockaddr_in6*sa,int defport)
+{
+	char buf[128],*p,*e;
+	long port=defport;
+	Memzero(sa,sizeof(struct sockaddr_in6));
+	sa->sin6_family=AF_INET6;
+	Strncpy(buf,str,sizeof(buf));
+	buf[sizeof(buf)-1]=0;
+	p=buf;
+	if(*p=='['){
+		/*[addr]:port*/
+		p++;
+		e=strchr(p,']');
+		if(!e)return -1;
+		*e++=0;
+		if(*e==':'){
+			port=strtol(e+1,&e,10);
+			if(*e)return -1;
+		}else if(*e)return -1;
+	}else if(*p && strspn(p,"0123456789")==strlen(p)){
+		/*port only*/
+		port=strtol(p,0,10);
+		p="::";
+	}
+	if(port<1 || port>65535)return -1;
+	if(inet_pton(AF_INET6,p,&sa->sin6_addr)<=0)return -1;
+	sa->sin6_port=htons(port);
+	return 0;
+}
@@ -22,8 +22,20 @@ extern int sockfd;
 
 /*initializes the socket on port*/
 void initsocket(short,const char*);
+/*opens another socket on port for device dev (eg. one per interface of the client), stores
+  the interface index in idx; returns the file descriptor or -1 on error*/
+int initifsocket(short port,const char*dev,int*idx);
 /*joins DHCP multicast group*/
 void joindhcp();
+/*opens a socket for unicast messages to addr on any interface (server only);
+  returns the file descriptor or -1 on error*/
+struct in6_addr;
+int initunicast(const struct in6_addr*,short port);
+
+/*waits up to secs seconds until each of the num devices has a link-local address
+  that is no longer tentative (DAD finished), using rtnetlink address events;
+  returns the number of devices that are not ready, -1 on error*/
+int waitlladdr(char*const*devs,int num,int secs);
 
 /*checks that the interface still exists; returns true if found*/
 int checkiface();
@@ -32,4 +44,8 @@ int checkiface();
 struct sockaddr_in6;
 void settargetserver(struct sockaddr_in6*);
 
+/*parses "addr", "[addr]:port" or "port" into sa (missing parts are :: and defport);
+  returns 0 on success, -1 on error*/
+int parseaddrport(const char*,struct sockaddr_in6*,int defport);
+
 #endif
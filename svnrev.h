@@ -0,0 +1,2 @@
+/*Autogenerated File*/
+#define SVNREV ""